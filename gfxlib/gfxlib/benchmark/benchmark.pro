@@ -0,0 +1,41 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+CONFIG += c++11
+
+SOURCES += main.cpp \
+    ../path.cpp \
+    ../tessellator.cpp \
+    ../jobs.cpp \
+    ../stroke.cpp \
+    ../delaunay.cpp \
+    ../hittest.cpp \
+    ../bundle.cpp \
+    ../poly2tri/poly2tri/common/shapes.cc \
+    ../poly2tri/poly2tri/sweep/advancing_front.cc \
+    ../poly2tri/poly2tri/sweep/cdt.cc \
+    ../poly2tri/poly2tri/sweep/sweep.cc \
+    ../poly2tri/poly2tri/sweep/sweep_context.cc
+
+INCLUDEPATH += $$_PRO_FILE_PWD_/..
+INCLUDEPATH += $$_PRO_FILE_PWD_/../libtess2/include
+INCLUDEPATH += $$_PRO_FILE_PWD_/../glm
+
+mac {
+    LIBS += $$_PRO_FILE_PWD_/../libtess2/build/mac/release/libtess2.a
+}
+
+win32 {
+    LIBS += $$_PRO_FILE_PWD_/../libtess2/build/windows/release/tess2.lib
+}
+
+unix:!mac {
+    LIBS += $$_PRO_FILE_PWD_/../libtess2/build/linux/release/libtess2.a
+    LIBS += -lpthread
+}
+
+HEADERS += \
+    ../path.h \
+    ../tessellator.h \
+    ../stroke.h
@@ -0,0 +1,340 @@
+// Benchmarks for path processing, run on the tiger and welsh dragon SVG data.
+//
+// Usage: benchmark [repetitions]
+
+#include <iostream>
+#include <sstream>
+#include <chrono>
+#include <string.h>
+#include <stdio.h>
+#include <vector>
+#include <math.h>
+#include "path.h"
+#include "tessellator.h"
+#include "hittest.h"
+#include "bundle.h"
+#include "tiger_paths.h"
+#include "welsh_dragon_paths.h"
+
+// Normally provided by canvas.cpp
+void addExport(const char*) {}
+
+typedef std::chrono::steady_clock Clock;
+
+static double millisecondsSince(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+
+// The stringstream parser appendSvgPath used to be, kept as a baseline.
+// It only understands absolute M, L, C, Q and stops at the first z.
+
+static bool legacyReadFloats(std::stringstream& ss, float* dst, int n)
+{
+    for (int i=0; i<n; i++) {
+        while (ss.peek() == ',') {
+            char c;
+            ss >> c;
+        }
+        ss >> dst[i];
+        if (ss.fail()) return false;
+    }
+    return true;
+}
+
+static void legacyAppendSvgPath(Path* path, const char* pathString)
+{
+    std::stringstream ss;
+    ss << pathString;
+
+    char cmd = 0;
+    float p[6];
+    while (!ss.eof()) {
+        ss >> cmd;
+        if (ss.fail()) return;
+
+        switch(cmd) {
+        case 'M':
+            if (!legacyReadFloats(ss, p, 2)) return;
+            moveTo(path, p[0], p[1]);
+            break;
+        case 'C':
+            legacyReadFloats(ss, p, 6);
+            cubicCurveTo(path, p[0], p[1], p[2], p[3], p[4], p[5]);
+            break;
+        case 'Q':
+            legacyReadFloats(ss, p, 4);
+            quadraticCurveTo(path, p[0], p[1], p[2], p[3]);
+            break;
+        case 'L':
+            legacyReadFloats(ss, p, 2);
+            lineTo(path, p[0], p[1]);
+            break;
+        case 'z':
+            return;
+        case ' ':
+            break;
+        default:
+            return;
+        }
+    }
+}
+
+
+template<int N>
+static void benchmarkSvgParsing(const char* name, const char* (&paths)[N], int reps)
+{
+    size_t bytes = 0;
+    for (int i=0; i<N; i++) {
+        bytes += strlen(paths[i]);
+    }
+
+    double legacyMs = 0;
+    double parserMs = 0;
+
+    // The first round warms up caches and the allocator and isn't counted
+    for (int r=-1; r<reps; r++) {
+        if (r == 0) {
+            legacyMs = 0;
+            parserMs = 0;
+        }
+
+        Clock::time_point start = Clock::now();
+        for (int i=0; i<N; i++) {
+            Path* path = newPath();
+            legacyAppendSvgPath(path, paths[i]);
+            freePath(path);
+        }
+        legacyMs += millisecondsSince(start);
+
+        start = Clock::now();
+        for (int i=0; i<N; i++) {
+            Path* path = newPath();
+            appendSvgPath(path, paths[i]);
+            freePath(path);
+        }
+        parserMs += millisecondsSince(start);
+    }
+
+    legacyMs /= reps;
+    parserMs /= reps;
+
+    std::cout << name << ": " << N << " paths, " << bytes / 1024 << " KiB of path data" << std::endl;
+    std::cout << "  stringstream parser: " << legacyMs << " ms" << std::endl;
+    std::cout << "  appendSvgPath:       " << parserMs << " ms ("
+              << bytes / (parserMs * 1e3) << " MB/s, "
+              << legacyMs / parserMs << "x faster)" << std::endl;
+}
+
+// Smallest angle of a triangle, in degrees. Thin triangles (slivers) rasterise
+// poorly and make bad hit-test geometry.
+static float minAngle(const vec2& a, const vec2& b, const vec2& c)
+{
+    float la = glm::length(b - c);
+    float lb = glm::length(c - a);
+    float lc = glm::length(a - b);
+    if (la == 0 || lb == 0 || lc == 0) return 0;
+
+    // The smallest angle is opposite the shortest side
+    float shortest = glm::min(la, glm::min(lb, lc));
+    float other1, other2;
+    if (shortest == la) { other1 = lb; other2 = lc; }
+    else if (shortest == lb) { other1 = la; other2 = lc; }
+    else { other1 = la; other2 = lb; }
+    float cosine = (other1 * other1 + other2 * other2 - shortest * shortest) / (2 * other1 * other2);
+    return acosf(glm::clamp(cosine, -1.0f, 1.0f)) * (float)(180 / M_PI);
+}
+
+template<int N>
+static void benchmarkTriangulators(const char* name, const char* (&paths)[N], int reps)
+{
+    // Flatten once at one pixel per unit, so only triangulation is timed
+    std::vector<Contours> contours(N);
+    for (int i=0; i<N; i++) {
+        Path* path = newPath();
+        appendSvgPath(path, paths[i]);
+        contours[i] = flattenPath(path, 1);
+        freePath(path);
+    }
+
+    std::cout << name << " triangulation:" << std::endl;
+
+    const char* names[TRIANGULATOR_COUNT] = { "libtess2", "poly2tri" };
+    for (int type=0; type<TRIANGULATOR_COUNT; type++) {
+        TessContext context;
+        Mesh mesh;
+
+        // Paths the backend can't take, which fall back to libtess2
+        int fallbacks = 0;
+        for (int i=0; i<N; i++) {
+            if (!context.backend((TriangulatorType)type)->triangulate(contours[i], &mesh)) fallbacks++;
+        }
+
+        double ms = 0;
+        for (int r=-1; r<reps; r++) {
+            if (r == 0) ms = 0;
+            Clock::time_point start = Clock::now();
+            for (int i=0; i<N; i++) {
+                context.tessellate(contours[i], &mesh, (TriangulatorType)type);
+            }
+            ms += millisecondsSince(start);
+        }
+        ms /= reps;
+
+        size_t triangles = 0;
+        size_t slivers = 0;
+        double angleSum = 0;
+        for (int i=0; i<N; i++) {
+            context.tessellate(contours[i], &mesh, (TriangulatorType)type);
+            for (size_t k=0; k<mesh.indices.size(); k+=3) {
+                float angle = minAngle(mesh.vertices[mesh.indices[k]], mesh.vertices[mesh.indices[k+1]], mesh.vertices[mesh.indices[k+2]]);
+                angleSum += angle;
+                if (angle < 5) slivers++;
+            }
+            triangles += mesh.indices.size() / 3;
+        }
+
+        std::cout << "  " << names[type] << ": " << ms << " ms, "
+                  << triangles << " triangles, mean smallest angle " << angleSum / triangles << " deg, "
+                  << 100.0 * slivers / triangles << "% under 5 deg";
+        if (fallbacks > 0) {
+            std::cout << " (" << fallbacks << " of " << N << " paths fell back to libtess2)";
+        }
+        std::cout << std::endl;
+    }
+}
+
+// Implemented in hittest.cpp
+DLLEXPORT int pickShape(float x, float y, int count, const int* shapes, Path** paths,
+                        const float* transforms, const float* strokeWidths, const float* pixelsPerUnit);
+
+// Picking among copies of every path laid out in a grid, filled and stroked,
+// at points spread over the whole grid
+template<int N>
+static void benchmarkPicking(const char* name, const char* (&paths)[N], int copies)
+{
+    std::vector<Path*> pathList(N);
+    for (int i=0; i<N; i++) {
+        pathList[i] = newPath();
+        appendSvgPath(pathList[i], paths[i]);
+    }
+
+    int count = N * copies;
+    std::vector<int> shapes(count, 0);
+    std::vector<Path*> shapePaths(count);
+    std::vector<float> transforms(count * 5);
+    std::vector<float> strokeWidths(count);
+    std::vector<float> pixelsPerUnit(count, 1);
+    for (int i=0; i<count; i++) {
+        int copy = i / N;
+        shapePaths[i] = pathList[i % N];
+        float* t = &transforms[i * 5];
+        t[0] = t[1] = 1;
+        t[2] = 0;
+        t[3] = (float)(copy % 4) * 1000;
+        t[4] = (float)(copy / 4) * 1000;
+        strokeWidths[i] = copy % 2 ? 2.0f : 0.0f;
+    }
+
+    // Meshes and their indices are built by the first queries to reach them, and
+    // aren't counted here
+    const int queries = 10000;
+    for (int q=0; q<N; q++) {
+        for (int k=0; k<16; k++) {
+            pickShape((float)(k * 50 - 200), (float)(q * 5 - 200), count, &shapes[0], &shapePaths[0], &transforms[0], &strokeWidths[0], &pixelsPerUnit[0]);
+        }
+    }
+
+    int hits = 0;
+    unsigned int seed = 1;
+    Clock::time_point start = Clock::now();
+    for (int q=0; q<queries; q++) {
+        seed = seed * 1664525 + 1013904223;
+        float x = (float)(seed >> 8 & 0xfff) - 500;
+        seed = seed * 1664525 + 1013904223;
+        float y = (float)(seed >> 8 & 0xfff) - 500;
+        if (pickShape(x, y, count, &shapes[0], &shapePaths[0], &transforms[0], &strokeWidths[0], &pixelsPerUnit[0]) >= 0) hits++;
+    }
+    double ms = millisecondsSince(start);
+
+    std::cout << name << " picking, " << count << " shapes:" << std::endl;
+    std::cout << "  " << ms * 1000 / queries << " us per query (" << 100.0 * hits / queries << "% hit)" << std::endl;
+
+    for (int i=0; i<N; i++) {
+        freePath(pathList[i]);
+    }
+}
+
+
+// Startup cost of building every path's fill mesh from its SVG data, against
+// loading the same meshes from a bundle
+template<int N>
+static void benchmarkBundle(const char* name, const char* (&paths)[N], int reps)
+{
+    const char* filename = "benchmark_bundle.nxb";
+    const float pixelsPerUnit = 2;
+
+    MeshBundleWriter* writer = newMeshBundleWriter();
+    double buildMs = 0;
+    for (int r=0; r<reps; r++) {
+        Clock::time_point start = Clock::now();
+        std::vector<Path*> pathList(N);
+        for (int i=0; i<N; i++) {
+            pathList[i] = newPath();
+            appendSvgPath(pathList[i], paths[i]);
+            fillPath(pathList[i], pixelsPerUnit);
+        }
+        buildMs += millisecondsSince(start);
+
+        for (int i=0; i<N; i++) {
+            if (r == 0) addToMeshBundle(writer, paths[i], pathList[i], pixelsPerUnit, 0);
+            freePath(pathList[i]);
+        }
+    }
+    bool written = writeMeshBundle(writer, filename) != 0;
+    freeMeshBundleWriter(writer);
+    if (!written) return;
+
+    double loadMs = 0;
+    for (int r=0; r<reps; r++) {
+        Clock::time_point start = Clock::now();
+        MeshBundle* bundle = openMeshBundle(filename);
+        std::vector<Path*> pathList(N);
+        for (int i=0; i<N; i++) {
+            pathList[i] = bundledPath(bundle, paths[i]);
+            fillPath(pathList[i], pixelsPerUnit);
+        }
+        closeMeshBundle(bundle);
+        loadMs += millisecondsSince(start);
+
+        for (int i=0; i<N; i++) {
+            freePath(pathList[i]);
+        }
+    }
+    remove(filename);
+
+    std::cout << name << " startup, " << N << " filled paths:" << std::endl;
+    std::cout << "  parse and tessellate: " << buildMs / reps << " ms" << std::endl;
+    std::cout << "  load from bundle:     " << loadMs / reps << " ms" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    int reps = argc > 1 ? atoi(argv[1]) : 20;
+    if (reps < 1) reps = 1;
+
+    benchmarkSvgParsing("tiger", tiger, reps);
+    benchmarkSvgParsing("welsh dragon", welsh_dragon, reps);
+
+    benchmarkTriangulators("tiger", tiger, reps);
+    benchmarkTriangulators("welsh dragon", welsh_dragon, reps);
+
+    benchmarkPicking("tiger", tiger, 10);
+    benchmarkPicking("welsh dragon", welsh_dragon, 10);
+
+    benchmarkBundle("tiger", tiger, reps);
+    benchmarkBundle("welsh dragon", welsh_dragon, reps);
+
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "bufferpool.h"
+#include "path.h"
+#include <mutex>
+#include <algorithm>
+#include <iostream>
+
+// Enough for a few thousand typical paths per block. Meshes bigger than this get
+// a block to themselves.
+static const size_t kVertexBlockSize = 4 << 20;
+static const size_t kIndexBlockSize = 2 << 20;
+static const size_t kRangeAlignment = 16;
+
+static BufferPool* gVertexPool;
+static BufferPool* gIndexPool;
+
+// Meshes can be freed by job threads, see prebuildPathMeshes()
+static std::mutex gPoolMutex;
+
+static GLuint gBoundArrayBuffer;
+static GLuint gBoundElementArrayBuffer;
+
+void bindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint& bound = target == GL_ARRAY_BUFFER ? gBoundArrayBuffer : gBoundElementArrayBuffer;
+    if (bound != buffer) {
+        glBindBuffer(target, buffer);
+        bound = buffer;
+    }
+}
+
+
+BufferPool::BufferPool(GLenum target, size_t blockSize)
+    : m_target(target)
+    , m_blockSize(blockSize)
+{
+}
+
+bool BufferPool::alloc(size_t size, Range& range)
+{
+    size = (size + kRangeAlignment - 1) & ~(kRangeAlignment - 1);
+
+    for (size_t b=0; b<m_blocks.size(); b++) {
+        std::map<size_t, size_t>& freeRanges = m_blocks[b].freeRanges;
+        for (auto it = freeRanges.begin(); it != freeRanges.end(); ++it) {
+            if (it->second < size) continue;
+
+            range.buffer = m_blocks[b].buffer;
+            range.offset = it->first;
+            range.size = size;
+            size_t rest = it->second - size;
+            freeRanges.erase(it);
+            if (rest > 0) {
+                freeRanges[range.offset + size] = rest;
+            }
+            return true;
+        }
+    }
+
+    Block block;
+    block.buffer = 0;
+    block.size = std::max(m_blockSize, size);
+    glGenBuffers(1, &block.buffer);
+    if (!block.buffer) return false;
+
+    bindBuffer(m_target, block.buffer);
+    glBufferData(m_target, block.size, 0, GL_STATIC_DRAW);
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        bindBuffer(m_target, 0);
+        glDeleteBuffers(1, &block.buffer);
+        std::cerr << "Error: out of GPU memory for meshes" << std::endl;
+        return false;
+    }
+
+    range.buffer = block.buffer;
+    range.offset = 0;
+    range.size = size;
+    if (block.size > size) {
+        block.freeRanges[size] = block.size - size;
+    }
+    m_blocks.push_back(block);
+    return true;
+}
+
+void BufferPool::free(const Range& range)
+{
+    for (size_t b=0; b<m_blocks.size(); b++) {
+        if (m_blocks[b].buffer != range.buffer) continue;
+
+        // Merge with the free ranges either side
+        std::map<size_t, size_t>& freeRanges = m_blocks[b].freeRanges;
+        size_t offset = range.offset;
+        size_t size = range.size;
+        auto next = freeRanges.lower_bound(offset);
+        if (next != freeRanges.end() && offset + size == next->first) {
+            size += next->second;
+            next = freeRanges.erase(next);
+        }
+        if (next != freeRanges.begin()) {
+            auto prev = std::prev(next);
+            if (prev->first + prev->second == offset) {
+                prev->second += size;
+                return;
+            }
+        }
+        freeRanges[offset] = size;
+        return;
+    }
+}
+
+
+static void releaseMeshBuffers(MeshBuffers* buffers)
+{
+    std::lock_guard<std::mutex> lock(gPoolMutex);
+    if (buffers->vertices.size > 0) gVertexPool->free(buffers->vertices);
+    if (buffers->indices.size > 0) gIndexPool->free(buffers->indices);
+    delete buffers;
+}
+
+// Makes sure range holds at least size bytes. A range that has to move gets half as
+// much again, so meshes that grow every frame (strokes of paths being drawn) don't
+// move every frame.
+static bool reserveRange(BufferPool* pool, BufferPool::Range& range, size_t size)
+{
+    if (size <= range.size) return true;
+
+    bool moving = range.size > 0;
+    if (moving) {
+        pool->free(range);
+        range.size = 0;
+    }
+    return pool->alloc(moving ? size + size / 2 : size, range);
+}
+
+const MeshBuffers* meshBuffers(const Mesh* mesh)
+{
+    MeshBuffers* buffers = mesh->buffers;
+    if (buffers && buffers->version == mesh->version) return buffers;
+    if (mesh->indices.empty()) return 0;
+
+    std::lock_guard<std::mutex> lock(gPoolMutex);
+    if (!gVertexPool) {
+        gVertexPool = new BufferPool(GL_ARRAY_BUFFER, kVertexBlockSize);
+        gIndexPool = new BufferPool(GL_ELEMENT_ARRAY_BUFFER, kIndexBlockSize);
+    }
+
+    if (!buffers) {
+        buffers = new MeshBuffers;
+        buffers->release = releaseMeshBuffers;
+        buffers->vertices.size = 0;
+        buffers->indices.size = 0;
+        mesh->buffers = buffers;
+    }
+
+    size_t vertexCount = mesh->vertices.size();
+    size_t vertexBytes = vertexCount * sizeof(vec2);
+    size_t indexBytes = mesh->indices.size() * sizeof(unsigned int);
+    bool hasExtrusions = !mesh->extrusions.empty();
+    if (!reserveRange(gVertexPool, buffers->vertices, hasExtrusions ? vertexBytes * 2 : vertexBytes)
+            || !reserveRange(gIndexPool, buffers->indices, indexBytes)) {
+        // Draw from client memory instead
+        if (buffers->vertices.size > 0) gVertexPool->free(buffers->vertices);
+        if (buffers->indices.size > 0) gIndexPool->free(buffers->indices);
+        delete buffers;
+        mesh->buffers = 0;
+        return 0;
+    }
+
+    bindBuffer(GL_ARRAY_BUFFER, buffers->vertices.buffer);
+    glBufferSubData(GL_ARRAY_BUFFER, buffers->vertices.offset, vertexBytes, &mesh->vertices[0]);
+    if (hasExtrusions) {
+        glBufferSubData(GL_ARRAY_BUFFER, buffers->vertices.offset + vertexBytes, vertexBytes, &mesh->extrusions[0]);
+    }
+    bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers->indices.buffer);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, buffers->indices.offset, indexBytes, &mesh->indices[0]);
+
+    buffers->version = mesh->version;
+    buffers->vertexCount = vertexCount;
+    buffers->indexCount = mesh->indices.size();
+    buffers->hasExtrusions = hasExtrusions;
+    return buffers;
+}
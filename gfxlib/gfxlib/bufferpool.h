@@ -0,0 +1,63 @@
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+#include <vector>
+#include <map>
+#include "common.h"
+
+struct Mesh;
+
+// Hands out ranges of a few large GL buffers, so each cached mesh doesn't need a
+// buffer object of its own. Free ranges are kept sorted by offset and merged with
+// their neighbours, and new ranges go in the first free one that fits.
+class BufferPool
+{
+public:
+    struct Range {
+        GLuint buffer;
+        size_t offset;
+        size_t size;
+    };
+
+    BufferPool(GLenum target, size_t blockSize);
+
+    bool alloc(size_t size, Range& range);
+    void free(const Range& range);
+
+private:
+    struct Block {
+        GLuint buffer;
+        size_t size;
+        std::map<size_t, size_t> freeRanges;     // offset -> size
+    };
+
+    GLenum m_target;
+    size_t m_blockSize;
+    std::vector<Block> m_blocks;
+};
+
+// Where a mesh lives in the buffer pools. Made when the mesh is first drawn and
+// freed with it; the contents are uploaded again only when mesh->version changes.
+struct MeshBuffers
+{
+    // Returns the ranges to the pools and deletes this. Called through a pointer
+    // so that code which frees meshes doesn't have to link against GL.
+    void (*release)(MeshBuffers* buffers);
+
+    BufferPool::Range vertices;     // the vertices, followed by the extrusions if there are any
+    BufferPool::Range indices;
+    unsigned int version;
+    size_t vertexCount;
+    size_t indexCount;
+    bool hasExtrusions;
+};
+
+// glBindBuffer, skipping calls that wouldn't change the binding. All buffer
+// binding goes through here so the cached state stays right; bind 0 before
+// drawing from client memory.
+void bindBuffer(GLenum target, GLuint buffer);
+
+// The mesh's buffers, uploading it first if it's new or has changed since.
+// Returns null if the buffers couldn't be allocated. Needs a current GL context.
+const MeshBuffers* meshBuffers(const Mesh* mesh);
+
+#endif // BUFFERPOOL_H
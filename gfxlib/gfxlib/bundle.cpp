@@ -0,0 +1,429 @@
+#include "bundle.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <string.h>
+#include <stdio.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static_assert(sizeof(BundleHeader) == 32, "BundleHeader layout changed");
+static_assert(sizeof(BundleLevel) == 120, "BundleLevel layout changed");
+static_assert(sizeof(BundleEntry) == 48, "BundleEntry layout changed");
+static_assert(sizeof(vec2) == 8, "vec2 must be two packed floats");
+
+#ifdef _WIN32
+// Bundles open for reading, so a bundle's file can be unmapped before it's replaced
+static std::vector<MeshBundle*> gOpenBundles;
+
+static std::string fullPath(const char* filename)
+{
+    char path[MAX_PATH];
+    DWORD length = GetFullPathNameA(filename, MAX_PATH, path, 0);
+    return length > 0 && length < MAX_PATH ? std::string(path, length) : std::string(filename);
+}
+#endif
+
+// 64 bit FNV-1a
+uint64_t bundleKey(const char* source)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char* p = (const unsigned char*)source; *p; p++) {
+        hash = (hash ^ *p) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+
+MeshBundle::MeshBundle()
+    : m_data(0)
+    , m_size(0)
+    , m_entries(0)
+    , m_entryCount(0)
+    , m_refs(1)
+#ifdef _WIN32
+    , m_file(INVALID_HANDLE_VALUE)
+    , m_mapping(0)
+#endif
+{
+}
+
+MeshBundle::~MeshBundle()
+{
+#ifdef _WIN32
+    gOpenBundles.erase(std::remove(gOpenBundles.begin(), gOpenBundles.end(), this), gOpenBundles.end());
+    if (m_data && m_copy.empty()) UnmapViewOfFile(m_data);
+    if (m_mapping) CloseHandle(m_mapping);
+    if (m_file != INVALID_HANDLE_VALUE) CloseHandle(m_file);
+#else
+    if (m_data) munmap((void*)m_data, m_size);
+#endif
+}
+
+void MeshBundle::release()
+{
+    if (--m_refs == 0) {
+        delete this;
+    }
+}
+
+MeshBundle* MeshBundle::open(const char* filename)
+{
+    MeshBundle* bundle = new MeshBundle;
+
+#ifdef _WIN32
+    bundle->m_file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    LARGE_INTEGER size;
+    if (bundle->m_file == INVALID_HANDLE_VALUE || !GetFileSizeEx(bundle->m_file, &size)) {
+        delete bundle;
+        return 0;
+    }
+    bundle->m_size = (size_t)size.QuadPart;
+    if (bundle->m_size >= sizeof(BundleHeader)) {
+        bundle->m_mapping = CreateFileMappingA(bundle->m_file, 0, PAGE_READONLY, 0, 0, 0);
+        if (bundle->m_mapping) {
+            bundle->m_data = (const char*)MapViewOfFile(bundle->m_mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+    }
+#else
+    int fd = ::open(filename, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) close(fd);
+        delete bundle;
+        return 0;
+    }
+    bundle->m_size = (size_t)st.st_size;
+    if (bundle->m_size >= sizeof(BundleHeader)) {
+        void* data = mmap(0, bundle->m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        bundle->m_data = data == MAP_FAILED ? 0 : (const char*)data;
+    }
+    // The mapping keeps the file open
+    close(fd);
+#endif
+
+    if (!bundle->m_data || !bundle->validate()) {
+        std::cerr << "Error: " << filename << " is not a valid mesh bundle" << std::endl;
+        delete bundle;
+        return 0;
+    }
+
+    const BundleHeader* header = (const BundleHeader*)bundle->m_data;
+    bundle->m_entries = bundle->array<BundleEntry>(header->entries);
+    bundle->m_entryCount = header->entryCount;
+#ifdef _WIN32
+    bundle->m_filename = fullPath(filename);
+    gOpenBundles.push_back(bundle);
+#endif
+    return bundle;
+}
+
+#ifdef _WIN32
+void MeshBundle::unmap()
+{
+    if (!m_copy.empty()) return;
+    m_copy.resize((m_size + 7) / 8);
+    memcpy(&m_copy[0], m_data, m_size);
+    UnmapViewOfFile(m_data);
+    CloseHandle(m_mapping);
+    CloseHandle(m_file);
+    m_mapping = 0;
+    m_file = INVALID_HANDLE_VALUE;
+
+    m_data = (const char*)&m_copy[0];
+    const BundleHeader* header = (const BundleHeader*)m_data;
+    m_entries = array<BundleEntry>(header->entries);
+}
+
+void MeshBundle::unmapFile(const char* filename)
+{
+    std::string path = fullPath(filename);
+    for (size_t i=0; i<gOpenBundles.size(); i++) {
+        if (_stricmp(gOpenBundles[i]->m_filename.c_str(), path.c_str()) == 0) {
+            gOpenBundles[i]->unmap();
+        }
+    }
+}
+#endif
+
+bool MeshBundle::inside(uint64_t offset, uint64_t count, uint64_t size) const
+{
+    return offset % 8 == 0 && offset <= m_size && count <= (m_size - offset) / size;
+}
+
+static bool indicesBelow(const uint32_t* indices, uint32_t count, uint32_t vertexCount)
+{
+    for (uint32_t i=0; i<count; i++) {
+        if (indices[i] >= vertexCount) return false;
+    }
+    return true;
+}
+
+// Checks the header, that every array lies inside the file, and that the arrays
+// agree with each other, so paths can use anything in the bundle without checking
+// it again. This reads the whole file, once, when it's opened.
+bool MeshBundle::validate() const
+{
+    const BundleHeader* header = (const BundleHeader*)m_data;
+    if (memcmp(header->magic, kBundleMagic, sizeof(kBundleMagic)) != 0) return false;
+    if (header->version != kBundleVersion) {
+        std::cerr << "Error: mesh bundle version " << header->version << " isn't supported, expected " << kBundleVersion << std::endl;
+        return false;
+    }
+    if (header->size != m_size) return false;
+
+    if (!inside(header->entries, header->entryCount, sizeof(BundleEntry))) return false;
+    const BundleEntry* entries = array<BundleEntry>(header->entries);
+    for (uint32_t i=0; i<header->entryCount; i++) {
+        const BundleEntry& e = entries[i];
+        if (i > 0 && entries[i-1].key >= e.key) return false;
+        if (!inside(e.commands, e.commandCount, 1) || !inside(e.points, e.pointCount, sizeof(vec2))
+                || !inside(e.levels, e.levelCount, sizeof(BundleLevel))) {
+            return false;
+        }
+
+        const BundleLevel* levels = array<BundleLevel>(e.levels);
+        for (uint32_t j=0; j<e.levelCount; j++) {
+            if (j > 0 && levels[j-1].bucket >= levels[j].bucket) return false;
+            if (!validateLevel(levels[j])) return false;
+        }
+    }
+    return true;
+}
+
+bool MeshBundle::validateLevel(const BundleLevel& l) const
+{
+    if (!inside(l.contourPoints, l.contourPointCount, sizeof(vec2))
+            || !inside(l.contourOffsets, (uint64_t)l.contourCount + 1, sizeof(uint32_t))
+            || !inside(l.contourClosed, l.contourCount, 1)
+            || !inside(l.fillVertices, l.fillVertexCount, sizeof(vec2))
+            || !inside(l.fillIndices, l.fillIndexCount, sizeof(uint32_t))
+            || !inside(l.strokeVertices, l.strokeVertexCount, sizeof(vec2))
+            || !inside(l.strokeExtrusions, l.strokeVertexCount, sizeof(vec2))
+            || !inside(l.strokeIndices, l.strokeIndexCount, sizeof(uint32_t))) {
+        return false;
+    }
+
+    if (l.triangulator < -1 || l.triangulator >= TRIANGULATOR_COUNT) return false;
+    if (l.strokeJoin != -1 && (l.strokeJoin < JOIN_MITER || l.strokeJoin > JOIN_BEVEL)) return false;
+    if (l.strokeCap < CAP_BUTT || l.strokeCap > CAP_SQUARE) return false;
+
+    // Every contour has at least its starting point, and an open one must exist
+    if (l.contourOpen && l.contourCount == 0) return false;
+    const uint32_t* offsets = array<uint32_t>(l.contourOffsets);
+    if (offsets[0] != 0 || offsets[l.contourCount] != l.contourPointCount) return false;
+    for (uint32_t i=0; i<l.contourCount; i++) {
+        if (offsets[i] >= offsets[i+1]) return false;
+    }
+
+    return indicesBelow(array<uint32_t>(l.fillIndices), l.fillIndexCount, l.fillVertexCount)
+        && indicesBelow(array<uint32_t>(l.strokeIndices), l.strokeIndexCount, l.strokeVertexCount);
+}
+
+const BundleEntry* MeshBundle::find(uint64_t key) const
+{
+    const BundleEntry* end = m_entries + m_entryCount;
+    const BundleEntry* e = std::lower_bound(m_entries, end, key, [](const BundleEntry& a, uint64_t k) {
+        return a.key < k;
+    });
+    return e != end && e->key == key ? e : 0;
+}
+
+const BundleLevel* MeshBundle::level(const BundleEntry* entry, int bucket) const
+{
+    const BundleLevel* levels = array<BundleLevel>(entry->levels);
+    for (uint32_t i=0; i<entry->levelCount; i++) {
+        if (levels[i].bucket == bucket) return &levels[i];
+    }
+    return 0;
+}
+
+void MeshBundle::loadContours(const BundleLevel* level, Contours& contours) const
+{
+    const vec2* points = array<vec2>(level->contourPoints);
+    const uint32_t* offsets = array<uint32_t>(level->contourOffsets);
+    const uint8_t* closed = array<uint8_t>(level->contourClosed);
+    contours.points.assign(points, points + level->contourPointCount);
+    contours.offsets.assign(offsets, offsets + level->contourCount + 1);
+    contours.closed.assign(closed, closed + level->contourCount);
+}
+
+void MeshBundle::loadFill(const BundleLevel* level, Mesh* mesh) const
+{
+    const vec2* vertices = array<vec2>(level->fillVertices);
+    const uint32_t* indices = array<uint32_t>(level->fillIndices);
+    mesh->vertices.assign(vertices, vertices + level->fillVertexCount);
+    mesh->extrusions.clear();
+    mesh->indices.assign(indices, indices + level->fillIndexCount);
+}
+
+void MeshBundle::loadStroke(const BundleLevel* level, Mesh* mesh) const
+{
+    const vec2* vertices = array<vec2>(level->strokeVertices);
+    const vec2* extrusions = array<vec2>(level->strokeExtrusions);
+    const uint32_t* indices = array<uint32_t>(level->strokeIndices);
+    mesh->vertices.assign(vertices, vertices + level->strokeVertexCount);
+    mesh->extrusions.assign(extrusions, extrusions + level->strokeVertexCount);
+    mesh->indices.assign(indices, indices + level->strokeIndexCount);
+}
+
+
+MeshBundleWriter::Level::Level()
+    : bucket(0)
+    , triangulator(-1)
+    , stroked(false)
+    , flattenedPos(0, 0)
+    , contourOpen(false)
+{
+}
+
+MeshBundleWriter::Level& MeshBundleWriter::level(uint64_t key, const std::vector<uint8_t>& commands, const std::vector<vec2>& points, int bucket)
+{
+    Entry& entry = m_entries[key];
+    if (entry.commands != commands || entry.points != points) {
+        entry.commands = commands;
+        entry.points = points;
+        entry.levels.clear();
+    }
+
+    for (size_t i=0; i<entry.levels.size(); i++) {
+        if (entry.levels[i].bucket == bucket) return entry.levels[i];
+    }
+    entry.levels.push_back(Level());
+    entry.levels.back().bucket = bucket;
+    return entry.levels.back();
+}
+
+// Appends an array to the file buffer at the next 8 byte boundary and returns its offset
+template <typename T>
+static uint64_t appendArray(std::vector<char>& out, const T* data, size_t count)
+{
+    out.resize((out.size() + 7) & ~(size_t)7);
+    uint64_t offset = out.size();
+    if (count > 0) {
+        out.insert(out.end(), (const char*)data, (const char*)(data + count));
+    }
+    return offset;
+}
+
+bool MeshBundleWriter::write(const char* filename) const
+{
+    std::vector<char> out(sizeof(BundleHeader));
+    std::vector<BundleEntry> entries;
+    std::vector<BundleLevel> levels;
+
+    // std::map keeps the entries sorted by key, as lookups need
+    for (auto it = m_entries.begin(); it != m_entries.end(); ++it) {
+        const Entry& e = it->second;
+        levels.clear();
+        for (size_t i=0; i<e.levels.size(); i++) {
+            const Level& src = e.levels[i];
+            BundleLevel l;
+            memset(&l, 0, sizeof(l));
+            l.bucket = src.bucket;
+            l.triangulator = src.triangulator;
+            l.strokeJoin = src.stroked ? (int32_t)src.strokeStyle.join : -1;
+            l.strokeCap = (int32_t)src.strokeStyle.cap;
+            l.miterLimit = src.strokeStyle.miterLimit;
+            l.flattenedPos[0] = src.flattenedPos.x;
+            l.flattenedPos[1] = src.flattenedPos.y;
+            l.contourOpen = src.contourOpen;
+
+            l.contourCount = (uint32_t)src.contours.count();
+            l.contourPointCount = (uint32_t)src.contours.points.size();
+            l.contourPoints = appendArray(out, src.contours.points.data(), src.contours.points.size());
+            l.contourOffsets = appendArray(out, src.contours.offsets.data(), src.contours.offsets.size());
+            l.contourClosed = appendArray(out, src.contours.closed.data(), src.contours.closed.size());
+
+            l.fillVertexCount = (uint32_t)src.fill.vertices.size();
+            l.fillIndexCount = (uint32_t)src.fill.indices.size();
+            l.fillVertices = appendArray(out, src.fill.vertices.data(), src.fill.vertices.size());
+            l.fillIndices = appendArray(out, src.fill.indices.data(), src.fill.indices.size());
+
+            l.strokeVertexCount = (uint32_t)src.stroke.vertices.size();
+            l.strokeIndexCount = (uint32_t)src.stroke.indices.size();
+            l.strokeVertices = appendArray(out, src.stroke.vertices.data(), src.stroke.vertices.size());
+            l.strokeExtrusions = appendArray(out, src.stroke.extrusions.data(), src.stroke.extrusions.size());
+            l.strokeIndices = appendArray(out, src.stroke.indices.data(), src.stroke.indices.size());
+            levels.push_back(l);
+        }
+        std::sort(levels.begin(), levels.end(), [](const BundleLevel& a, const BundleLevel& b) {
+            return a.bucket < b.bucket;
+        });
+
+        BundleEntry entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.key = it->first;
+        entry.commandCount = (uint32_t)e.commands.size();
+        entry.pointCount = (uint32_t)e.points.size();
+        entry.levelCount = (uint32_t)levels.size();
+        entry.commands = appendArray(out, e.commands.data(), e.commands.size());
+        entry.points = appendArray(out, e.points.data(), e.points.size());
+        entry.levels = appendArray(out, levels.data(), levels.size());
+        entries.push_back(entry);
+    }
+
+    BundleHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kBundleMagic, sizeof(kBundleMagic));
+    header.version = kBundleVersion;
+    header.entryCount = (uint32_t)entries.size();
+    header.entries = appendArray(out, entries.data(), entries.size());
+    header.size = out.size();
+    memcpy(&out[0], &header, sizeof(header));
+
+    // Write to a temporary file and move it into place, since the old file may be
+    // mapped by an open bundle and must not change underneath it
+    std::string temp = std::string(filename) + ".tmp";
+    std::ofstream file(temp.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file.write(out.data(), out.size()) || (file.close(), !file)) {
+        std::cerr << "Error: couldn't write mesh bundle " << temp << std::endl;
+        remove(temp.c_str());
+        return false;
+    }
+#ifdef _WIN32
+    // Windows won't replace a mapped file, or rename over any existing one
+    MeshBundle::unmapFile(filename);
+    if (!MoveFileExA(temp.c_str(), filename, MOVEFILE_REPLACE_EXISTING)) {
+#else
+    if (rename(temp.c_str(), filename) != 0) {
+#endif
+        std::cerr << "Error: couldn't write mesh bundle " << filename << std::endl;
+        remove(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+
+LUAEXPORT(MeshBundle* openMeshBundle(const char* filename))
+{
+    return MeshBundle::open(filename);
+}
+
+LUAEXPORT(void closeMeshBundle(MeshBundle* bundle))
+{
+    if (bundle) bundle->release();
+}
+
+LUAEXPORT(MeshBundleWriter* newMeshBundleWriter())
+{
+    return new MeshBundleWriter;
+}
+
+LUAEXPORT(void freeMeshBundleWriter(MeshBundleWriter* writer))
+{
+    delete writer;
+}
+
+LUAEXPORT(int writeMeshBundle(MeshBundleWriter* writer, const char* filename))
+{
+    return writer->write(filename) ? 1 : 0;
+}
@@ -0,0 +1,180 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+#include <vector>
+#include <map>
+#include <string>
+#include <stdint.h>
+#include "common.h"
+#include "path.h"
+#include "stroke.h"
+#include "tessellator.h"
+
+// Precompiled path geometry, so a script's paths don't have to be parsed, flattened
+// and triangulated again on every run.
+//
+// A bundle holds one entry per source path (SVG path data, or a font glyph), keyed by
+// a hash of the source. Each entry stores the path's commands and, for each flatten
+// tolerance it was built at, the flattened contours with its fill and stroke meshes.
+// Bundles are memory-mapped when opened and read in place. Opening one checks every
+// offset, count and index in it, so a damaged file is refused rather than read
+// outside its arrays later.
+//
+// File layout, in native byte order: a BundleHeader, then the arrays of every entry,
+// then the entry table sorted by key. All offsets are from the start of the file and
+// every array starts on an 8 byte boundary.
+
+static const char kBundleMagic[8] = {'N', 'X', 'B', 'U', 'N', 'D', 'L', 'E'};
+static const uint32_t kBundleVersion = 1;
+
+struct BundleHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t entryCount;
+    uint64_t entries;           // offset of the BundleEntry table
+    uint64_t size;              // of the whole file, to catch truncated files
+};
+
+// Geometry of one entry at one tolerance bucket
+struct BundleLevel
+{
+    int32_t bucket;
+    int32_t triangulator;       // TriangulatorType of the fill mesh, -1 if there isn't one
+    int32_t strokeJoin;         // style of the stroke mesh, -1 if there isn't one
+    int32_t strokeCap;
+    float miterLimit;
+
+    // Flattener state after the last command, so more commands can be added later
+    float flattenedPos[2];
+    uint32_t contourOpen;
+
+    uint32_t contourCount;
+    uint32_t contourPointCount;
+    uint32_t fillVertexCount;
+    uint32_t fillIndexCount;
+    uint32_t strokeVertexCount;
+    uint32_t strokeIndexCount;
+
+    uint64_t contourPoints;     // vec2[contourPointCount]
+    uint64_t contourOffsets;    // uint32_t[contourCount + 1]
+    uint64_t contourClosed;     // uint8_t[contourCount]
+    uint64_t fillVertices;      // vec2[fillVertexCount]
+    uint64_t fillIndices;       // uint32_t[fillIndexCount]
+    uint64_t strokeVertices;    // vec2[strokeVertexCount]
+    uint64_t strokeExtrusions;  // vec2[strokeVertexCount]
+    uint64_t strokeIndices;     // uint32_t[strokeIndexCount]
+};
+
+struct BundleEntry
+{
+    uint64_t key;
+    uint64_t commands;          // uint8_t[commandCount], PathCommand values
+    uint64_t points;            // vec2[pointCount]
+    uint64_t levels;            // BundleLevel[levelCount], sorted by bucket
+    uint32_t commandCount;
+    uint32_t pointCount;
+    uint32_t levelCount;
+    uint32_t reserved;
+};
+
+// Key of the entry for a path made from source
+uint64_t bundleKey(const char* source);
+
+// A bundle file opened for reading
+class MeshBundle
+{
+public:
+    static MeshBundle* open(const char* filename);
+
+    // The file stays mapped until the bundle is closed and every path loaded from it is freed
+    void retain() { m_refs++; }
+    void release();
+
+    const BundleEntry* find(uint64_t key) const;
+    const BundleEntry* entry(size_t index) const { return &m_entries[index]; }
+    size_t entryIndex(const BundleEntry* entry) const { return entry - m_entries; }
+    const BundleLevel* level(const BundleEntry* entry, int bucket) const;
+
+    template <typename T>
+    const T* array(uint64_t offset) const {
+        return (const T*)(m_data + offset);
+    }
+
+    // Copy a level's geometry out of the mapping
+    void loadContours(const BundleLevel* level, Contours& contours) const;
+    void loadFill(const BundleLevel* level, Mesh* mesh) const;
+    void loadStroke(const BundleLevel* level, Mesh* mesh) const;
+
+#ifdef _WIN32
+    // Windows won't replace a file while it's mapped, so bundles opened from it
+    // are copied into memory and unmapped first. Pointers into them change.
+    static void unmapFile(const char* filename);
+#endif
+
+private:
+    MeshBundle();
+    ~MeshBundle();
+
+    bool inside(uint64_t offset, uint64_t count, uint64_t size) const;
+    bool validate() const;
+    bool validateLevel(const BundleLevel& level) const;
+
+    const char* m_data;
+    size_t m_size;
+    const BundleEntry* m_entries;
+    size_t m_entryCount;
+    int m_refs;
+#ifdef _WIN32
+    void unmap();
+
+    void* m_file;
+    void* m_mapping;
+    std::string m_filename;         // full path, to find the bundles unmapFile() means
+    std::vector<uint64_t> m_copy;   // the file's contents once unmapped
+#endif
+};
+
+// Collects prebuilt geometry and writes it out as a bundle
+class MeshBundleWriter
+{
+public:
+    struct Level
+    {
+        Level();
+
+        int bucket;
+        int triangulator;           // -1 until a fill mesh is added
+        bool stroked;
+        StrokeStyle strokeStyle;
+        vec2 flattenedPos;
+        bool contourOpen;
+        Contours contours;
+        Mesh fill;
+        Mesh stroke;
+    };
+
+    // The level to store the path's geometry at bucket in. Adding the same key again
+    // replaces the entry if its commands have changed.
+    Level& level(uint64_t key, const std::vector<uint8_t>& commands, const std::vector<vec2>& points, int bucket);
+
+    bool write(const char* filename) const;
+
+private:
+    struct Entry
+    {
+        std::vector<uint8_t> commands;
+        std::vector<vec2> points;
+        std::vector<Level> levels;
+    };
+
+    std::map<uint64_t, Entry> m_entries;
+};
+
+
+DLLEXPORT MeshBundle* openMeshBundle(const char* filename);
+DLLEXPORT void closeMeshBundle(MeshBundle* bundle);
+DLLEXPORT MeshBundleWriter* newMeshBundleWriter();
+DLLEXPORT void freeMeshBundleWriter(MeshBundleWriter* writer);
+DLLEXPORT int writeMeshBundle(MeshBundleWriter* writer, const char* filename);
+
+#endif // BUNDLE_H
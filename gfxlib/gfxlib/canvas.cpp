@@ -2,11 +2,20 @@
 #include <GLFW/glfw3.h>
 #include "canvas.h"
 #include "path.h"
+#include "shader.h"
+#include "tessellator.h"
+#include "bufferpool.h"
+#include "frametiming.h"
+#include "offscreen.h"
+#include "capture.h"
+#include "inputevents.h"
 #include <vector>
 #include <thread>
 #include <queue>
 #include <mutex>
+#include <chrono>
 #include <stdio.h>      // fileno()
+#include <string.h>
 #include <unistd.h>     // close()
 
 // MSVC doesn't define M_PI unless you do this
@@ -58,25 +67,32 @@ public:
 
     GLFWwindow* m_window;
     GLFWmonitor* m_monitor;
+    OffscreenTarget* m_offscreen;   // drawing goes here instead of to a window, see createOffscreenCanvas()
+    bool m_glfwReady;               // glfwInit() succeeded, which needs a display
+    bool m_shouldClose;             // for offscreen canvases, which have no window to hold it
 
     vec4 m_clearColor;
     bool m_wireframe;
+    bool m_hasStencil;
+    bool m_hasInstancing;       // GL_ARB_instanced_arrays and GL_ARB_draw_instanced, for drawBatch()
 
     std::queue<std::string> m_inputQueue;
     std::thread m_inputThread;
     std::mutex m_inputQueueMutex;
-
-    void (*m_mouseButtonCallback)(int, int, int);
-    void (*m_scrollCallback)(double, double);
-    void (*m_charCallback)(unsigned int);
-    //void (*m_cursorEnterCallback)(int);
-    void (*m_cursorPosCallback)(double, double);
-    void (*m_keyCallback)(int, int, int, int);
-
 };
 
 static Canvas g_canvas;
 
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+// Instancing entry points, loaded at run time since they're extensions to GL 2.1
+typedef void (APIENTRY* VertexAttribDivisorFunc)(GLuint index, GLuint divisor);
+typedef void (APIENTRY* DrawElementsInstancedFunc)(GLenum mode, GLsizei count, GLenum type, const GLvoid* indices, GLsizei primcount);
+static VertexAttribDivisorFunc gVertexAttribDivisor;
+static DrawElementsInstancedFunc gDrawElementsInstanced;
+
 static void inputThreadRoutine()
 {
     std::string line;
@@ -86,40 +102,189 @@ static void inputThreadRoutine()
     }
 }
 
+static void pushEvent(int type, double x, double y, int code, int scancode, int action, int mods)
+{
+    InputEvent event;
+    event.time = canvasTime();
+    event.x = x;
+    event.y = y;
+    event.type = type;
+    event.code = code;
+    event.scancode = scancode;
+    event.action = action;
+    event.mods = mods;
+    pushInputEvent(event);
+}
+
+// Makes a position in window coordinates relative to the center of the window,
+// increasing up and right, the same as cursorPos()
+static void centerCursorPos(GLFWwindow* window, double& x, double& y)
+{
+    int width, height;
+    glfwGetWindowSize(window, &width, &height);
+    x = x - width/2;
+    y = height/2 - y;
+}
+
+static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods)
+{
+    double x, y;
+    glfwGetCursorPos(window, &x, &y);
+    centerCursorPos(window, x, y);
+    pushEvent(INPUT_MOUSE_BUTTON, x, y, button, 0, action, mods);
+}
+
+static void scrollCallback(GLFWwindow*, double xoffset, double yoffset)
+{
+    pushEvent(INPUT_SCROLL, xoffset, yoffset, 0, 0, 0, 0);
+}
+
+static void charCallback(GLFWwindow*, unsigned int codepoint)
+{
+    pushEvent(INPUT_CHAR, 0, 0, (int)codepoint, 0, 0, 0);
+}
+
+static void cursorPosCallback(GLFWwindow* window, double x, double y)
+{
+    centerCursorPos(window, x, y);
+    pushEvent(INPUT_CURSOR, x, y, 0, 0, 0, 0);
+}
+
+static void keyCallback(GLFWwindow*, int key, int scancode, int action, int mods)
+{
+    pushEvent(INPUT_KEY, 0, 0, key, scancode, action, mods);
+}
+
 
 
 Canvas::Canvas()
     : m_window(0)
     , m_monitor(0)
+    , m_offscreen(0)
+    , m_shouldClose(false)
     , m_clearColor(0, 0, 0, 0)
     , m_wireframe(false)
-{
-    assert(glfwInit());
+    , m_hasStencil(false)
+    , m_hasInstancing(false)
+{
+    m_glfwReady = glfwInit() == GL_TRUE;
+    if (!m_glfwReady) {
+        // Not fatal, offscreen canvases can do without
+        std::cerr << "Warning: failed to initialise GLFW, only offscreen canvases will work" << std::endl;
+        return;
+    }
+
     glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_TRUE);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 2);
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
     //glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_SAMPLES, 16);
     glfwWindowHint(GLFW_DEPTH_BITS, 0);
-    glfwWindowHint(GLFW_STENCIL_BITS, 0);
+    glfwWindowHint(GLFW_STENCIL_BITS, 0);       // only needed for stencil fills, see setWindowHint()
     glfwWindowHint(GLFW_REFRESH_RATE, 0);       // highest available, full screen only
 }
 
 Canvas::~Canvas()
 {
-    glfwTerminate();
+    if (m_glfwReady) {
+        glfwTerminate();
+    }
+}
+
+// Stroke meshes carry extrusion vectors, everything else gets a constant zero
+static void setExtrusionArray(const vec2* extrusions)
+{
+    static bool extrusionArrayEnabled = false;
+    if (extrusions) {
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, extrusions);
+        if (!extrusionArrayEnabled) {
+            glEnableVertexAttribArray(1);
+            extrusionArrayEnabled = true;
+        }
+    } else if (extrusionArrayEnabled) {
+        glDisableVertexAttribArray(1);
+        glVertexAttrib2f(1, 0, 0);
+        extrusionArrayEnabled = false;
+    }
 }
 
+// Meshes are drawn from the buffer pools, where they're uploaded when first drawn
+// and again only after they change. If that fails they're drawn from client memory.
 static void drawMesh(const Mesh* mesh) {
-    if (!mesh) return;
+    if (!mesh || mesh->indices.empty()) return;
+
+    const MeshBuffers* buffers = meshBuffers(mesh);
+    if (buffers) {
+        // Pointers are offsets into the bound buffers
+        const char* vertices = (const char*)0 + buffers->vertices.offset;
+        bindBuffer(GL_ARRAY_BUFFER, buffers->vertices.buffer);
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers->indices.buffer);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, vertices);
+        setExtrusionArray(buffers->hasExtrusions ? (const vec2*)(vertices + buffers->vertexCount * sizeof(vec2)) : 0);
+        glDrawElements(g_canvas.m_wireframe ? GL_LINES : GL_TRIANGLES,
+                       (GLsizei)buffers->indexCount,
+                       GL_UNSIGNED_INT,
+                       (const char*)0 + buffers->indices.offset);
+        return;
+    }
 
+    bindBuffer(GL_ARRAY_BUFFER, 0);
+    bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, &mesh->vertices[0]);
+    setExtrusionArray(mesh->extrusions.empty() ? 0 : &mesh->extrusions[0]);
 
     glDrawElements(g_canvas.m_wireframe ? GL_LINES : GL_TRIANGLES,
                    (GLsizei)mesh->indices.size(),
                    GL_UNSIGNED_INT,
                    &mesh->indices[0]);
+}
+
+// Fills contours without triangulating them. A triangle fan from the first point of
+// each contour covers every pixel inside it once per winding, so counting the fan
+// triangles in the stencil buffer gives each pixel's winding number (or its parity).
+// A rectangle over the bounds then draws the pixels the fill rule accepts, and
+// clears the stencil again on the way.
+static void drawStencilFill(const Contours& contours, bool nonzero)
+{
+    if (contours.points.empty()) return;
+
+    vec2 lo = contours.points[0];
+    vec2 hi = lo;
+    for (size_t i=1; i<contours.points.size(); i++) {
+        lo = glm::min(lo, contours.points[i]);
+        hi = glm::max(hi, contours.points[i]);
+    }
+
+    glEnable(GL_STENCIL_TEST);
+    glStencilMask(0xff);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glStencilFunc(GL_ALWAYS, 0, 0xff);
+    if (nonzero) {
+        // Counter-clockwise triangles add one, clockwise ones subtract one
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+    } else {
+        glStencilOp(GL_KEEP, GL_KEEP, GL_INVERT);
+    }
+
+    // The contours change too often to be worth uploading
+    bindBuffer(GL_ARRAY_BUFFER, 0);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, &contours.points[0]);
+    setExtrusionArray(0);
+    for (size_t i=0; i<contours.count(); i++) {
+        if (contours.contourSize(i) < 3) continue;
+        glDrawArrays(GL_TRIANGLE_FAN, (GLint)contours.offsets[i], (GLsizei)contours.contourSize(i));
+    }
 
+    // Cover
+    vec2 cover[4] = { lo, vec2(hi.x, lo.y), hi, vec2(lo.x, hi.y) };
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glStencilFunc(GL_NOTEQUAL, 0, 0xff);
+    glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+    glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, cover);
+    glDrawArrays(GL_TRIANGLE_FAN, 0, 4);
+
+    glDisable(GL_STENCIL_TEST);
 }
 
 LUAEXPORT(bool getNextInputLine(char* dest, int bufsize))
@@ -137,6 +302,36 @@ LUAEXPORT(void setWindowHint(int target, int hint))
     glfwWindowHint(target, hint);
 }
 
+bool canvasExtensionSupported(const char* name)
+{
+    if (g_canvas.m_offscreen) {
+        return OffscreenTarget::extensionSupported(name);
+    }
+    return glfwExtensionSupported(name) == GL_TRUE;
+}
+
+void* canvasProcAddress(const char* name)
+{
+    if (g_canvas.m_offscreen) {
+        return OffscreenTarget::procAddress(name);
+    }
+    return (void*)glfwGetProcAddress(name);
+}
+
+// Set up what every canvas needs once its context is current
+static void initContext()
+{
+    if (canvasExtensionSupported("GL_ARB_instanced_arrays") && canvasExtensionSupported("GL_ARB_draw_instanced")) {
+        gVertexAttribDivisor = (VertexAttribDivisorFunc)canvasProcAddress("glVertexAttribDivisorARB");
+        gDrawElementsInstanced = (DrawElementsInstancedFunc)canvasProcAddress("glDrawElementsInstancedARB");
+        g_canvas.m_hasInstancing = gVertexAttribDivisor && gDrawElementsInstanced;
+    }
+
+    // Start input thread
+    g_canvas.m_inputThread = std::thread(inputThreadRoutine);
+    g_canvas.m_inputThread.detach();     // let the OS terminate it with the process
+}
+
 LUAEXPORT(bool createCanvas(int width, int height, const char* title, bool fullscreen, bool vsync, int monitor, int bitsPerChannel))
 {
     // Convert monitor parameter to 0-based index
@@ -193,10 +388,39 @@ LUAEXPORT(bool createCanvas(int width, int height, const char* title, bool fulls
 
     glfwSwapInterval(vsync ? 1 : 0);
 
-    // Start input thread
-    g_canvas.m_inputThread = std::thread(inputThreadRoutine);
-    g_canvas.m_inputThread.detach();     // let the OS terminate it with the process
+    const GLFWvidmode* mode = glfwGetVideoMode(g_canvas.m_monitor ? g_canvas.m_monitor : glfwGetPrimaryMonitor());
+    setFrameTimingRefresh(mode ? mode->refreshRate : 0, vsync);
+
+    GLint stencilBits = 0;
+    glGetIntegerv(GL_STENCIL_BITS, &stencilBits);
+    g_canvas.m_hasStencil = stencilBits > 0;
+
+    // Events are queued for Lua to take, see inputevents.h
+    glfwSetMouseButtonCallback(g_canvas.m_window, mouseButtonCallback);
+    glfwSetScrollCallback(g_canvas.m_window, scrollCallback);
+    glfwSetCharCallback(g_canvas.m_window, charCallback);
+    glfwSetCursorPosCallback(g_canvas.m_window, cursorPosCallback);
+    glfwSetKeyCallback(g_canvas.m_window, keyCallback);
+
+    initContext();
+    return true;
+}
+
+// Draws into a framebuffer object instead of a window, so no display is needed.
+// samples is clamped to what the driver supports.
+LUAEXPORT(bool createOffscreenCanvas(int width, int height, int samples, int stencilBits))
+{
+    g_canvas.m_offscreen = OffscreenTarget::create(width, height, samples, stencilBits > 0);
+    if (!g_canvas.m_offscreen) {
+        std::cerr << "Failed to create offscreen canvas" << std::endl;
+        return false;
+    }
 
+    // Frames are finished as fast as they can be drawn
+    setFrameTimingRefresh(0, false);
+    g_canvas.m_hasStencil = g_canvas.m_offscreen->hasStencil();
+
+    initContext();
     return true;
 }
 
@@ -215,6 +439,7 @@ LUAEXPORT(int getMonitorByName(const char* name))
 
 LUAEXPORT(void setWindowPos(int x, int y))
 {
+    if (!g_canvas.m_window) return;
     glfwSetWindowPos(g_canvas.m_window, x, y);
 }
 
@@ -230,7 +455,14 @@ LUAEXPORT(const char* getMonitorName())
 
 LUAEXPORT(void destroyCanvas())
 {
-    glfwDestroyWindow(g_canvas.m_window);
+    stopCapture();
+    if (g_canvas.m_offscreen) {
+        delete g_canvas.m_offscreen;
+        g_canvas.m_offscreen = 0;
+    }
+    if (g_canvas.m_window) {
+        glfwDestroyWindow(g_canvas.m_window);
+    }
 }
 
 LUAEXPORT(void setGamma(float gamma))
@@ -254,27 +486,67 @@ LUAEXPORT(void setGammaRamp(unsigned short* rgb, int n))
 
 LUAEXPORT(void swapBuffers())
 {
-    glfwSwapBuffers(g_canvas.m_window);
+    endGpuFrame();
 
-    int width, height;
-    glfwGetWindowSize(g_canvas.m_window, &width, &height);
-    glViewport(0, 0, width, height);
+    if (capturing()) {
+        bindCanvasForReading();
+        captureFrame(frameCount());
+    }
 
+    if (g_canvas.m_offscreen) {
+        double now = canvasTime();
+        recordFrameSwap(now, now);
+        g_canvas.m_offscreen->bind();
+    } else {
+        double issued = canvasTime();
+        glfwSwapBuffers(g_canvas.m_window);
+        recordFrameSwap(issued, canvasTime());
+
+        int width, height;
+        glfwGetWindowSize(g_canvas.m_window, &width, &height);
+        glViewport(0, 0, width, height);
+    }
+
+    fenceFrame();
+    clearCanvas();
+}
+
+void clearCanvas()
+{
     glClearColor(g_canvas.m_clearColor[0],
             g_canvas.m_clearColor[1],
             g_canvas.m_clearColor[2],
             g_canvas.m_clearColor[3]);
 
-    glClear(GL_COLOR_BUFFER_BIT);
+    glClear(g_canvas.m_hasStencil ? GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT : GL_COLOR_BUFFER_BIT);
+}
+
+void bindCanvasForReading()
+{
+    if (g_canvas.m_offscreen) {
+        g_canvas.m_offscreen->bindForReading();
+    } else {
+        glReadBuffer(GL_BACK);
+    }
+}
+
+void bindCanvasForDrawing()
+{
+    if (g_canvas.m_offscreen) {
+        g_canvas.m_offscreen->bind();
+    }
 }
 
 LUAEXPORT(bool shouldClose())
 {
+    if (!g_canvas.m_window) return g_canvas.m_shouldClose;
     return glfwWindowShouldClose(g_canvas.m_window) == 1;
 }
 
 LUAEXPORT(void setWindowShouldClose(bool close))
 {
+    g_canvas.m_shouldClose = close;
+    if (!g_canvas.m_window) return;
     glfwSetWindowShouldClose(g_canvas.m_window, close ? 1 : 0);
 }
 
@@ -290,45 +562,128 @@ LUAEXPORT(void setClearColor(float r, float g, float b, float a))
 
 LUAEXPORT(void windowSize(int* dest))
 {
+    if (g_canvas.m_offscreen) {
+        dest[0] = g_canvas.m_offscreen->width();
+        dest[1] = g_canvas.m_offscreen->height();
+        return;
+    }
     glfwGetWindowSize(g_canvas.m_window, &dest[0], &dest[1]);
 }
 
+// Size of the canvas in pixels, which can be more than its size in window
+// coordinates on high resolution displays
+LUAEXPORT(void canvasPixelSize(int* dest))
+{
+    if (g_canvas.m_offscreen) {
+        windowSize(dest);
+    } else if (g_canvas.m_window) {
+        glfwGetFramebufferSize(g_canvas.m_window, &dest[0], &dest[1]);
+    } else {
+        dest[0] = dest[1] = 0;
+    }
+}
+
+static std::vector<unsigned char> gPixelRow;
+
+// Copies what's been drawn this frame into dest, as rows of RGBA bytes from the
+// top down, stride bytes apart (0 for tightly packed rows). dest must hold
+// canvasPixelSize() rows. Call before swapBuffers(), which clears the frame.
+LUAEXPORT(bool readCanvasPixels(unsigned char* dest, int stride))
+{
+    int size[2];
+    canvasPixelSize(size);
+    int rowBytes = size[0] * 4;
+    if (stride == 0) {
+        stride = rowBytes;
+    }
+    if (stride < rowBytes || stride % 4 != 0) {
+        std::cerr << "Error: pixel row stride must be a multiple of 4 and at least 4 times the width" << std::endl;
+        return false;
+    }
+
+    bindCanvasForReading();
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glPixelStorei(GL_PACK_ROW_LENGTH, stride / 4);
+    glReadPixels(0, 0, size[0], size[1], GL_RGBA, GL_UNSIGNED_BYTE, dest);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    bindCanvasForDrawing();
+
+    // GL's rows go from the bottom up
+    gPixelRow.resize(rowBytes);
+    for (int top=0, bottom=size[1]-1; top<bottom; top++, bottom--) {
+        unsigned char* a = dest + (size_t)top * stride;
+        unsigned char* b = dest + (size_t)bottom * stride;
+        memcpy(&gPixelRow[0], a, rowBytes);
+        memcpy(a, b, rowBytes);
+        memcpy(b, &gPixelRow[0], rowBytes);
+    }
+    return true;
+}
+
 LUAEXPORT(void cursorPos(double* dest))
 {
+    if (!g_canvas.m_window) {
+        dest[0] = dest[1] = 0;
+        return;
+    }
     glfwGetCursorPos(g_canvas.m_window, &dest[0], &dest[1]);
-
-    // Make center be (0, 0), increasing up and right
-    int wsize[2];
-    windowSize(wsize);
-    dest[0] = dest[0] - wsize[0]/2;
-    dest[1] = wsize[1]/2 - dest[1];
+    centerCursorPos(g_canvas.m_window, dest[0], dest[1]);
 }
 
 LUAEXPORT(bool mouseButton(int btn))
 {
+    if (!g_canvas.m_window) return false;
     return glfwGetMouseButton(g_canvas.m_window, btn) == GLFW_PRESS;
 }
 
 LUAEXPORT(double canvasTime())
 {
-    return glfwGetTime();
+    if (g_canvas.m_glfwReady) {
+        return glfwGetTime();
+    }
+
+    // GLFW's timer only runs once GLFW is initialised
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
 
 LUAEXPORT(void setVerticalSync(bool enabled)) {
+    if (!g_canvas.m_window) return;
     glfwSwapInterval(enabled ? 1 : 0);
+    setFrameTimingRefresh(0, enabled);
 }
 
-LUAEXPORT(void drawFilledPath(Path* path))
+LUAEXPORT(void drawFilledPath(Path* path, float pixelsPerUnit))
 {
-    drawMesh(fillPath(path));
+    ScopedDrawTiming timing;
+    FillMode mode = pathFillMode(path);
+    if (mode != FILL_TESSELLATE && !g_canvas.m_hasStencil) {
+        static bool warned = false;
+        if (!warned) {
+            std::cerr << "Warning: stencil fill needs a stencil buffer, set stencil_bits in settings. Tessellating instead." << std::endl;
+            warned = true;
+        }
+        mode = FILL_TESSELLATE;
+    }
+
+    if (mode == FILL_TESSELLATE) {
+        drawMesh(fillPath(path, pixelsPerUnit));
+    } else {
+        drawStencilFill(flattenPath(path, pixelsPerUnit), mode == FILL_STENCIL_NONZERO);
+    }
 }
 
-LUAEXPORT(void drawStrokedPath(Path* path, float strokeWidth))
+LUAEXPORT(void drawStrokedPath(Path* path, float strokeWidth, float pixelsPerUnit))
 {
-    drawMesh(strokePath(path, strokeWidth));
+    ScopedDrawTiming timing;
+    setStrokeWidth(strokeWidth);
+    drawMesh(strokePath(path, pixelsPerUnit));
 }
 
-LUAEXPORT(void drawFilledSquare())
+// cached mesh of square with sides of 1 and centred at origin
+static Mesh* gUnitSquareMesh;
+
+static void generateSquareMesh()
 {
     float x1 = -.5f;
     float y1 = -.5f;
@@ -355,8 +710,17 @@ LUAEXPORT(void drawFilledSquare())
     ind[4] = 3;
     ind[5] = 2;
 
-    Mesh m(vert, ind);
-    drawMesh(&m);
+    gUnitSquareMesh = new Mesh(vert, ind);
+}
+
+LUAEXPORT(void drawFilledSquare())
+{
+    ScopedDrawTiming timing;
+    if (gUnitSquareMesh == 0) {
+        generateSquareMesh();
+    }
+
+    drawMesh(gUnitSquareMesh);
 }
 
 
@@ -397,6 +761,7 @@ static void generateCircleMesh()
 
 LUAEXPORT(void drawFilledCircle())
 {
+    ScopedDrawTiming timing;
     if (gUnitCircleMesh == 0) {
         generateCircleMesh();
     }
@@ -409,69 +774,171 @@ LUAEXPORT(void drawStrokedCircle())
 
 }
 
-static void mouseButtonCallback(GLFWwindow*, int button, int action, int mods)
+// Per-object attributes for drawBatch(): rows of the transform to device coordinates,
+// then the object's value of the batched shader parameter
+static const int kBatchInstanceFloats = 10;
+
+// Pretransformed vertices are drawn in chunks of about this many, to bound the scratch memory
+static const size_t kBatchChunkVertices = 1 << 16;
+
+static std::vector<float> gBatchInstances;
+static std::vector<float> gBatchVertices;
+static std::vector<unsigned int> gBatchIndices;
+
+static void drawBatchInstanced(const Mesh* mesh, int count, bool hasParam)
 {
-    if (g_canvas.m_mouseButtonCallback) {
-        g_canvas.m_mouseButtonCallback(button, action, mods);
+    GLenum mode = g_canvas.m_wireframe ? GL_LINES : GL_TRIANGLES;
+
+    const MeshBuffers* buffers = meshBuffers(mesh);
+    if (buffers) {
+        const char* vertices = (const char*)0 + buffers->vertices.offset;
+        bindBuffer(GL_ARRAY_BUFFER, buffers->vertices.buffer);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, vertices);
+        setExtrusionArray(buffers->hasExtrusions ? (const vec2*)(vertices + buffers->vertexCount * sizeof(vec2)) : 0);
+    } else {
+        bindBuffer(GL_ARRAY_BUFFER, 0);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, &mesh->vertices[0]);
+        setExtrusionArray(mesh->extrusions.empty() ? 0 : &mesh->extrusions[0]);
     }
-}
 
-LUAEXPORT(void setMouseButtonCallback(void(*cb)(int, int, int)))
-{
-    g_canvas.m_mouseButtonCallback = cb;
-    glfwSetMouseButtonCallback(g_canvas.m_window, mouseButtonCallback);
-}
+    // Per-object attributes advance once per instance
+    bindBuffer(GL_ARRAY_BUFFER, 0);
+    GLsizei stride = kBatchInstanceFloats * sizeof(float);
+    for (GLuint a=2; a<=(hasParam ? 4u : 3u); a++) {
+        glVertexAttribPointer(a, a == 4 ? 4 : 3, GL_FLOAT, GL_FALSE, stride, &gBatchInstances[(a - 2) * 3]);
+        gVertexAttribDivisor(a, 1);
+        glEnableVertexAttribArray(a);
+    }
 
-static void scrollCallback(GLFWwindow*, double xoffset, double yoffset)
-{
-    if (g_canvas.m_scrollCallback) {
-        g_canvas.m_scrollCallback(xoffset, yoffset);
+    if (buffers) {
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffers->indices.buffer);
+        gDrawElementsInstanced(mode, (GLsizei)buffers->indexCount, GL_UNSIGNED_INT, (const char*)0 + buffers->indices.offset, count);
+    } else {
+        bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        gDrawElementsInstanced(mode, (GLsizei)mesh->indices.size(), GL_UNSIGNED_INT, &mesh->indices[0], count);
     }
-}
 
-LUAEXPORT(void setScrollCallback(void (*cb)(double, double)))
-{
-    g_canvas.m_scrollCallback = cb;
-    glfwSetScrollCallback(g_canvas.m_window, scrollCallback);
+    for (GLuint a=2; a<=4; a++) {
+        gVertexAttribDivisor(a, 0);
+        glDisableVertexAttribArray(a);
+    }
 }
 
-static void charCallback(GLFWwindow*, unsigned int codepoint)
-{
-    if (g_canvas.m_charCallback) {
-        g_canvas.m_charCallback(codepoint);
+// Plain GL 2.1 fallback: copies of the mesh are transformed on the CPU and drawn
+// from one vertex stream. Each vertex has its position in device coordinates, its
+// untransformed position and the object's parameter value.
+static void drawBatchPretransformed(const Mesh* mesh, int count, float strokeWidth, bool hasParam)
+{
+    GLenum mode = g_canvas.m_wireframe ? GL_LINES : GL_TRIANGLES;
+    const int vertexFloats = 8;
+    size_t meshVertices = mesh->vertices.size();
+    bool extruded = !mesh->extrusions.empty();
+
+    bindBuffer(GL_ARRAY_BUFFER, 0);
+    bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    setExtrusionArray(0);
+    glEnableVertexAttribArray(5);
+    if (hasParam) glEnableVertexAttribArray(4);
+
+    int first = 0;
+    while (first < count) {
+        int last = first;
+        gBatchVertices.clear();
+        gBatchIndices.clear();
+        do {
+            const float* t = &gBatchInstances[last * kBatchInstanceFloats];
+            unsigned int base = (unsigned int)(gBatchVertices.size() / vertexFloats);
+            for (size_t v=0; v<meshVertices; v++) {
+                vec2 p = mesh->vertices[v];
+                if (extruded) p += mesh->extrusions[v] * strokeWidth;
+                gBatchVertices.push_back(t[0] * p.x + t[1] * p.y + t[2]);
+                gBatchVertices.push_back(t[3] * p.x + t[4] * p.y + t[5]);
+                gBatchVertices.push_back(p.x);
+                gBatchVertices.push_back(p.y);
+                gBatchVertices.insert(gBatchVertices.end(), t + 6, t + 10);
+            }
+            for (size_t i=0; i<mesh->indices.size(); i++) {
+                gBatchIndices.push_back(base + mesh->indices[i]);
+            }
+            last++;
+        } while (last < count && gBatchVertices.size() / vertexFloats + meshVertices <= kBatchChunkVertices);
+
+        GLsizei stride = vertexFloats * sizeof(float);
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, stride, &gBatchVertices[0]);
+        glVertexAttribPointer(5, 2, GL_FLOAT, GL_FALSE, stride, &gBatchVertices[2]);
+        if (hasParam) glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, stride, &gBatchVertices[4]);
+        glDrawElements(mode, (GLsizei)gBatchIndices.size(), GL_UNSIGNED_INT, &gBatchIndices[0]);
+        first = last;
     }
-}
 
-LUAEXPORT(void setCharCallback(void (*cb)(unsigned int)))
-{
-    g_canvas.m_charCallback = cb;
-    glfwSetCharCallback(g_canvas.m_window, charCallback);
-}
+    glDisableVertexAttribArray(4);
+    glDisableVertexAttribArray(5);
+}
+
+// Draws count objects that share a shape (a ShapeType) and shader, in one instanced
+// draw where the driver supports it and in a few large ones where it doesn't. Paths
+// are filled, or stroked if strokeWidth > 0, and always drawn from their tessellated
+// meshes.
+//
+// Each object has 5 values in transforms (x scale, y scale, rotation in degrees, x, y),
+// laid out as for pickShape(). If param isn't null it names a parameter of the current
+// shader that each object sets itself, with 4 values per object in params; the rest
+// of the parameters are the ones set on the shader before the call. view holds the
+// window transform: x and y scale to device coordinates, then the window centre.
+//
+// Returns 0 without drawing anything if the shader can't be batched that way.
+LUAEXPORT(int drawBatch(int shape, Path* path, float strokeWidth, float pixelsPerUnit, int count,
+                        const float* transforms, const char* param, const float* params, const float* view))
+{
+    if (count <= 0) return 1;
+
+    ScopedDrawTiming timing;
+    const Mesh* mesh = 0;
+    if (shape == SHAPE_PATH) {
+        mesh = strokeWidth > 0 ? strokePath(path, pixelsPerUnit) : fillPath(path, pixelsPerUnit);
+    } else if (shape == SHAPE_RECT) {
+        if (gUnitSquareMesh == 0) generateSquareMesh();
+        mesh = gUnitSquareMesh;
+    } else if (shape == SHAPE_CIRCLE) {
+        if (gUnitCircleMesh == 0) generateCircleMesh();
+        mesh = gUnitCircleMesh;
+    }
+    if (!mesh || mesh->indices.empty()) return 1;
 
-static void cursorPosCallback(GLFWwindow*, double x, double y)
-{
-    if (g_canvas.m_cursorPosCallback) {
-        g_canvas.m_cursorPosCallback(x, y);
+    bool instanced = g_canvas.m_hasInstancing;
+    const BatchProgram* batch = useBatchProgram(param, !instanced);
+    if (!batch) return 0;
+    if (strokeWidth > 0 && batch->strokeWidthLocation >= 0) {
+        glUniform1f(batch->strokeWidthLocation, strokeWidth);
     }
-}
 
-LUAEXPORT(void setCursorPosCallback(void (*cb)(double, double)))
-{
-    g_canvas.m_cursorPosCallback = cb;
-    glfwSetCursorPosCallback(g_canvas.m_window, cursorPosCallback);
-}
+    // Object to device transforms, as setTransform() in Nexpo.lua makes them
+    gBatchInstances.resize(count * kBatchInstanceFloats);
+    for (int i=0; i<count; i++) {
+        const float* t = &transforms[i * 5];
+        float* out = &gBatchInstances[i * kBatchInstanceFloats];
+        float rad = t[2] * (float)M_PI / 180.0f;
+        float c = cosf(rad);
+        float s = sinf(rad);
+        out[0] = view[0] * t[0] * c;
+        out[1] = view[0] * t[0] * s;
+        out[2] = view[0] * (t[3] - view[2]);
+        out[3] = view[1] * -t[1] * s;
+        out[4] = view[1] * t[1] * c;
+        out[5] = view[1] * (t[4] - view[3]);
+        if (param) {
+            memcpy(out + 6, &params[i * 4], 4 * sizeof(float));
+        }
+    }
 
-static void keyCallback(GLFWwindow*, int key, int scancode, int action, int mods)
-{
-    if (g_canvas.m_keyCallback) {
-        g_canvas.m_keyCallback(key, scancode, action, mods);
+    if (instanced) {
+        drawBatchInstanced(mesh, count, param != 0);
+    } else {
+        drawBatchPretransformed(mesh, count, strokeWidth, param != 0);
     }
-}
 
-LUAEXPORT(void setKeyCallback(void (*cb)(int, int, int, int)))
-{
-    g_canvas.m_keyCallback = cb;
-    glfwSetKeyCallback(g_canvas.m_window, keyCallback);
+    endBatchProgram();
+    return 1;
 }
 
 LUAEXPORT(void setWireFrame(bool e)) {
@@ -480,5 +947,7 @@ LUAEXPORT(void setWireFrame(bool e)) {
 
 LUAEXPORT(void pollEvents())
 {
-    glfwPollEvents();
+    if (g_canvas.m_window) {
+        glfwPollEvents();
+    }
 }
@@ -1,7 +1,37 @@
 #ifndef CANVAS_H
 #define CANVAS_H
+#include "common.h"
 
+class Path;
 
+// Shapes for functions that draw many objects at once, numbered as for pickShape()
+enum ShapeType {
+    SHAPE_PATH,
+    SHAPE_RECT,             // unit square centred on the origin
+    SHAPE_CIRCLE,           // unit diameter circle centred on the origin
+};
 
-#endif // CANVAS_H
+// The canvas's GL context may be GLFW's or an offscreen one, so look extensions
+// and entry points up through these rather than GLFW
+bool canvasExtensionSupported(const char* name);
+void* canvasProcAddress(const char* name);
+
+// Reading what's been drawn this frame, for copying it elsewhere. An offscreen
+// canvas reads from a resolved copy, so rebind it for drawing afterwards.
+void bindCanvasForReading();
+void bindCanvasForDrawing();
+
+// Clears the frame to the clear colour, as swapBuffers() does
+void clearCanvas();
 
+DLLEXPORT double canvasTime();
+DLLEXPORT void canvasPixelSize(int* dest);
+DLLEXPORT void drawFilledPath(Path* path, float pixelsPerUnit);
+DLLEXPORT void drawStrokedPath(Path* path, float strokeWidth, float pixelsPerUnit);
+DLLEXPORT void drawFilledSquare();
+DLLEXPORT void drawFilledCircle();
+DLLEXPORT void swapBuffers();
+DLLEXPORT bool shouldClose();
+DLLEXPORT void pollEvents();
+
+#endif // CANVAS_H
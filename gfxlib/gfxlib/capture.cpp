@@ -0,0 +1,390 @@
+#include "capture.h"
+#include "canvas.h"
+#include <vector>
+#include <deque>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+// Frames are mapped this many frames after they're read, so the GPU has had two
+// frames to finish the copy
+static const int kCaptureBuffers = 3;
+
+static const int kDefaultQueueFrames = 8;
+
+// A frame on its way to disk, as GL's bottom-up rows of RGBA bytes
+struct CapturedFrame
+{
+    std::vector<unsigned char> pixels;
+    unsigned int index;
+};
+
+class FrameCapture
+{
+public:
+    FrameCapture(const std::string& path, bool sequence, int width, int height, int queueFrames);
+    ~FrameCapture();
+
+    bool open();
+    void finish();          // writes out every frame read so far
+    void capture(unsigned int frame);
+    CaptureStats stats();
+
+private:
+    void mapBuffer(int i, bool wait);
+    void writerRoutine();
+    bool writeFrame(CapturedFrame& frame);
+
+    std::string m_path;
+    bool m_sequence;            // m_path is a printf pattern for one file per frame
+    FILE* m_stream;             // otherwise every frame goes into this one file
+    int m_width;
+    int m_height;
+    bool m_warnedSize;
+
+    GLuint m_buffers[kCaptureBuffers];
+    unsigned int m_bufferFrames[kCaptureBuffers];
+    bool m_bufferPending[kCaptureBuffers];
+    int m_nextBuffer;
+
+    std::vector<CapturedFrame> m_frames;
+    std::vector<CapturedFrame*> m_free;
+    std::deque<CapturedFrame*> m_queue;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;         // the writer has work, or should quit
+    std::condition_variable m_freed;        // the writer has finished with a frame
+    std::thread m_writer;
+    bool m_quit;
+
+    // written, failed and maxQueued are guarded by m_mutex, the rest are render thread only
+    CaptureStats m_stats;
+};
+
+static FrameCapture* gCapture;
+static CaptureStats gLastStats = { 0, 0, 0, 0, 0, 0, -1, 0, 0 };     // of the last capture stopped
+
+
+FrameCapture::FrameCapture(const std::string& path, bool sequence, int width, int height, int queueFrames)
+    : m_path(path)
+    , m_sequence(sequence)
+    , m_stream(0)
+    , m_width(width)
+    , m_height(height)
+    , m_warnedSize(false)
+    , m_nextBuffer(0)
+    , m_frames(queueFrames)
+    , m_quit(false)
+    , m_stats()
+{
+    m_stats.lastDropped = -1;
+    m_stats.width = width;
+    m_stats.height = height;
+
+    // Allocate everything up front so capturing never allocates
+    for (size_t i=0; i<m_frames.size(); i++) {
+        m_frames[i].pixels.resize((size_t)width * height * 4);
+        m_free.push_back(&m_frames[i]);
+    }
+
+    glGenBuffers(kCaptureBuffers, m_buffers);
+    for (int i=0; i<kCaptureBuffers; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, 0, GL_STREAM_READ);
+        m_bufferPending[i] = false;
+        m_bufferFrames[i] = 0;
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+FrameCapture::~FrameCapture()
+{
+    finish();
+    glDeleteBuffers(kCaptureBuffers, m_buffers);
+}
+
+void FrameCapture::finish()
+{
+    // Collect the frames still in flight, oldest first
+    for (int i=0; i<kCaptureBuffers; i++) {
+        mapBuffer((m_nextBuffer + i) % kCaptureBuffers, true);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_one();
+    if (m_writer.joinable()) {
+        m_writer.join();
+    }
+
+    if (m_stream) {
+        if (fclose(m_stream) != 0) {
+            std::cerr << "Error: couldn't finish writing " << m_path << std::endl;
+        }
+        m_stream = 0;
+    }
+}
+
+bool FrameCapture::open()
+{
+    if (!m_sequence) {
+        m_stream = fopen(m_path.c_str(), "wb");
+        if (!m_stream) {
+            std::cerr << "Error: couldn't open " << m_path << " for writing" << std::endl;
+            return false;
+        }
+    }
+    m_writer = std::thread(&FrameCapture::writerRoutine, this);
+    return true;
+}
+
+void FrameCapture::capture(unsigned int frame)
+{
+    int size[2];
+    canvasPixelSize(size);
+    int i = m_nextBuffer;
+    m_nextBuffer = (m_nextBuffer + 1) % kCaptureBuffers;
+
+    // The buffer about to be reused holds the oldest frame, so hand that on first
+    mapBuffer(i, false);
+
+    if (size[0] != m_width || size[1] != m_height) {
+        if (!m_warnedSize) {
+            std::cerr << "Warning: the canvas changed size while capturing, frames are being dropped" << std::endl;
+            m_warnedSize = true;
+        }
+        m_stats.frames++;
+        m_stats.dropped++;
+        m_stats.lastDropped = (int)frame;
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[i]);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    m_bufferPending[i] = true;
+    m_bufferFrames[i] = frame;
+    m_stats.frames++;
+}
+
+// Copies a buffer's frame to the writer's queue. Unless wait is set, drops the
+// frame instead of waiting if the writer has no room for it.
+void FrameCapture::mapBuffer(int i, bool wait)
+{
+    if (!m_bufferPending[i]) return;
+    m_bufferPending[i] = false;
+
+    CapturedFrame* frame = 0;
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (wait) {
+            m_freed.wait(lock, [this] { return !m_free.empty(); });
+        }
+        if (!m_free.empty()) {
+            frame = m_free.back();
+            m_free.pop_back();
+        }
+    }
+    if (!frame) {
+        m_stats.dropped++;
+        m_stats.lastDropped = (int)m_bufferFrames[i];
+        return;
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, m_buffers[i]);
+    void* pixels = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+    bool copied = pixels != 0;
+    if (copied) {
+        memcpy(&frame->pixels[0], pixels, frame->pixels.size());
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    frame->index = m_bufferFrames[i];
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (copied) {
+            m_queue.push_back(frame);
+            m_stats.maxQueued = std::max(m_stats.maxQueued, (unsigned int)m_queue.size());
+        } else {
+            m_free.push_back(frame);
+            m_stats.failed++;
+        }
+    }
+    if (copied) {
+        m_wake.notify_one();
+    }
+}
+
+CaptureStats FrameCapture::stats()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    CaptureStats stats = m_stats;
+    stats.queued = (unsigned int)m_queue.size();
+    return stats;
+}
+
+void FrameCapture::writerRoutine()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait(lock, [this] { return m_quit || !m_queue.empty(); });
+        if (m_queue.empty()) break;
+
+        CapturedFrame* frame = m_queue.front();
+        m_queue.pop_front();
+
+        lock.unlock();
+        bool ok = writeFrame(*frame);
+        lock.lock();
+
+        if (ok) {
+            m_stats.written++;
+        } else {
+            m_stats.failed++;
+        }
+        m_free.push_back(frame);
+        m_freed.notify_one();
+    }
+}
+
+// Raw streams hold frames back to back as rows of RGBA bytes from the top down,
+// with no header. Sequences are uncompressed 32 bit TGA files, which keep GL's
+// bottom-up row order.
+bool FrameCapture::writeFrame(CapturedFrame& frame)
+{
+    size_t rowBytes = (size_t)m_width * 4;
+    unsigned char* pixels = &frame.pixels[0];
+
+    if (!m_sequence) {
+        for (int y=m_height-1; y>=0; y--) {
+            if (fwrite(pixels + y * rowBytes, 1, rowBytes, m_stream) != rowBytes) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    char filename[1024];
+    snprintf(filename, sizeof(filename), m_path.c_str(), frame.index);
+    FILE* file = fopen(filename, "wb");
+    if (!file) return false;
+
+    unsigned char header[18] = {0};
+    header[2] = 2;                          // uncompressed true colour
+    header[12] = m_width & 0xff;
+    header[13] = (m_width >> 8) & 0xff;
+    header[14] = m_height & 0xff;
+    header[15] = (m_height >> 8) & 0xff;
+    header[16] = 32;                        // bits per pixel
+    header[17] = 8;                         // alpha bits, origin at the bottom left
+
+    // TGA stores BGRA
+    for (size_t i=0; i<frame.pixels.size(); i+=4) {
+        std::swap(pixels[i], pixels[i + 2]);
+    }
+
+    bool ok = fwrite(header, 1, sizeof(header), file) == sizeof(header)
+            && fwrite(pixels, 1, frame.pixels.size(), file) == frame.pixels.size();
+    return fclose(file) == 0 && ok;
+}
+
+// A sequence pattern must have exactly one integer conversion for the frame number
+static bool isSequencePattern(const char* path, bool* valid)
+{
+    *valid = true;
+    int conversions = 0;
+    for (const char* p=path; *p; p++) {
+        if (*p != '%') continue;
+        if (p[1] == '%') {
+            p++;
+            continue;
+        }
+        p++;
+        while (*p >= '0' && *p <= '9') p++;
+        if (*p != 'd' && *p != 'u') {
+            *valid = false;
+            return true;
+        }
+        conversions++;
+    }
+    if (conversions > 1) {
+        *valid = false;
+    }
+    return conversions > 0;
+}
+
+
+bool capturing()
+{
+    return gCapture != 0;
+}
+
+void captureFrame(unsigned int frame)
+{
+    if (gCapture) {
+        gCapture->capture(frame);
+    }
+}
+
+// Starts capturing every frame shown, stopping any capture already running. If path
+// contains a printf style integer conversion such as %05d each frame goes in its own
+// TGA file, named with its frame number from frameCount(); otherwise frames go one
+// after another into a single raw RGBA file. queueFrames is how many frames can wait
+// to be written before frames get dropped, 0 for the default. Needs a GL context.
+LUAEXPORT(bool startCapture(const char* path, int queueFrames))
+{
+    stopCapture();
+
+    bool valid;
+    bool sequence = isSequencePattern(path, &valid);
+    if (!valid) {
+        std::cerr << "Error: capture file name patterns need a single %d or %u for the frame number" << std::endl;
+        return false;
+    }
+    if (queueFrames <= 0) {
+        queueFrames = kDefaultQueueFrames;
+    }
+
+    int size[2];
+    canvasPixelSize(size);
+    if (size[0] <= 0 || size[1] <= 0) {
+        std::cerr << "Error: there's no canvas to capture" << std::endl;
+        return false;
+    }
+    if (sequence && (size[0] > 0xffff || size[1] > 0xffff)) {
+        std::cerr << "Error: the canvas is too big for TGA files" << std::endl;
+        return false;
+    }
+
+    FrameCapture* capture = new FrameCapture(path, sequence, size[0], size[1], queueFrames);
+    if (!capture->open()) {
+        delete capture;
+        return false;
+    }
+    gCapture = capture;
+    return true;
+}
+
+// Waits for the frames already read to be written, then closes the capture
+LUAEXPORT(void stopCapture())
+{
+    if (!gCapture) return;
+    gCapture->finish();
+    gLastStats = gCapture->stats();
+    delete gCapture;
+    gCapture = 0;
+}
+
+// Stats of the running capture, or the final stats of the last one stopped
+LUAEXPORT(void captureStats(CaptureStats* stats))
+{
+    *stats = gCapture ? gCapture->stats() : gLastStats;
+}
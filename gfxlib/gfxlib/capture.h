@@ -0,0 +1,35 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+#include "common.h"
+
+// Recording every frame shown to disk, without holding up the frames. Each frame
+// is read into one of a ring of pixel buffer objects just before it's swapped,
+// and mapped a couple of frames later once the GPU has finished with it, so the
+// render thread never waits on glReadPixels. A background thread writes the
+// frames out. If it falls behind, frames are dropped from the capture (and
+// counted) rather than from the display.
+//
+// CaptureStats is also declared in Nexpo.lua's ffi.cdef, so keep the two in sync.
+
+struct CaptureStats
+{
+    unsigned int frames;        // frames read back since the capture started
+    unsigned int written;       // frames written to disk
+    unsigned int dropped;       // frames left out because the writer was behind or the canvas changed size
+    unsigned int failed;        // frames that couldn't be written
+    unsigned int queued;        // frames waiting for the writer now
+    unsigned int maxQueued;     // the most frames ever waiting for the writer
+    int lastDropped;            // number of the last frame dropped, -1 if none
+    int width;
+    int height;
+};
+
+// Called by swapBuffers() before swapping, with the finished frame bound for reading
+bool capturing();
+void captureFrame(unsigned int frame);
+
+DLLEXPORT bool startCapture(const char* path, int queueFrames);
+DLLEXPORT void stopCapture();
+DLLEXPORT void captureStats(CaptureStats* stats);
+
+#endif // CAPTURE_H
@@ -0,0 +1,245 @@
+#include "consoleoutput.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const unsigned int kDefaultConsoleBytes = 1 << 20;
+static const unsigned int kMinConsoleBytes = 4096;
+
+// Lines starting with this are messages for the IDE rather than output, and it
+// needs every one of them whole, so they wait for room whatever the policy
+static const char kControlLinePrefix = '\x05';
+
+// Each write is stored as a header followed by its text, and may wrap around the
+// end of the buffer
+struct ConsoleRecord
+{
+    unsigned int length;
+    int stream;
+};
+
+class ConsoleOutput
+{
+public:
+    ConsoleOutput();
+
+    bool configure(unsigned int bytes, int overflow);
+    void write(int stream, const char* text, size_t length);
+    bool flush(double timeout);
+    void stop();
+    unsigned int dropped() const { return m_dropped; }
+
+private:
+    void start();
+    void put(const void* data, size_t length);
+    void take(void* data, size_t length);
+    void writerRoutine();
+
+    std::mutex m_mutex;
+    std::condition_variable m_written;      // signalled when there's more to write
+    std::condition_variable m_drained;      // signalled when there's more room
+
+    std::vector<char> m_buffer;
+    size_t m_head;                          // where the next write goes
+    size_t m_used;
+    int m_overflow;
+    unsigned int m_dropped;
+    unsigned int m_droppedNoted;            // dropped bytes already noted on stderr
+    bool m_writing;                         // the writer has taken a record but not written it
+    bool m_stopping;
+    bool m_stopped;                         // writes go straight to the streams
+    std::thread m_thread;
+};
+
+// Never destroyed, since by the time static destructors run the writer thread may
+// already have been killed, and on Windows joining it there can deadlock on the
+// loader lock. Lua stops it with stopConsole before the script ends instead.
+static ConsoleOutput& gConsole = *new ConsoleOutput;
+
+
+ConsoleOutput::ConsoleOutput()
+    : m_head(0)
+    , m_used(0)
+    , m_overflow(CONSOLE_DROP)
+    , m_dropped(0)
+    , m_droppedNoted(0)
+    , m_writing(false)
+    , m_stopping(false)
+    , m_stopped(false)
+{
+}
+
+bool ConsoleOutput::configure(unsigned int bytes, int overflow)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_overflow = std::max((int)CONSOLE_DROP, std::min(overflow, (int)CONSOLE_BLOCK));
+    bytes = std::max(bytes, kMinConsoleBytes);
+    if (m_buffer.size() == bytes) return true;
+    if (!m_buffer.empty()) return false;
+    m_buffer.resize(bytes);
+    return true;
+}
+
+// Called with the lock held, on the first write
+void ConsoleOutput::start()
+{
+    if (m_buffer.empty()) m_buffer.resize(kDefaultConsoleBytes);
+    m_thread = std::thread(&ConsoleOutput::writerRoutine, this);
+}
+
+void ConsoleOutput::put(const void* data, size_t length)
+{
+    const char* src = (const char*)data;
+    size_t first = std::min(length, m_buffer.size() - m_head);
+    std::copy(src, src + first, &m_buffer[m_head]);
+    std::copy(src + first, src + length, &m_buffer[0]);
+    m_head = (m_head + length) % m_buffer.size();
+    m_used += length;
+}
+
+void ConsoleOutput::take(void* data, size_t length)
+{
+    char* dest = (char*)data;
+    size_t tail = (m_head + m_buffer.size() - m_used) % m_buffer.size();
+    size_t first = std::min(length, m_buffer.size() - tail);
+    std::copy(&m_buffer[tail], &m_buffer[tail] + first, dest);
+    std::copy(&m_buffer[0], &m_buffer[0] + (length - first), dest + first);
+    m_used -= length;
+}
+
+void ConsoleOutput::write(int stream, const char* text, size_t length)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_stopped) {
+        FILE* file = stream == 2 ? stderr : stdout;
+        std::fwrite(text, 1, length, file);
+        std::fflush(file);
+        return;
+    }
+    if (!m_thread.joinable()) start();
+    int overflow = length > 0 && text[0] == kControlLinePrefix ? (int)CONSOLE_BLOCK : m_overflow;
+
+    // Writes too long for the buffer go in pieces
+    size_t maxText = m_buffer.size() / 2 - sizeof(ConsoleRecord);
+    while (length > 0) {
+        size_t piece = std::min(length, maxText);
+        size_t room = m_buffer.size() - m_used;
+
+        if (room < sizeof(ConsoleRecord) + piece) {
+            if (overflow == CONSOLE_BLOCK) {
+                m_drained.wait(lock, [&] { return m_buffer.size() - m_used >= sizeof(ConsoleRecord) + piece; });
+            } else {
+                size_t kept = 0;
+                if (overflow == CONSOLE_TRUNCATE && room > sizeof(ConsoleRecord)) {
+                    kept = room - sizeof(ConsoleRecord);
+                }
+                m_dropped += (unsigned int)(length - kept);
+                length = kept;
+                piece = kept;
+                if (piece == 0) break;
+            }
+        }
+
+        ConsoleRecord record;
+        record.length = (unsigned int)piece;
+        record.stream = stream;
+        put(&record, sizeof(record));
+        put(text, piece);
+        text += piece;
+        length -= piece;
+    }
+
+    lock.unlock();
+    m_written.notify_one();
+}
+
+// Waits up to timeout seconds for everything written so far to reach the pipe
+bool ConsoleOutput::flush(double timeout)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_drained.wait_for(lock, std::chrono::duration<double>(timeout),
+                              [this] { return m_used == 0 && !m_writing; });
+}
+
+// Writes everything left, however long the pipe takes, and ends the writer thread.
+// Anything written after this goes straight to the streams.
+void ConsoleOutput::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_stopped) return;
+        m_stopping = true;
+    }
+    m_written.notify_all();
+    if (m_thread.joinable()) m_thread.join();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopped = true;
+}
+
+void ConsoleOutput::writerRoutine()
+{
+    std::vector<char> text;
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_written.wait(lock, [this] { return m_used > 0 || m_stopping; });
+        if (m_used == 0) break;
+
+        ConsoleRecord record;
+        take(&record, sizeof(record));
+        text.resize(record.length);
+        if (record.length > 0) take(&text[0], record.length);
+        unsigned int dropped = m_dropped - m_droppedNoted;
+        m_droppedNoted = m_dropped;
+        m_writing = true;
+        lock.unlock();
+        m_drained.notify_all();
+
+        // Only this thread writes to stdout and stderr, so it alone waits on the pipe
+        if (dropped > 0) {
+            std::fprintf(stderr, "[%u bytes of console output were dropped]\n", dropped);
+            std::fflush(stderr);
+        }
+        FILE* file = record.stream == 2 ? stderr : stdout;
+        std::fwrite(text.data(), 1, text.size(), file);
+        std::fflush(file);
+
+        lock.lock();
+        m_writing = false;
+        if (m_used == 0) m_drained.notify_all();
+    }
+}
+
+
+// Sets the buffer size and what happens when it's full. The size can only be set
+// before anything is written.
+LUAEXPORT(bool setConsoleBuffer(unsigned int bytes, int overflow))
+{
+    return gConsole.configure(bytes, overflow);
+}
+
+// stream is 1 for stdout and 2 for stderr
+LUAEXPORT(void writeConsole(int stream, const char* text, size_t length))
+{
+    gConsole.write(stream, text, length);
+}
+
+LUAEXPORT(bool flushConsole(double timeout))
+{
+    return gConsole.flush(timeout);
+}
+
+LUAEXPORT(void stopConsole())
+{
+    gConsole.stop();
+}
+
+LUAEXPORT(unsigned int droppedConsoleBytes())
+{
+    return gConsole.dropped();
+}
@@ -0,0 +1,26 @@
+#ifndef CONSOLEOUTPUT_H
+#define CONSOLEOUTPUT_H
+#include "common.h"
+
+// Console output from Lua, buffered so that writing it never holds up a frame.
+// Writes are copied into a ring buffer and a background thread writes them to
+// stdout or stderr, which block whenever the IDE is slow to read the pipe. When
+// the buffer is full, the overflow policy decides whether a write is dropped,
+// cut short, or waits for room. Dropped bytes are counted, and a note of them is
+// written to stderr once there's room again. Lua stops the buffer, writing what's
+// left, when the script finishes or fails, so its output comes before anything the
+// player writes about the script ending.
+
+enum ConsoleOverflow {
+    CONSOLE_DROP,           // drop writes that don't fit whole
+    CONSOLE_TRUNCATE,       // keep as much of a write as fits
+    CONSOLE_BLOCK           // wait for room, as writing to the pipe directly would
+};
+
+DLLEXPORT bool setConsoleBuffer(unsigned int bytes, int overflow);
+DLLEXPORT void writeConsole(int stream, const char* text, size_t length);
+DLLEXPORT bool flushConsole(double timeout);
+DLLEXPORT void stopConsole();
+DLLEXPORT unsigned int droppedConsoleBytes();
+
+#endif // CONSOLEOUTPUT_H
@@ -0,0 +1,146 @@
+#include "controlchannel.h"
+#include "controlprotocol.h"
+#include <algorithm>
+#include <iostream>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+static ControlChannelHeader* gChannel;
+static char* gToIde;
+static char* gToPlayer;
+
+
+// Returns false if the IDE didn't pass a channel, or it couldn't be mapped
+LUAEXPORT(bool openControlChannel())
+{
+    if (gChannel) return true;
+    const char* path = getenv(kControlChannelVariable);
+    if (!path || !path[0]) return false;
+
+    void* data = 0;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE,
+                              0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0);
+    if (file != INVALID_HANDLE_VALUE) {
+        HANDLE mapping = CreateFileMappingA(file, 0, PAGE_READWRITE, 0, (DWORD)kControlChannelBytes, 0);
+        if (mapping) {
+            data = MapViewOfFile(mapping, FILE_MAP_WRITE, 0, 0, kControlChannelBytes);
+            // The view keeps the mapping and file open
+            CloseHandle(mapping);
+        }
+        CloseHandle(file);
+    }
+#else
+    int fd = ::open(path, O_RDWR);
+    if (fd >= 0) {
+        struct stat info;
+        if (fstat(fd, &info) == 0 && (size_t)info.st_size >= kControlChannelBytes) {
+            data = mmap(0, kControlChannelBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (data == MAP_FAILED) data = 0;
+        }
+        close(fd);
+    }
+#endif
+
+    if (!data) {
+        std::cerr << "Error: couldn't map the control channel " << path << std::endl;
+        return false;
+    }
+
+    ControlChannelHeader* channel = (ControlChannelHeader*)data;
+    if (channel->magic != kControlChannelMagic || channel->version != kControlChannelVersion
+            || channel->toIde.size != kControlToIdeBytes || channel->toPlayer.size != kControlToPlayerBytes) {
+        std::cerr << "Error: the control channel is from a different version of Nexpo" << std::endl;
+#ifdef _WIN32
+        UnmapViewOfFile(data);
+#else
+        munmap(data, kControlChannelBytes);
+#endif
+        return false;
+    }
+
+    gChannel = channel;
+    gToIde = (char*)data + kControlToIdeOffset;
+    gToPlayer = (char*)data + kControlToPlayerOffset;
+    return true;
+}
+
+// The send functions return false if the message was dropped because the IDE
+// has fallen behind, so the caller can send it again next frame
+
+LUAEXPORT(bool sendControlFrame(double elapsed))
+{
+    if (!gChannel) return false;
+    return writeControlMessage(&gChannel->toIde, gToIde, CONTROL_FRAME, 0, &elapsed, 1, 0, 0);
+}
+
+bool controlChannelOpen()
+{
+    return gChannel != 0;
+}
+
+unsigned int writeControlSamples(const ControlSample* samples, unsigned int count)
+{
+    if (!gChannel) return 0;
+    unsigned int sent = 0;
+    while (sent < count) {
+        unsigned int n = std::min(count - sent, kControlSamplesPerMessage);
+        if (!writeControlMessage(&gChannel->toIde, gToIde, CONTROL_SAMPLES, 0, 0, 0,
+                                 (const char*)(samples + sent), n * sizeof(ControlSample))) {
+            break;
+        }
+        sent += n;
+    }
+    return sent;
+}
+
+// Strings longer than kControlMaxText are dropped
+LUAEXPORT(bool sendControlString(unsigned int id, const char* value))
+{
+    if (!gChannel) return false;
+    return writeControlMessage(&gChannel->toIde, gToIde, CONTROL_STRING, id, 0, 0, value, (uint32_t)strlen(value));
+}
+
+LUAEXPORT(bool sendControlSlider(unsigned int id, const char* name, double min, double max, double initial))
+{
+    if (!gChannel) return false;
+    double values[3] = { min, max, initial };
+    return writeControlMessage(&gChannel->toIde, gToIde, CONTROL_SLIDER, id, values, 3, name, (uint32_t)strlen(name));
+}
+
+LUAEXPORT(bool sendControlPlot(unsigned int id, const char* name))
+{
+    if (!gChannel) return false;
+    return writeControlMessage(&gChannel->toIde, gToIde, CONTROL_PLOT, id, 0, 0, name, (uint32_t)strlen(name));
+}
+
+// Takes the oldest value the IDE has set, returning false if there are none. The
+// IDE sends at most one per control per frame.
+LUAEXPORT(bool receiveControlNumber(unsigned int* id, double* value))
+{
+    if (!gChannel) return false;
+    ControlMessage message;
+    while (readControlMessage(&gChannel->toPlayer, gToPlayer, &message)) {
+        if (message.type == CONTROL_NUMBER && message.valueCount == 1) {
+            *id = message.id;
+            *value = message.values[0];
+            return true;
+        }
+    }
+    return false;
+}
+
+// Messages to the IDE dropped because its ring was full
+LUAEXPORT(unsigned int droppedControlMessages())
+{
+    if (!gChannel) return 0;
+    return gChannel->toIde.dropped.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,27 @@
+#ifndef CONTROLCHANNEL_H
+#define CONTROLCHANNEL_H
+#include "common.h"
+
+struct ControlSample;
+
+// The player's end of the live control channel described in controlprotocol.h.
+// When the IDE runs a script it maps a file shared with the IDE, and Lua sends
+// control values through it each frame instead of printing them. Run any other
+// way there's no channel and Lua falls back to printing. Console text always
+// goes through stdout.
+
+bool controlChannelOpen();
+
+// Sends samples in as few messages as fit, returning how many were sent before
+// the channel filled up
+unsigned int writeControlSamples(const ControlSample* samples, unsigned int count);
+
+DLLEXPORT bool openControlChannel();
+DLLEXPORT bool sendControlFrame(double elapsed);
+DLLEXPORT bool sendControlString(unsigned int id, const char* value);
+DLLEXPORT bool sendControlSlider(unsigned int id, const char* name, double min, double max, double initial);
+DLLEXPORT bool sendControlPlot(unsigned int id, const char* name);
+DLLEXPORT bool receiveControlNumber(unsigned int* id, double* value);
+DLLEXPORT unsigned int droppedControlMessages();
+
+#endif // CONTROLCHANNEL_H
@@ -0,0 +1,186 @@
+#ifndef CONTROLPROTOCOL_H
+#define CONTROLPROTOCOL_H
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Binary messages for live controls, passed between NexpoIDE and the player it
+// runs through a file both of them map into memory. The IDE creates the file and
+// passes its path to the player in the NEXPO_CONTROL_CHANNEL environment variable.
+// This header is shared by gfxlib and the IDE, so it only uses the standard library.
+//
+// The file holds a ControlChannelHeader and then two rings, one carrying messages
+// to the IDE and the other to the player. Each ring has a single writer and a
+// single reader and is lock free, so neither process ever waits for the other.
+// If a ring is full the message is dropped and counted, and the writer can try
+// again next frame.
+//
+// A message is a ControlMessageHeader, valueCount doubles and then text, padded to
+// a multiple of 8 bytes. A message never wraps around the end of a ring; the
+// space left there is skipped with a CONTROL_PAD header.
+
+static const uint32_t kControlChannelMagic = 0x4c43584e;    // "NXCL"
+static const uint32_t kControlChannelVersion = 2;
+static const char* const kControlChannelVariable = "NEXPO_CONTROL_CHANNEL";
+
+// Ring sizes are powers of two, so positions can wrap around with the counters
+static const uint32_t kControlToIdeBytes = 1 << 16;
+static const uint32_t kControlToPlayerBytes = 1 << 12;
+
+static const int kControlMaxValues = 4;
+static const uint32_t kControlMaxText = 1024;
+
+enum ControlMessageType {
+    CONTROL_PAD,
+    CONTROL_FRAME,          // to the IDE: values[0] is the script's elapsed time
+    CONTROL_NUMBER,         // to the player: values[0] is the control's new value
+    CONTROL_STRING,         // to the IDE: text is the control's new value
+    CONTROL_SLIDER,         // to the IDE: values are min, max and initial, text is the name
+    CONTROL_PLOT,           // to the IDE: text is the name
+    CONTROL_SAMPLES         // to the IDE: text is packed ControlSamples, sent after CONTROL_FRAME
+};
+
+struct ControlMessageHeader
+{
+    uint16_t size;          // bytes including this header, before padding
+    uint8_t type;           // ControlMessageType
+    uint8_t valueCount;
+    uint32_t id;            // the script numbers its controls from 1
+};
+
+// Number values changed in a frame, packed together so a frame's worth of them
+// takes one or a few messages
+struct ControlSample
+{
+    uint32_t id;
+    uint32_t reserved;
+    double value;
+};
+
+static const uint32_t kControlSamplesPerMessage = kControlMaxText / sizeof(ControlSample);
+
+// Positions are free running byte counts. Only the writer stores written and only
+// the reader stores read. The file starts out zeroed, which is a valid state for
+// the atomics as long as they're lock free.
+struct ControlRing
+{
+    std::atomic<uint32_t> written;
+    std::atomic<uint32_t> read;
+    std::atomic<uint32_t> dropped;
+    uint32_t size;
+};
+
+static_assert(ATOMIC_INT_LOCK_FREE == 2, "the control channel needs lock free atomics in shared memory");
+
+struct ControlChannelHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    ControlRing toIde;
+    ControlRing toPlayer;
+};
+
+static const size_t kControlToIdeOffset = 64;
+static const size_t kControlToPlayerOffset = kControlToIdeOffset + kControlToIdeBytes;
+static const size_t kControlChannelBytes = kControlToPlayerOffset + kControlToPlayerBytes;
+
+static_assert(sizeof(ControlChannelHeader) <= kControlToIdeOffset, "control channel header overlaps the rings");
+
+// A message read from a ring. text is null terminated.
+struct ControlMessage
+{
+    int type;
+    uint32_t id;
+    int valueCount;
+    double values[kControlMaxValues];
+    uint32_t textLength;
+    char text[kControlMaxText + 1];
+};
+
+inline uint32_t controlPaddedSize(uint32_t size)
+{
+    return (size + 7) & ~7u;
+}
+
+// Called by the IDE on a freshly zeroed file
+inline void initControlChannel(ControlChannelHeader* header)
+{
+    header->toIde.size = kControlToIdeBytes;
+    header->toPlayer.size = kControlToPlayerBytes;
+    header->version = kControlChannelVersion;
+    header->magic = kControlChannelMagic;
+}
+
+// Returns false, counting a dropped message, if there isn't room for it
+inline bool writeControlMessage(ControlRing* ring, char* data, int type, uint32_t id,
+                                const double* values, int valueCount, const char* text, uint32_t textLength)
+{
+    if (valueCount > kControlMaxValues || textLength > kControlMaxText) return false;
+    uint32_t size = sizeof(ControlMessageHeader) + valueCount * sizeof(double) + textLength;
+    uint32_t padded = controlPaddedSize(size);
+
+    uint32_t written = ring->written.load(std::memory_order_relaxed);
+    uint32_t read = ring->read.load(std::memory_order_acquire);
+    uint32_t offset = written & (ring->size - 1);
+    uint32_t untilEnd = ring->size - offset;
+    uint32_t needed = padded <= untilEnd ? padded : untilEnd + padded;
+    if (ring->size - (written - read) < needed) {
+        ring->dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    if (padded > untilEnd) {
+        ControlMessageHeader pad = ControlMessageHeader();
+        pad.type = CONTROL_PAD;
+        memcpy(data + offset, &pad, sizeof(pad));
+        written += untilEnd;
+        offset = 0;
+    }
+
+    ControlMessageHeader header;
+    header.size = (uint16_t)size;
+    header.type = (uint8_t)type;
+    header.valueCount = (uint8_t)valueCount;
+    header.id = id;
+    char* dest = data + offset;
+    memcpy(dest, &header, sizeof(header));
+    if (valueCount) memcpy(dest + sizeof(header), values, valueCount * sizeof(double));
+    if (textLength) memcpy(dest + sizeof(header) + valueCount * sizeof(double), text, textLength);
+
+    ring->written.store(written + padded, std::memory_order_release);
+    return true;
+}
+
+// Takes the oldest message, returning false if there are none
+inline bool readControlMessage(ControlRing* ring, const char* data, ControlMessage* message)
+{
+    while (true) {
+        uint32_t read = ring->read.load(std::memory_order_relaxed);
+        if (read == ring->written.load(std::memory_order_acquire)) return false;
+
+        uint32_t offset = read & (ring->size - 1);
+        ControlMessageHeader header;
+        memcpy(&header, data + offset, sizeof(header));
+        if (header.type == CONTROL_PAD) {
+            ring->read.store(read + (ring->size - offset), std::memory_order_release);
+            continue;
+        }
+
+        message->type = header.type;
+        message->id = header.id;
+        message->valueCount = header.valueCount < kControlMaxValues ? header.valueCount : kControlMaxValues;
+        const char* src = data + offset + sizeof(header);
+        memcpy(message->values, src, message->valueCount * sizeof(double));
+        src += header.valueCount * sizeof(double);
+        uint32_t textLength = header.size - (uint32_t)(src - (data + offset));
+        message->textLength = textLength < kControlMaxText ? textLength : kControlMaxText;
+        memcpy(message->text, src, message->textLength);
+        message->text[message->textLength] = 0;
+
+        ring->read.store(read + controlPaddedSize(header.size), std::memory_order_release);
+        return true;
+    }
+}
+
+#endif // CONTROLPROTOCOL_H
@@ -0,0 +1,157 @@
+#include "controlsampler.h"
+#include "controlchannel.h"
+#include "controlprotocol.h"
+#include "canvas.h"
+#include "frametiming.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+struct WatchedControl
+{
+    bool watched;
+    bool sent;              // false until a value has been sent, and after one is lost
+    bool queued;            // in gSamples this frame
+    const double* pointer;  // null when Lua samples the control
+    double period;          // 0 to sample every frame
+    double threshold;
+    double nextDue;
+    unsigned int listedFrame;   // frameCount() + 1 of the frame it was last sampled in, 0 if never
+    double lastSent;
+};
+
+static std::vector<WatchedControl> gWatched;   // indexed by id
+static std::vector<ControlSample> gSamples;    // changed values waiting for sendControlSamples()
+static unsigned int gWatchedCount;
+
+
+static void watch(unsigned int id, const double* pointer, double rate, double threshold)
+{
+    if (id == 0) return;
+    if (id >= gWatched.size()) {
+        gWatched.resize(id + 1, WatchedControl());
+    }
+    WatchedControl& control = gWatched[id];
+    if (!control.watched) gWatchedCount++;
+    control = WatchedControl();
+    control.watched = true;
+    control.pointer = pointer;
+    control.period = rate > 0 ? 1 / rate : 0;
+    control.threshold = std::max(0.0, threshold);
+
+    // Every control could change in the same frame
+    gSamples.reserve(gWatchedCount);
+}
+
+static bool queueSample(unsigned int id, WatchedControl& control, double value)
+{
+    bool changed = !control.sent || std::fabs(value - control.lastSent) > control.threshold
+            || (std::isnan(value) != std::isnan(control.lastSent));
+    if (!changed) return false;
+
+    control.sent = true;
+    control.lastSent = value;
+
+    // Without a channel, Lua prints the values that changed
+    if (!controlChannelOpen()) return true;
+
+    if (control.queued) {
+        // Sampled twice in a frame; only the latest value goes
+        for (size_t i=0; i<gSamples.size(); i++) {
+            if (gSamples[i].id == id) gSamples[i].value = value;
+        }
+    } else {
+        ControlSample sample;
+        sample.id = id;
+        sample.reserved = 0;
+        sample.value = value;
+        gSamples.push_back(sample);
+        control.queued = true;
+    }
+    return true;
+}
+
+// Lua samples the control itself when it's listed by dueControls(). rate is in
+// samples per second, or 0 for every frame.
+LUAEXPORT(void watchControl(unsigned int id, double rate, double threshold))
+{
+    watch(id, 0, rate, threshold);
+}
+
+// The value is read from the pointer when due, so it must stay valid until the
+// control is unwatched or watched again
+LUAEXPORT(void watchControlPointer(unsigned int id, const double* value, double rate, double threshold))
+{
+    watch(id, value, rate, threshold);
+}
+
+LUAEXPORT(void unwatchControl(unsigned int id))
+{
+    if (id >= gWatched.size() || !gWatched[id].watched) return;
+    gWatched[id] = WatchedControl();
+    gWatchedCount--;
+    for (size_t i=0; i<gSamples.size(); i++) {
+        if (gSamples[i].id == id) {
+            gSamples.erase(gSamples.begin() + i);
+            break;
+        }
+    }
+}
+
+// Samples the pointer controls that are due and copies the ids of up to max of
+// the others into ids, for Lua to sample. Those listed aren't due again until
+// their next sample time, and never twice in a frame, so call again while it
+// fills ids.
+LUAEXPORT(unsigned int dueControls(unsigned int* ids, unsigned int max))
+{
+    double now = canvasTime();
+    unsigned int frame = frameCount() + 1;
+    unsigned int n = 0;
+    for (unsigned int id=1; id<gWatched.size() && n<max; id++) {
+        WatchedControl& control = gWatched[id];
+        if (!control.watched || control.nextDue > now || control.listedFrame == frame) continue;
+        control.listedFrame = frame;
+
+        // Keep to the rate on average, but don't catch up after a stall
+        control.nextDue += control.period;
+        if (control.nextDue <= now) control.nextDue = now + control.period;
+
+        if (control.pointer) {
+            queueSample(id, control, *control.pointer);
+        } else {
+            ids[n++] = id;
+        }
+    }
+    return n;
+}
+
+// Returns true if the value changed by more than the control's threshold since
+// the last one sent. It's then sent with the next sendControlSamples().
+LUAEXPORT(bool sampleControl(unsigned int id, double value))
+{
+    if (id >= gWatched.size() || !gWatched[id].watched) return false;
+    return queueSample(id, gWatched[id], value);
+}
+
+// For values set by the IDE, so they aren't sent back to it
+LUAEXPORT(void setSampledControlValue(unsigned int id, double value))
+{
+    if (id >= gWatched.size() || !gWatched[id].watched) return;
+    gWatched[id].sent = true;
+    gWatched[id].lastSent = value;
+}
+
+// Sends the values queued this frame through the control channel, after
+// sendControlFrame(). Returns how many were sent; any that didn't fit are sent
+// again when next sampled.
+LUAEXPORT(unsigned int sendControlSamples())
+{
+    unsigned int sent = writeControlSamples(gSamples.data(), (unsigned int)gSamples.size());
+    for (size_t i=0; i<gSamples.size(); i++) {
+        WatchedControl& control = gWatched[gSamples[i].id];
+        control.queued = false;
+        if (i >= sent) control.sent = false;
+    }
+    gSamples.clear();
+    return sent;
+}
@@ -0,0 +1,23 @@
+#ifndef CONTROLSAMPLER_H
+#define CONTROLSAMPLER_H
+#include "common.h"
+
+// Decides when each live control is sampled and whether its value has changed
+// enough to send. Each control has a rate, so a plot sampled at 10 Hz costs
+// nothing on the frames in between, and a threshold that small changes have to
+// exceed. Values read through a pointer, such as a field of an FFI struct, are
+// sampled here without Lua; Lua samples the rest when dueControls() lists them.
+// Changed values are packed into a buffer allocated when controls are watched
+// and sent to the IDE together once a frame.
+//
+// Controls are numbered by Lua from 1, and are found by indexing with their id.
+
+DLLEXPORT void watchControl(unsigned int id, double rate, double threshold);
+DLLEXPORT void watchControlPointer(unsigned int id, const double* value, double rate, double threshold);
+DLLEXPORT void unwatchControl(unsigned int id);
+DLLEXPORT unsigned int dueControls(unsigned int* ids, unsigned int max);
+DLLEXPORT bool sampleControl(unsigned int id, double value);
+DLLEXPORT void setSampledControlValue(unsigned int id, double value);
+DLLEXPORT unsigned int sendControlSamples();
+
+#endif // CONTROLSAMPLER_H
@@ -0,0 +1,166 @@
+#include "tessellator.h"
+#include "path.h"
+#include "poly2tri/poly2tri/poly2tri.h"
+#include <stdexcept>
+#include <math.h>
+
+static inline float cross(const vec2& o, const vec2& a, const vec2& b)
+{
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+// Appends a contour to rings without repeated or collinear points, which poly2tri
+// can't handle. Contours left with no area are skipped.
+static void appendRing(Contours& rings, const vec2* points, size_t size)
+{
+    size_t start = rings.points.size();
+    std::vector<vec2>& ring = rings.points;
+
+    for (size_t i=0; i<size; i++) {
+        while (ring.size() - start >= 2 && cross(ring[ring.size()-2], ring.back(), points[i]) == 0) {
+            ring.pop_back();
+        }
+        if (ring.size() == start || ring.back() != points[i]) {
+            ring.push_back(points[i]);
+        }
+    }
+
+    // The same again where the contour wraps round
+    while (ring.size() - start >= 3) {
+        size_t n = ring.size();
+        if (cross(ring[n-2], ring[n-1], ring[start]) == 0) {
+            ring.pop_back();
+        } else if (cross(ring[n-1], ring[start], ring[start+1]) == 0) {
+            ring.erase(ring.begin() + start);
+        } else {
+            break;
+        }
+    }
+
+    if (ring.size() - start < 3) {
+        ring.resize(start);
+        return;
+    }
+
+    rings.offsets.push_back((unsigned int)ring.size());
+    rings.closed.push_back(1);
+}
+
+static float ringArea(const vec2* p, size_t n)
+{
+    float area = 0;
+    for (size_t i=0, j=n-1; i<n; j=i++) {
+        area += p[j].x * p[i].y - p[i].x * p[j].y;
+    }
+    return area * 0.5f;
+}
+
+static bool pointInRing(const vec2& p, const vec2* ring, size_t n)
+{
+    bool inside = false;
+    for (size_t i=0, j=n-1; i<n; j=i++) {
+        if ((ring[i].y > p.y) != (ring[j].y > p.y)
+                && p.x < (ring[j].x - ring[i].x) * (p.y - ring[i].y) / (ring[j].y - ring[i].y) + ring[i].x) {
+            inside = !inside;
+        }
+    }
+    return inside;
+}
+
+bool Poly2triTriangulator::triangulate(const Contours& contours, Mesh* mesh)
+{
+    mesh->vertices.clear();
+    mesh->indices.clear();
+
+    Contours& rings = m_rings;
+    rings.clear();
+    for (size_t c=0; c<contours.count(); c++) {
+        appendRing(rings, contours.contour(c), contours.contourSize(c));
+    }
+    size_t count = rings.count();
+    if (count == 0) return true;
+
+    if (edgesTouch(rings.points.data(), rings.offsets.data(), count, m_order, m_next)) {
+        return false;
+    }
+
+    // With no crossings, a contour is either wholly inside another or wholly outside
+    // it. Under the even-odd rule, contours inside an odd number of others are holes
+    // in the contour directly around them, and the rest are outlines.
+    m_depth.assign(count, 0);
+    m_parent.assign(count, -1);
+    for (size_t i=0; i<count; i++) {
+        for (size_t j=0; j<count; j++) {
+            if (i != j && pointInRing(*rings.contour(i), rings.contour(j), rings.contourSize(j))) {
+                m_depth[i]++;
+            }
+        }
+    }
+    float expectedArea = 0;
+    for (size_t i=0; i<count; i++) {
+        float area = fabsf(ringArea(rings.contour(i), rings.contourSize(i)));
+        if (m_depth[i] % 2 == 0) {
+            expectedArea += area;
+            continue;
+        }
+
+        expectedArea -= area;
+        for (size_t j=0; j<count; j++) {
+            if (m_depth[j] == m_depth[i] - 1 && pointInRing(*rings.contour(i), rings.contour(j), rings.contourSize(j))) {
+                m_parent[i] = (int)j;
+                break;
+            }
+        }
+    }
+
+    // poly2tri links edges into its points, so they're made fresh for each run
+    std::vector<p2t::Point> points(rings.points.size());
+    for (size_t i=0; i<points.size(); i++) {
+        points[i].set(rings.points[i].x, rings.points[i].y);
+    }
+
+    std::vector<p2t::Point*> polyline;
+    try {
+        for (size_t i=0; i<count; i++) {
+            if (m_depth[i] % 2 != 0) continue;
+
+            polyline.clear();
+            for (unsigned int k=rings.offsets[i]; k<rings.offsets[i+1]; k++) polyline.push_back(&points[k]);
+            p2t::CDT cdt(polyline);
+
+            for (size_t h=0; h<count; h++) {
+                if (m_parent[h] != (int)i) continue;
+                polyline.clear();
+                for (unsigned int k=rings.offsets[h]; k<rings.offsets[h+1]; k++) polyline.push_back(&points[k]);
+                cdt.AddHole(polyline);
+            }
+
+            cdt.Triangulate();
+            std::vector<p2t::Triangle*> triangles = cdt.GetTriangles();
+            for (size_t t=0; t<triangles.size(); t++) {
+                for (int k=0; k<3; k++) {
+                    mesh->indices.push_back((unsigned int)(triangles[t]->GetPoint(k) - &points[0]));
+                }
+            }
+        }
+    } catch (const std::exception&) {
+        mesh->indices.clear();
+        return false;
+    }
+
+    mesh->vertices.assign(rings.points.begin(), rings.points.end());
+
+    // poly2tri doesn't report every failure, so check the triangles cover the right area
+    float area = 0;
+    for (size_t i=0; i<mesh->indices.size(); i+=3) {
+        const vec2& a = mesh->vertices[mesh->indices[i]];
+        area += fabsf(cross(a, mesh->vertices[mesh->indices[i+1]], mesh->vertices[mesh->indices[i+2]])) * 0.5f;
+    }
+    if (fabsf(area - expectedArea) > 1e-3f * expectedArea) {
+        mesh->vertices.clear();
+        mesh->indices.clear();
+        return false;
+    }
+
+    return true;
+}
@@ -1,4 +1,5 @@
 #include "font.h"
+#include "jobs.h"
 #include <fstream>
 #include <string>
 #include <iostream>
@@ -67,6 +68,7 @@ LUAEXPORT(Path* pathForCodepoint(Font* font, int codepoint))
     stbtt_vertex* verts;
     int nvert = stbtt_GetCodepointShape(&font->m_fontInfo, codepoint, &verts);
     if (nvert == 0) {
+        stbtt_FreeShape(&font->m_fontInfo, verts);
         return 0;
     }
 
@@ -99,9 +101,42 @@ LUAEXPORT(Path* pathForCodepoint(Font* font, int codepoint))
         }
     }
 
+    stbtt_FreeShape(&font->m_fontInfo, verts);
+
     return path;
 }
 
+struct CodepointBatch
+{
+    Font* font;
+    const int* codepoints;
+    Path** paths;
+    float pixelsPerUnit;
+};
+
+static void buildCodepoint(void* data, size_t i)
+{
+    CodepointBatch* batch = (CodepointBatch*)data;
+    batch->paths[i] = pathForCodepoint(batch->font, batch->codepoints[i]);
+    if (batch->paths[i] && batch->pixelsPerUnit > 0) {
+        fillPath(batch->paths[i], batch->pixelsPerUnit);
+    }
+}
+
+// Extracts the outlines of many codepoints in parallel, writing one path (or null) per
+// codepoint into paths. If pixelsPerUnit > 0 the filled meshes are built as well.
+LUAEXPORT(void pathsForCodepoints(Font* font, const int* codepoints, Path** paths, int count, float pixelsPerUnit))
+{
+    if (!font || count <= 0) return;
+
+    CodepointBatch batch;
+    batch.font = font;
+    batch.codepoints = codepoints;
+    batch.paths = paths;
+    batch.pixelsPerUnit = pixelsPerUnit;
+    parallelFor(count, buildCodepoint, &batch);
+}
+
 LUAEXPORT(void freeFont(Font* font))
 {
     delete font;
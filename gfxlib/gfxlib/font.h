@@ -9,6 +9,7 @@ class Font;
 
 DLLEXPORT Font* loadFont(const char* path);
 DLLEXPORT Path* pathForCodepoint(Font* font, int codepoint);
+DLLEXPORT void pathsForCodepoints(Font* font, const int* codepoints, Path** paths, int count, float pixelsPerUnit);
 DLLEXPORT void freeFont(Font* font);
 
 #endif // FONT_H
@@ -0,0 +1,527 @@
+#include "frametiming.h"
+#include "canvas.h"
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <chrono>
+#include <stdlib.h>
+#include <math.h>
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+#ifndef GL_TIMESTAMP
+#define GL_TIMESTAMP 0x8E28
+#endif
+
+// ARB_sync constants
+#define SYNC_GPU_COMMANDS_COMPLETE      0x9117
+#define SYNC_FLUSH_COMMANDS_BIT         0x00000001
+#define SYNC_TIMEOUT_EXPIRED            0x911B
+#define SYNC_WAIT_FAILED                0x911D
+
+static const size_t kDefaultFrameRecords = 1 << 14;
+
+// Timer query results are read this many frames after the queries were issued
+static const unsigned int kGpuTimingLatency = 4;
+
+static std::vector<FrameRecord> gFrameRecords(kDefaultFrameRecords);
+static std::vector<double> gSummaryScratch;
+static FrameRecord gCurrentFrame;
+static unsigned int gFrameCount;        // frames recorded so far
+static unsigned int gFirstFrame;        // first frame still recorded after the ring was last cleared
+static double gLastSwapReturned;
+static double gRefreshPeriod;
+static bool gVsync;
+
+// ARB_timer_query entry points, loaded at run time since they're extensions to GL 2.1
+typedef void (APIENTRY* QueryCounterFunc)(GLuint id, GLenum target);
+typedef void (APIENTRY* GetQueryObjectui64vFunc)(GLuint id, GLenum pname, GLuint64* params);
+static QueryCounterFunc gQueryCounter;
+static GetQueryObjectui64vFunc gGetQueryObjectui64v;
+
+// ARB_sync entry points, loaded the same way. Sync objects are opaque pointers,
+// declared here since the Mac headers for GL 2.1 don't have GLsync.
+typedef void* SyncObject;
+typedef SyncObject (APIENTRY* FenceSyncFunc)(GLenum condition, GLbitfield flags);
+typedef GLenum (APIENTRY* ClientWaitSyncFunc)(SyncObject sync, GLbitfield flags, GLuint64 timeout);
+typedef void (APIENTRY* DeleteSyncFunc)(SyncObject sync);
+static FenceSyncFunc gFenceSync;
+static ClientWaitSyncFunc gClientWaitSync;
+static DeleteSyncFunc gDeleteSync;
+
+static const int kMaxFramesInFlight = 2;
+static const double kFenceTimeout = 1.0;
+static const GLuint64 kFencePollTimeout = 1000000;      // nanoseconds
+
+// Sleeps can overshoot by a millisecond or two, so the end of a wait is spun out
+static const double kSpinTime = 0.002;
+static const double kPollInterval = 0.001;
+
+// Frames the automatic start margin is worked out from
+static const unsigned int kMarginFrames = 32;
+
+struct FrameFence
+{
+    SyncObject sync;
+    unsigned int frame;
+};
+
+static FrameFence gFences[kMaxFramesInFlight];
+static int gFramesInFlight;             // 0 for no limit
+static double gFrameStartMargin;        // 0 to start frames straight away, negative to choose automatically
+
+// Timer queries of one frame
+struct GpuFrame
+{
+    GpuFrame() : used(0), frame(0), pending(false) {}
+
+    std::vector<GLuint> queries;        // frame start, the start and end of each draw, then the frame end
+    std::vector<double> drawCpuTimes;
+    size_t used;
+    unsigned int frame;
+    bool pending;                       // issued and not read yet
+};
+
+static GpuFrame gGpuFrames[kGpuTimingLatency];
+static GpuFrame* gGpuFrame;             // the frame being recorded, if GPU timing is on
+static int gGpuTimingMode = GPU_TIMING_OFF;
+static bool gInDraw;
+static double gDrawStart;
+static std::vector<GLuint64> gQueryResults;
+static std::vector<DrawTiming> gDrawTimings;     // of the most recent frame read back
+static unsigned int gDrawTimingFrame;
+
+
+void setFrameTimingRefresh(int refreshRate, bool vsync)
+{
+    if (refreshRate > 0) {
+        gRefreshPeriod = 1.0 / refreshRate;
+    }
+    gVsync = vsync;
+}
+
+void recordFrameSwap(double issued, double returned)
+{
+    FrameRecord& frame = gCurrentFrame;
+    frame.swapIssued = issued;
+    frame.swapReturned = returned;
+    frame.interval = gLastSwapReturned > 0 ? returned - gLastSwapReturned : 0;
+    frame.missed = 0;
+    frame.index = gFrameCount;
+    frame.gpuTime = -1;
+    frame.completed = -1;
+    gLastSwapReturned = returned;
+
+    if (gVsync && frame.interval > 0) {
+        if (gRefreshPeriod <= 0) {
+            gRefreshPeriod = frame.interval;
+        } else if (fabs(frame.interval - gRefreshPeriod) < 0.2 * gRefreshPeriod) {
+            // Follow the real refresh rate, which is rarely exactly what the mode says,
+            // using only intervals that look like a single refresh
+            gRefreshPeriod += 0.05 * (frame.interval - gRefreshPeriod);
+        }
+        frame.missed = std::max(0, (int)floor(frame.interval / gRefreshPeriod + 0.5) - 1);
+    }
+
+    gFrameRecords[gFrameCount % gFrameRecords.size()] = frame;
+    gFrameCount++;
+
+    frame = FrameRecord();
+}
+
+FrameRecord suspendFrameRecord()
+{
+    FrameRecord frame = gCurrentFrame;
+    gCurrentFrame = FrameRecord();
+    return frame;
+}
+
+void resumeFrameRecord(const FrameRecord& frame)
+{
+    gCurrentFrame = frame;
+}
+
+static GLuint nextQuery(GpuFrame& frame)
+{
+    if (frame.used == frame.queries.size()) {
+        size_t n = std::max<size_t>(16, frame.queries.size());
+        frame.queries.resize(frame.queries.size() + n);
+        glGenQueries((GLsizei)n, &frame.queries[frame.queries.size() - n]);
+    }
+    return frame.queries[frame.used++];
+}
+
+static void readGpuFrame(GpuFrame& frame)
+{
+    frame.pending = false;
+
+    // Timestamps complete in order, so if the last is available they all are. If it
+    // isn't the GPU is more than kGpuTimingLatency frames behind; drop the frame
+    // rather than wait.
+    GLuint available = 0;
+    glGetQueryObjectuiv(frame.queries[frame.used - 1], GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) return;
+
+    gQueryResults.resize(frame.used);
+    for (size_t i=0; i<frame.used; i++) {
+        gGetQueryObjectui64v(frame.queries[i], GL_QUERY_RESULT, &gQueryResults[i]);
+    }
+
+    if (frame.frame >= firstRecordedFrame() && frame.frame < gFrameCount) {
+        FrameRecord& record = gFrameRecords[frame.frame % gFrameRecords.size()];
+        record.gpuTime = (gQueryResults[frame.used - 1] - gQueryResults[0]) * 1e-9;
+    }
+
+    if (!frame.drawCpuTimes.empty()) {
+        gDrawTimings.resize(frame.drawCpuTimes.size());
+        for (size_t i=0; i<gDrawTimings.size(); i++) {
+            gDrawTimings[i].cpu = frame.drawCpuTimes[i];
+            gDrawTimings[i].gpu = (gQueryResults[2*i + 2] - gQueryResults[2*i + 1]) * 1e-9;
+        }
+        gDrawTimingFrame = frame.frame;
+    }
+}
+
+LUAEXPORT(void beginFrame())
+{
+    gCurrentFrame.frameStart = canvasTime();
+    if (gGpuTimingMode == GPU_TIMING_OFF) return;
+
+    GpuFrame& frame = gGpuFrames[gFrameCount % kGpuTimingLatency];
+    if (frame.pending) {
+        readGpuFrame(frame);
+    }
+    frame.used = 0;
+    frame.drawCpuTimes.clear();
+    frame.frame = gFrameCount;
+    gQueryCounter(nextQuery(frame), GL_TIMESTAMP);
+    gGpuFrame = &frame;
+}
+
+void endGpuFrame()
+{
+    if (!gGpuFrame) return;
+    gQueryCounter(nextQuery(*gGpuFrame), GL_TIMESTAMP);
+    gGpuFrame->pending = true;
+    gGpuFrame = 0;
+
+    // Swapping flushes, but not every drawable swaps. Without a flush the queries
+    // may not even have been sent to the GPU by the time they're read.
+    glFlush();
+}
+
+void fenceFrame()
+{
+    if (gFramesInFlight == 0) return;
+
+    // Frame n's fence goes in slot n % gFramesInFlight, where the fence of frame
+    // n - gFramesInFlight was, and the oldest fence left is frame n - gFramesInFlight + 1's
+    unsigned int frame = gFrameCount - 1;
+    FrameFence& fence = gFences[frame % gFramesInFlight];
+    fence.sync = gFenceSync(SYNC_GPU_COMMANDS_COMPLETE, 0);
+    fence.frame = frame;
+
+    FrameFence& oldest = gFences[(frame + 1) % gFramesInFlight];
+    if (!oldest.sync) return;
+
+    // Input events are timestamped when they're polled, so wait in short steps
+    // and poll in between rather than blocking for the whole frame
+    double waitStart = canvasTime();
+    GLenum result = gClientWaitSync(oldest.sync, SYNC_FLUSH_COMMANDS_BIT, kFencePollTimeout);
+    while (result == SYNC_TIMEOUT_EXPIRED && canvasTime() - waitStart < kFenceTimeout) {
+        pollEvents();
+        result = gClientWaitSync(oldest.sync, 0, kFencePollTimeout);
+    }
+    double now = canvasTime();
+    gDeleteSync(oldest.sync);
+    oldest.sync = 0;
+
+    if (result == SYNC_TIMEOUT_EXPIRED || result == SYNC_WAIT_FAILED) return;
+    if (oldest.frame >= firstRecordedFrame() && oldest.frame < gFrameCount) {
+        gFrameRecords[oldest.frame % gFrameRecords.size()].completed = now;
+    }
+}
+
+static void deleteFences()
+{
+    for (int i=0; i<kMaxFramesInFlight; i++) {
+        if (gFences[i].sync) {
+            gDeleteSync(gFences[i].sync);
+            gFences[i].sync = 0;
+        }
+    }
+}
+
+// Enough time to draw a frame, judging by the slowest of the last few
+static double autoFrameStartMargin()
+{
+    unsigned int first = firstRecordedFrame();
+    if (gFrameCount - first > kMarginFrames) {
+        first = gFrameCount - kMarginFrames;
+    }
+    // Nothing to judge by yet, so start straight away
+    if (first == gFrameCount) return gRefreshPeriod;
+
+    double slowest = 0;
+    for (unsigned int i=first; i<gFrameCount; i++) {
+        const FrameRecord& frame = gFrameRecords[i % gFrameRecords.size()];
+        slowest = std::max(slowest, frame.swapIssued - frame.frameStart + std::max(0.0, frame.gpuTime));
+    }
+    return std::min(gRefreshPeriod, 1.25 * slowest + 0.001);
+}
+
+void beginDrawTiming()
+{
+    if (!gGpuFrame || gGpuTimingMode != GPU_TIMING_DRAWS || gInDraw) return;
+    gInDraw = true;
+    gDrawStart = canvasTime();
+    gQueryCounter(nextQuery(*gGpuFrame), GL_TIMESTAMP);
+}
+
+void endDrawTiming()
+{
+    if (!gInDraw) return;
+    gInDraw = false;
+    if (!gGpuFrame) return;
+    gQueryCounter(nextQuery(*gGpuFrame), GL_TIMESTAMP);
+    gGpuFrame->drawCpuTimes.push_back(canvasTime() - gDrawStart);
+}
+
+LUAEXPORT(void endFrame())
+{
+    gCurrentFrame.frameEnd = canvasTime();
+}
+
+LUAEXPORT(unsigned int frameCount())
+{
+    return gFrameCount;
+}
+
+LUAEXPORT(double refreshPeriod())
+{
+    return gRefreshPeriod;
+}
+
+// The ring buffer. Frame n is at index n % frameRecordCapacity() while
+// firstRecordedFrame() <= n < frameCount().
+LUAEXPORT(const FrameRecord* frameRecords())
+{
+    return &gFrameRecords[0];
+}
+
+LUAEXPORT(unsigned int frameRecordCapacity())
+{
+    return (unsigned int)gFrameRecords.size();
+}
+
+LUAEXPORT(unsigned int firstRecordedFrame())
+{
+    unsigned int capacity = (unsigned int)gFrameRecords.size();
+    if (gFrameCount - gFirstFrame > capacity) {
+        return gFrameCount - capacity;
+    }
+    return gFirstFrame;
+}
+
+// Clears the records, frame numbers carry on from where they were
+LUAEXPORT(bool setFrameRecordCapacity(unsigned int capacity))
+{
+    if (capacity == 0) {
+        std::cerr << "Error: frame record capacity must be at least 1" << std::endl;
+        return false;
+    }
+    gFrameRecords.assign(capacity, FrameRecord());
+    gFirstFrame = gFrameCount;
+    return true;
+}
+
+// Starts timing over: the next frame has no interval, and so can't count as dropped
+LUAEXPORT(void resetFrameTiming())
+{
+    gLastSwapReturned = 0;
+}
+
+// Summarises the recorded frames numbered since or later. Returns the number of frames.
+LUAEXPORT(unsigned int frameSummary(unsigned int since, FrameSummary* summary))
+{
+    *summary = FrameSummary();
+    summary->refreshPeriod = gRefreshPeriod;
+
+    unsigned int first = std::max(since, firstRecordedFrame());
+    if (first >= gFrameCount) return 0;
+
+    size_t capacity = gFrameRecords.size();
+    gSummaryScratch.clear();
+    double total = 0;
+    double totalGpu = 0;
+    double totalLatency = 0;
+    double totalGc = 0;
+    for (unsigned int i=first; i<gFrameCount; i++) {
+        const FrameRecord& frame = gFrameRecords[i % capacity];
+        summary->frames++;
+        if (frame.missed > 0) {
+            summary->dropped++;
+            summary->missed += frame.missed;
+        }
+        summary->maxFrameTime = std::max(summary->maxFrameTime, frame.frameEnd - frame.frameStart);
+        summary->maxGcTime = std::max(summary->maxGcTime, frame.gcTime);
+        totalGc += frame.gcTime;
+        if (frame.gpuTime >= 0) {
+            summary->gpuFrames++;
+            summary->maxGpuTime = std::max(summary->maxGpuTime, frame.gpuTime);
+            totalGpu += frame.gpuTime;
+        }
+        if (frame.completed >= 0) {
+            double latency = frame.completed - frame.frameStart;
+            summary->latencyFrames++;
+            summary->maxLatency = std::max(summary->maxLatency, latency);
+            totalLatency += latency;
+        }
+
+        // The first frame after a reset has no interval
+        if (frame.interval > 0) {
+            gSummaryScratch.push_back(frame.interval);
+            total += frame.interval;
+        }
+    }
+
+    if (summary->gpuFrames > 0) {
+        summary->meanGpuTime = totalGpu / summary->gpuFrames;
+    }
+    if (summary->latencyFrames > 0) {
+        summary->meanLatency = totalLatency / summary->latencyFrames;
+    }
+    summary->meanGcTime = totalGc / summary->frames;
+
+    size_t n = gSummaryScratch.size();
+    if (n > 0) {
+        std::sort(gSummaryScratch.begin(), gSummaryScratch.end());
+        summary->meanInterval = total / n;
+        summary->medianInterval = gSummaryScratch[(n - 1) / 2];
+        summary->p95Interval = gSummaryScratch[(size_t)ceil(0.95 * n) - 1];
+        summary->p99Interval = gSummaryScratch[(size_t)ceil(0.99 * n) - 1];
+        summary->maxInterval = gSummaryScratch[n - 1];
+    }
+
+    return summary->frames;
+}
+
+// Returns false if timer queries aren't supported. Needs a current GL context.
+LUAEXPORT(bool setGpuTiming(int mode))
+{
+    if (mode != GPU_TIMING_OFF && !gQueryCounter) {
+        if (canvasExtensionSupported("GL_ARB_timer_query")) {
+            gQueryCounter = (QueryCounterFunc)canvasProcAddress("glQueryCounter");
+            gGetQueryObjectui64v = (GetQueryObjectui64vFunc)canvasProcAddress("glGetQueryObjectui64v");
+        }
+        if (!gQueryCounter || !gGetQueryObjectui64v) {
+            std::cerr << "Error: GPU timing needs GL_ARB_timer_query, which this driver doesn't support" << std::endl;
+            gQueryCounter = 0;
+            return false;
+        }
+    }
+
+    if (mode == GPU_TIMING_OFF) {
+        for (unsigned int i=0; i<kGpuTimingLatency; i++) {
+            gGpuFrames[i].pending = false;
+        }
+        gGpuFrame = 0;
+    }
+    gGpuTimingMode = mode;
+    return true;
+}
+
+// Draw timings of the most recent frame whose results have come back, in draw order
+LUAEXPORT(const DrawTiming* drawTimings(unsigned int* count, unsigned int* frame))
+{
+    *count = (unsigned int)gDrawTimings.size();
+    *frame = gDrawTimingFrame;
+    return gDrawTimings.empty() ? 0 : &gDrawTimings[0];
+}
+
+// Limits how many frames can be queued ahead of the display to 1 or 2, or 0 for no
+// limit. Returns false if fences aren't supported. Needs a current GL context.
+LUAEXPORT(bool setFramesInFlight(int frames))
+{
+    if (frames < 0 || frames > kMaxFramesInFlight) {
+        std::cerr << "Error: frames in flight must be 0 (no limit), 1 or 2" << std::endl;
+        return false;
+    }
+    if (frames > 0 && !gFenceSync) {
+        const char* version = (const char*)glGetString(GL_VERSION);
+        bool core = version && (atoi(version) > 3 || (atoi(version) == 3 && version[2] >= '2'));
+        if (core || canvasExtensionSupported("GL_ARB_sync")) {
+            gFenceSync = (FenceSyncFunc)canvasProcAddress("glFenceSync");
+            gClientWaitSync = (ClientWaitSyncFunc)canvasProcAddress("glClientWaitSync");
+            gDeleteSync = (DeleteSyncFunc)canvasProcAddress("glDeleteSync");
+        }
+        if (!gFenceSync || !gClientWaitSync || !gDeleteSync) {
+            std::cerr << "Error: limiting frames in flight needs GL_ARB_sync, which this driver doesn't support" << std::endl;
+            gFenceSync = 0;
+            return false;
+        }
+    }
+
+    if (gFenceSync) {
+        deleteFences();
+    }
+    gFramesInFlight = frames;
+    return true;
+}
+
+// How long before the refresh a frame is meant for to start drawing it: 0 to start
+// as soon as the last frame is swapped, or negative to judge it from recent frames
+LUAEXPORT(void setFrameStartMargin(double seconds))
+{
+    gFrameStartMargin = seconds;
+}
+
+// Waits until the start margin before the next refresh, predicted from when the
+// last frame was shown. Only waits with vertical sync on, and predicts best with
+// frames in flight limited to 1. Returns the seconds waited.
+LUAEXPORT(double waitForFrameStart())
+{
+    if (gFrameStartMargin == 0 || !gVsync || gRefreshPeriod <= 0 || gLastSwapReturned <= 0) return 0;
+
+    double shown = gLastSwapReturned;
+    if (gFrameCount > 0) {
+        shown = std::max(shown, gFrameRecords[(gFrameCount - 1) % gFrameRecords.size()].completed);
+    }
+    double margin = gFrameStartMargin > 0 ? gFrameStartMargin : autoFrameStartMargin();
+    double start = shown + gRefreshPeriod - margin;
+
+    double now = canvasTime();
+    if (start <= now) return 0;
+
+    // Input events are timestamped when they're polled, so keep polling while waiting
+    for (double t = now; start - t > kSpinTime; t = canvasTime()) {
+        pollEvents();
+        std::this_thread::sleep_for(std::chrono::duration<double>(std::min(kPollInterval, start - t - kSpinTime)));
+    }
+    while (canvasTime() < start) {}
+    return canvasTime() - now;
+}
+
+// When the frame being drawn should be shown, predicted from when the last one
+// was. Returns 0 without vertical sync, or before a refresh period is known.
+LUAEXPORT(double nextRefreshTime())
+{
+    if (!gVsync || gRefreshPeriod <= 0 || gLastSwapReturned <= 0) return 0;
+
+    double next = gLastSwapReturned + gRefreshPeriod;
+    double now = canvasTime();
+    if (next <= now) {
+        // Already late, so it will be shown on a later refresh
+        next += ceil((now - next) / gRefreshPeriod) * gRefreshPeriod;
+    }
+    return next;
+}
+
+// Adds to the time spent collecting garbage in the frame being drawn
+LUAEXPORT(void recordGcTime(double seconds))
+{
+    gCurrentFrame.gcTime += seconds;
+}
@@ -0,0 +1,125 @@
+#ifndef FRAMETIMING_H
+#define FRAMETIMING_H
+#include "common.h"
+
+// Timing of every frame, for checking that each one was shown on the refresh it
+// was meant for. Records go in a ring buffer allocated up front, so recording
+// never allocates. All times are in seconds, from canvasTime().
+//
+// FrameRecord and FrameSummary are also declared in Nexpo.lua's ffi.cdef, so
+// keep the two in sync.
+
+struct FrameRecord
+{
+    double frameStart;          // onframe called
+    double frameEnd;            // onframe returned
+    double swapIssued;          // glfwSwapBuffers called
+    double swapReturned;        // glfwSwapBuffers returned
+    double interval;            // since the previous frame's swap returned, 0 for the first frame
+    double gpuTime;             // GPU time from beginFrame() to the swap, -1 until known or if not measured
+    double completed;           // the GPU had finished the frame and its swap, -1 if not measured
+    double gcTime;              // collecting garbage between onframe returning and the swap
+    int missed;                 // refreshes missed before this frame, 0 if it was on time
+    unsigned int index;         // frame number, counting from 0
+};
+
+struct FrameSummary
+{
+    unsigned int frames;        // frames summarised
+    unsigned int dropped;       // frames that missed at least one refresh
+    unsigned int missed;        // refreshes missed in total
+    double refreshPeriod;
+    double meanInterval;
+    double medianInterval;
+    double p95Interval;
+    double p99Interval;
+    double maxInterval;
+    double maxFrameTime;        // longest time spent in onframe
+    unsigned int gpuFrames;     // frames with a GPU time
+    double meanGpuTime;
+    double maxGpuTime;
+    unsigned int latencyFrames; // frames with a completion time
+    double meanLatency;         // from onframe being called to the frame being completed
+    double maxLatency;
+    double meanGcTime;
+    double maxGcTime;
+};
+
+// Time taken by one draw call, recorded when GPU timing is set to GPU_TIMING_DRAWS
+struct DrawTiming
+{
+    double cpu;                 // in the draw function, including any tessellation
+    double gpu;                 // between the GPU reaching the start and end of the draw
+};
+
+enum GpuTimingMode {
+    GPU_TIMING_OFF,
+    GPU_TIMING_FRAMES,
+    GPU_TIMING_DRAWS
+};
+
+// Called by the canvas when vertical sync or the refresh rate changes. Missed
+// refreshes are only counted with vertical sync on.
+void setFrameTimingRefresh(int refreshRate, bool vsync);
+
+// Called by swapBuffers() around glfwSwapBuffers, completes the current record
+void recordFrameSwap(double issued, double returned);
+
+// GL timer queries (ARB_timer_query) around each frame, and optionally each draw.
+// Results are read back a few frames later, once the GPU has finished with them,
+// so timing never waits for the GPU. Draw functions bracket their GL calls with
+// beginDrawTiming() and endDrawTiming(), which do nothing unless draws are timed.
+void beginDrawTiming();
+void endDrawTiming();
+void endGpuFrame();         // called by swapBuffers() before swapping
+
+// Bounding the frames queued ahead of the display with fences (ARB_sync), so input
+// read at the start of a frame is shown as soon as it can be. swapBuffers() puts
+// a fence after each swap and waits for the one from frames - 1 swaps ago, noting
+// when it finished in the frame's record. Optionally the next frame is started
+// late, a margin before the refresh it's meant for, so it's drawn from the most
+// recent input.
+void fenceFrame();          // called by swapBuffers() after swapping
+
+// Times the rest of the enclosing scope as one draw
+class ScopedDrawTiming
+{
+public:
+    ScopedDrawTiming() { beginDrawTiming(); }
+    ~ScopedDrawTiming() { endDrawTiming(); }
+};
+
+// Frames drawn and swapped from inside another frame, as when a sequence is
+// played from onframe, get records of their own. The enclosing frame's record is
+// set aside meanwhile, so it keeps its start time.
+FrameRecord suspendFrameRecord();
+void resumeFrameRecord(const FrameRecord& frame);
+
+class ScopedNestedFrames
+{
+public:
+    ScopedNestedFrames() : m_outer(suspendFrameRecord()) {}
+    ~ScopedNestedFrames() { resumeFrameRecord(m_outer); }
+private:
+    FrameRecord m_outer;
+};
+
+DLLEXPORT void beginFrame();
+DLLEXPORT void endFrame();
+DLLEXPORT unsigned int frameCount();
+DLLEXPORT double refreshPeriod();
+DLLEXPORT const FrameRecord* frameRecords();
+DLLEXPORT unsigned int frameRecordCapacity();
+DLLEXPORT unsigned int firstRecordedFrame();
+DLLEXPORT bool setFrameRecordCapacity(unsigned int capacity);
+DLLEXPORT void resetFrameTiming();
+DLLEXPORT unsigned int frameSummary(unsigned int since, FrameSummary* summary);
+DLLEXPORT bool setGpuTiming(int mode);
+DLLEXPORT const DrawTiming* drawTimings(unsigned int* count, unsigned int* frame);
+DLLEXPORT bool setFramesInFlight(int frames);
+DLLEXPORT void setFrameStartMargin(double seconds);
+DLLEXPORT double waitForFrameStart();
+DLLEXPORT double nextRefreshTime();
+DLLEXPORT void recordGcTime(double seconds);
+
+#endif // FRAMETIMING_H
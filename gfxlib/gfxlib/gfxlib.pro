@@ -37,15 +37,70 @@ win32 {
 
 }
 
+unix:!mac {
+    CONFIG(release, debug|release) {
+        LIBS += $$_PRO_FILE_PWD_/libtess2/build/linux/release/libtess2.a
+    } else {
+        LIBS += $$_PRO_FILE_PWD_/libtess2/build/linux/debug/libtess2.a
+    }
+    # glfw3 is static, so configure glfw-build with CMAKE_POSITION_INDEPENDENT_CODE=ON
+    LIBS += -L$$_PRO_FILE_PWD_/glfw-build/src -lglfw3
+    LIBS += -lX11 -lXrandr -lXi -lXxf86vm -lrt -ldl -lpthread -lm
+    QMAKE_CXXFLAGS += -fvisibility=hidden
+
+    # Offscreen canvases use EGL, so they work without a display server
+    DEFINES += NEXPO_EGL
+    LIBS += -lEGL -lGL
+
+    SOURCES +=  gl_2_1.c
+}
+
 
 SOURCES += shader.cpp \
     canvas.cpp \
     path.cpp \
-    font.cpp
+    font.cpp \
+    tessellator.cpp \
+    jobs.cpp \
+    stroke.cpp \
+    delaunay.cpp \
+    hittest.cpp \
+    bundle.cpp \
+    bufferpool.cpp \
+    scene.cpp \
+    frametiming.cpp \
+    offscreen.cpp \
+    capture.cpp \
+    sequence.cpp \
+    inputevents.cpp \
+    controlchannel.cpp \
+    controlsampler.cpp \
+    consoleoutput.cpp \
+    poly2tri/poly2tri/common/shapes.cc \
+    poly2tri/poly2tri/sweep/advancing_front.cc \
+    poly2tri/poly2tri/sweep/cdt.cc \
+    poly2tri/poly2tri/sweep/sweep.cc \
+    poly2tri/poly2tri/sweep/sweep_context.cc
 
 HEADERS += \
     shader.h \
     common.h \
     canvas.h \
     path.h \
-    font.h
+    font.h \
+    tessellator.h \
+    jobs.h \
+    stroke.h \
+    hittest.h \
+    bundle.h \
+    bufferpool.h \
+    scene.h \
+    frametiming.h \
+    offscreen.h \
+    capture.h \
+    sequence.h \
+    inputevents.h \
+    controlchannel.h \
+    controlsampler.h \
+    consoleoutput.h \
+    controlprotocol.h
@@ -0,0 +1,222 @@
+#include "hittest.h"
+#include "path.h"
+#include "tessellator.h"
+#include <algorithm>
+
+// MSVC doesn't define M_PI unless you do this
+#ifdef _MSC_VER
+#define _USE_MATH_DEFINES
+#endif
+#include <math.h>
+
+// Triangles per leaf. Testing a few triangles is cheaper than another level of boxes.
+static const int kLeafTriangles = 4;
+
+MeshIndex::MeshIndex()
+    : m_valid(false)
+{
+}
+
+void MeshIndex::clear()
+{
+    m_nodes.clear();
+    m_triangles.clear();
+    m_valid = false;
+}
+
+void MeshIndex::build(const Mesh& mesh)
+{
+    clear();
+
+    size_t count = mesh.indices.size() / 3;
+    m_triangles.resize(count);
+    m_centroids.resize(count);
+    for (size_t t=0; t<count; t++) {
+        m_triangles[t] = (unsigned int)t;
+        const unsigned int* ind = &mesh.indices[t * 3];
+        m_centroids[t] = (mesh.vertices[ind[0]] + mesh.vertices[ind[1]] + mesh.vertices[ind[2]]) / 3.0f;
+    }
+
+    // A complete tree has fewer than 2n / kLeafTriangles nodes, reserve so building doesn't reallocate
+    m_nodes.reserve(2 * count / kLeafTriangles + 1);
+    if (count > 0) {
+        buildNode(mesh, 0, (int)count);
+    }
+    m_valid = true;
+}
+
+int MeshIndex::buildNode(const Mesh& mesh, int first, int count)
+{
+    int index = (int)m_nodes.size();
+    m_nodes.push_back(Node());
+
+    Node node;
+    node.lo = vec2(INFINITY, INFINITY);
+    node.hi = vec2(-INFINITY, -INFINITY);
+    node.extrusion = 0;
+    for (int i=first; i<first+count; i++) {
+        const unsigned int* ind = &mesh.indices[m_triangles[i] * 3];
+        for (int k=0; k<3; k++) {
+            node.lo = glm::min(node.lo, mesh.vertices[ind[k]]);
+            node.hi = glm::max(node.hi, mesh.vertices[ind[k]]);
+            if (!mesh.extrusions.empty()) {
+                node.extrusion = glm::max(node.extrusion, glm::length(mesh.extrusions[ind[k]]));
+            }
+        }
+    }
+
+    if (count <= kLeafTriangles) {
+        node.first = first;
+        node.count = count;
+        m_nodes[index] = node;
+        return index;
+    }
+
+    // Split at the median centroid along the longer side
+    int axis = node.hi.x - node.lo.x > node.hi.y - node.lo.y ? 0 : 1;
+    int half = count / 2;
+    const std::vector<vec2>& centroids = m_centroids;
+    std::nth_element(m_triangles.begin() + first, m_triangles.begin() + first + half, m_triangles.begin() + first + count,
+                     [&centroids, axis](unsigned int a, unsigned int b) {
+        return centroids[a][axis] < centroids[b][axis];
+    });
+
+    // Children are stored next to each other, the left one straight after its parent
+    buildNode(mesh, first, half);
+    node.first = buildNode(mesh, first + half, count - half);
+    node.count = 0;
+    m_nodes[index] = node;
+    return index;
+}
+
+static inline float cross(const vec2& o, const vec2& a, const vec2& b)
+{
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+// Inclusive of the edges, and of either winding
+static bool triangleContains(const vec2& a, const vec2& b, const vec2& c, const vec2& p)
+{
+    float d1 = cross(a, b, p);
+    float d2 = cross(b, c, p);
+    float d3 = cross(c, a, p);
+    bool negative = d1 < 0 || d2 < 0 || d3 < 0;
+    bool positive = d1 > 0 || d2 > 0 || d3 > 0;
+    return !(negative && positive);
+}
+
+bool MeshIndex::contains(const Mesh& mesh, const vec2& p, float strokeWidth) const
+{
+    if (m_nodes.empty()) return false;
+
+    bool extruded = !mesh.extrusions.empty();
+    int stack[64];
+    int depth = 0;
+    stack[depth++] = 0;
+
+    while (depth > 0) {
+        const Node& node = m_nodes[stack[--depth]];
+        float grow = node.extrusion * strokeWidth;
+        if (p.x < node.lo.x - grow || p.y < node.lo.y - grow || p.x > node.hi.x + grow || p.y > node.hi.y + grow) {
+            continue;
+        }
+
+        if (node.count == 0) {
+            // The left child follows its parent. A median split keeps the tree
+            // balanced, so its depth can't come near the stack size.
+            int self = (int)(&node - &m_nodes[0]);
+            stack[depth++] = node.first;
+            stack[depth++] = self + 1;
+            continue;
+        }
+
+        for (int i=node.first; i<node.first+node.count; i++) {
+            const unsigned int* ind = &mesh.indices[m_triangles[i] * 3];
+            vec2 a = mesh.vertices[ind[0]];
+            vec2 b = mesh.vertices[ind[1]];
+            vec2 c = mesh.vertices[ind[2]];
+            if (extruded) {
+                a += mesh.extrusions[ind[0]] * strokeWidth;
+                b += mesh.extrusions[ind[1]] * strokeWidth;
+                c += mesh.extrusions[ind[2]] * strokeWidth;
+            }
+            if (triangleContains(a, b, c, p)) return true;
+        }
+    }
+
+    return false;
+}
+
+bool contoursContain(const Contours& contours, const vec2& p, bool nonzero)
+{
+    // Winding number, counting the edges that cross the horizontal line through p to its right
+    int winding = 0;
+    for (size_t c=0; c<contours.count(); c++) {
+        const vec2* pts = contours.contour(c);
+        size_t n = contours.contourSize(c);
+        for (size_t i=0, j=n-1; i<n; j=i++) {
+            const vec2& a = pts[j];
+            const vec2& b = pts[i];
+            if (a.y <= p.y) {
+                if (b.y > p.y && cross(a, b, p) > 0) winding++;
+            } else {
+                if (b.y <= p.y && cross(a, b, p) < 0) winding--;
+            }
+        }
+    }
+    return nonzero ? winding != 0 : (winding & 1) != 0;
+}
+
+// Shapes for pickShape()
+enum PickShape {
+    PICK_PATH,
+    PICK_RECT,          // unit square centred on the origin
+    PICK_CIRCLE,        // unit diameter circle centred on the origin
+};
+
+// Finds the topmost of a list of drawn shapes under the point (x, y), in the same
+// units as object positions. Shapes are given in drawing order, so the last one
+// that contains the point wins. Returns its index, or -1 if there's none.
+//
+// Each shape i has shapes[i] (a PickShape), paths[i] for paths, the object transform
+// in transforms[i*5] as xscale, yscale, rotation in degrees, x and y, a stroke width
+// (0 for fills) and the pixelsPerUnit it's drawn at, which decides the mesh used.
+LUAEXPORT(int pickShape(float x, float y, int count, const int* shapes, Path** paths,
+                        const float* transforms, const float* strokeWidths, const float* pixelsPerUnit))
+{
+    for (int i=count-1; i>=0; i--) {
+        // Undo the object transform (see setTransform() in Nexpo.lua), which scales
+        // after rotating: [xs*cos  xs*sin; -ys*sin  ys*cos]
+        const float* t = &transforms[i * 5];
+        if (t[0] == 0 || t[1] == 0) continue;
+        float dx = x - t[3];
+        float dy = y - t[4];
+        vec2 p;
+        if (t[2] == 0) {
+            p = vec2(dx / t[0], dy / t[1]);
+        } else {
+            float rad = t[2] * (float)(M_PI / 180);
+            float a = t[0] * cosf(rad), b = t[0] * sinf(rad);
+            float c = -t[1] * sinf(rad), d = t[1] * cosf(rad);
+            float det = a * d - b * c;
+            p = vec2((d * dx - b * dy) / det, (a * dy - c * dx) / det);
+        }
+
+        bool hit = false;
+        switch (shapes[i]) {
+        case PICK_RECT:
+            hit = fabsf(p.x) <= 0.5f && fabsf(p.y) <= 0.5f;
+            break;
+        case PICK_CIRCLE:
+            hit = p.x * p.x + p.y * p.y <= 0.25f;
+            break;
+        case PICK_PATH:
+            hit = paths[i] && pathContains(paths[i], p, strokeWidths[i], pixelsPerUnit[i]);
+            break;
+        }
+
+        if (hit) return i;
+    }
+
+    return -1;
+}
@@ -0,0 +1,43 @@
+#ifndef HITTEST_H
+#define HITTEST_H
+#include <vector>
+#include "common.h"
+
+struct Mesh;
+struct Contours;
+
+// Bounding volume hierarchy over the triangles of a mesh, for finding whether
+// a point is inside it without testing every triangle.
+class MeshIndex
+{
+public:
+    MeshIndex();
+
+    void build(const Mesh& mesh);
+    void clear();
+    bool valid() const { return m_valid; }
+
+    // Whether p is inside one of the mesh's triangles. Extrusions are scaled by
+    // strokeWidth, as the vertex shader does when drawing.
+    bool contains(const Mesh& mesh, const vec2& p, float strokeWidth) const;
+
+private:
+    struct Node {
+        vec2 lo, hi;            // bounds of the triangles' unextruded points
+        float extrusion;        // longest extrusion, the bounds grow by this times the stroke width
+        int first;              // leaves: first entry in m_triangles, otherwise the first child
+        int count;              // triangles in a leaf, 0 for inner nodes
+    };
+
+    int buildNode(const Mesh& mesh, int first, int count);
+
+    std::vector<Node> m_nodes;
+    std::vector<unsigned int> m_triangles;      // triangle numbers in leaf order
+    std::vector<vec2> m_centroids;              // scratch for building
+    bool m_valid;
+};
+
+// Whether p is inside the contours under the even-odd or nonzero rule
+bool contoursContain(const Contours& contours, const vec2& p, bool nonzero);
+
+#endif // HITTEST_H
@@ -0,0 +1,45 @@
+#include "inputevents.h"
+#include <atomic>
+#include <algorithm>
+
+// A power of two, so indices can wrap around with the counters
+static const unsigned int kInputQueueSize = 4096;
+
+static InputEvent gEvents[kInputQueueSize];
+
+// Free running counts of events pushed and taken. Only the pushing thread writes
+// gPushed and only the taking thread writes gTaken.
+static std::atomic<unsigned int> gPushed(0);
+static std::atomic<unsigned int> gTaken(0);
+static std::atomic<unsigned int> gDropped(0);
+
+
+void pushInputEvent(const InputEvent& event)
+{
+    unsigned int pushed = gPushed.load(std::memory_order_relaxed);
+    if (pushed - gTaken.load(std::memory_order_acquire) == kInputQueueSize) {
+        gDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    gEvents[pushed % kInputQueueSize] = event;
+    gPushed.store(pushed + 1, std::memory_order_release);
+}
+
+// Copies up to max of the oldest events into dest, returning how many. Call again
+// while it fills dest to take every event.
+LUAEXPORT(unsigned int takeInputEvents(InputEvent* dest, unsigned int max))
+{
+    unsigned int taken = gTaken.load(std::memory_order_relaxed);
+    unsigned int n = std::min(gPushed.load(std::memory_order_acquire) - taken, max);
+    for (unsigned int i=0; i<n; i++) {
+        dest[i] = gEvents[(taken + i) % kInputQueueSize];
+    }
+    gTaken.store(taken + n, std::memory_order_release);
+    return n;
+}
+
+// Events dropped since the program started because the queue was full
+LUAEXPORT(unsigned int droppedInputEvents())
+{
+    return gDropped.load(std::memory_order_relaxed);
+}
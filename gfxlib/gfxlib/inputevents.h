@@ -0,0 +1,43 @@
+#ifndef INPUTEVENTS_H
+#define INPUTEVENTS_H
+#include "common.h"
+
+// Keyboard and mouse events, queued with the time they were polled instead of
+// being passed to Lua through callbacks. GLFW's callbacks push events into a ring buffer
+// allocated up front, and Lua takes them all out once a frame. The ring is lock
+// free for one thread pushing and another taking, so events could come from a
+// thread other than the one drawing. If Lua falls too far behind, new events are
+// dropped and counted.
+//
+// InputEvent is also declared in Nexpo.lua's ffi.cdef, so keep the two in sync.
+
+enum InputEventType {
+    INPUT_KEY,
+    INPUT_CHAR,
+    INPUT_MOUSE_BUTTON,
+    INPUT_SCROLL,
+    INPUT_CURSOR
+};
+
+struct InputEvent
+{
+    double time;        // canvasTime() when GLFW reported the event. GLFW only reports
+                        // them from glfwPollEvents, which is called every millisecond
+                        // while waiting for a frame to start or finish, so this is to
+                        // within the frame start margin.
+    double x;           // cursor position from the center of the window, increasing
+                        // up and right as from cursorPos(), or the scroll offsets
+    double y;
+    int type;           // InputEventType
+    int code;           // GLFW key, mouse button (from 0), or the unicode codepoint of a char
+    int scancode;
+    int action;         // GLFW_RELEASE, GLFW_PRESS or GLFW_REPEAT
+    int mods;           // GLFW modifier bits
+};
+
+void pushInputEvent(const InputEvent& event);
+
+DLLEXPORT unsigned int takeInputEvents(InputEvent* dest, unsigned int max);
+DLLEXPORT unsigned int droppedInputEvents();
+
+#endif // INPUTEVENTS_H
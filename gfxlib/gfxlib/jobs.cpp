@@ -0,0 +1,205 @@
+#include "jobs.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Work-stealing job pool. Each thread has its own queue: it takes work from the
+// back of its own queue and, when that runs dry, steals from the front of the
+// others. Batches are split into a few ranges per thread so that uneven jobs
+// (a handful of huge paths among many small ones) still balance out.
+
+struct Batch
+{
+    void (*fn)(void*, size_t);
+    void* data;
+    std::atomic<size_t> remaining;
+};
+
+struct Job
+{
+    Batch* batch;
+    size_t begin;
+    size_t end;
+};
+
+struct JobQueue
+{
+    std::mutex mutex;
+    std::deque<Job> jobs;
+};
+
+class JobSystem
+{
+public:
+    JobSystem();
+    ~JobSystem();
+
+    void run(Batch& batch, size_t count);
+
+    size_t m_numQueues;
+
+private:
+    void workerRoutine(size_t index);
+    bool popJob(size_t index, Job& job);
+    void execute(const Job& job);
+
+    // One queue per worker, plus a last one for the thread that submits batches
+    std::vector<std::unique_ptr<JobQueue>> m_queues;
+    std::vector<std::thread> m_threads;
+
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    std::atomic<size_t> m_pendingJobs;
+    bool m_quit;
+};
+
+JobSystem::JobSystem()
+    : m_pendingJobs(0)
+    , m_quit(false)
+{
+    unsigned int hw = std::thread::hardware_concurrency();
+    size_t numWorkers = hw > 1 ? hw - 1 : 0;
+    m_numQueues = numWorkers + 1;
+
+    for (size_t i=0; i<m_numQueues; i++) {
+        m_queues.push_back(std::unique_ptr<JobQueue>(new JobQueue));
+    }
+
+    for (size_t i=0; i<numWorkers; i++) {
+        m_threads.push_back(std::thread(&JobSystem::workerRoutine, this, i));
+    }
+}
+
+JobSystem::~JobSystem()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+
+    for (size_t i=0; i<m_threads.size(); i++) {
+        m_threads[i].join();
+    }
+}
+
+bool JobSystem::popJob(size_t index, Job& job)
+{
+    // Own queue first, newest job
+    {
+        JobQueue& q = *m_queues[index];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.jobs.empty()) {
+            job = q.jobs.back();
+            q.jobs.pop_back();
+            m_pendingJobs--;
+            return true;
+        }
+    }
+
+    // Steal the oldest job from another queue
+    for (size_t i=1; i<m_numQueues; i++) {
+        JobQueue& q = *m_queues[(index + i) % m_numQueues];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.jobs.empty()) {
+            job = q.jobs.front();
+            q.jobs.pop_front();
+            m_pendingJobs--;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void JobSystem::execute(const Job& job)
+{
+    Batch* batch = job.batch;
+    for (size_t i=job.begin; i<job.end; i++) {
+        batch->fn(batch->data, i);
+    }
+    batch->remaining -= job.end - job.begin;
+}
+
+void JobSystem::workerRoutine(size_t index)
+{
+    Job job;
+    while (true) {
+        if (popJob(index, job)) {
+            execute(job);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_wakeMutex);
+        m_wake.wait(lock, [this] { return m_quit || m_pendingJobs > 0; });
+        if (m_quit) return;
+    }
+}
+
+void JobSystem::run(Batch& batch, size_t count)
+{
+    size_t submitter = m_numQueues - 1;
+
+    // Aim for about four ranges per thread
+    size_t chunk = (count + m_numQueues * 4 - 1) / (m_numQueues * 4);
+    if (chunk < 1) chunk = 1;
+
+    size_t numJobs = (count + chunk - 1) / chunk;
+    batch.remaining = count;
+
+    for (size_t j=0; j<numJobs; j++) {
+        Job job;
+        job.batch = &batch;
+        job.begin = j * chunk;
+        job.end = job.begin + chunk < count ? job.begin + chunk : count;
+
+        JobQueue& q = *m_queues[j % m_numQueues];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        q.jobs.push_back(job);
+        m_pendingJobs++;
+    }
+
+    {
+        // Lock so a worker can't miss the wakeup between checking and waiting
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+    }
+    m_wake.notify_all();
+
+    // Help out until the whole batch is done. Jobs from this batch may still be
+    // running on workers after the queues are empty, so wait on the count.
+    Job job;
+    while (batch.remaining > 0) {
+        if (popJob(submitter, job)) {
+            execute(job);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// Never destroyed, since joining the workers from a static destructor can hang
+// if they were already killed at exit, or deadlock on the Windows loader lock
+static JobSystem& jobSystem()
+{
+    static JobSystem& system = *new JobSystem;
+    return system;
+}
+
+void parallelFor(size_t count, void (*fn)(void* data, size_t i), void* data)
+{
+    if (count == 0) return;
+
+    if (count == 1) {
+        fn(data, 0);
+        return;
+    }
+
+    Batch batch;
+    batch.fn = fn;
+    batch.data = data;
+    jobSystem().run(batch, count);
+}
@@ -0,0 +1,11 @@
+#ifndef JOBS_H
+#define JOBS_H
+#include <stddef.h>
+
+// Runs fn(data, i) for every i in [0, count) on the worker pool and returns
+// once all of them have finished. The calling thread works on the batch too.
+// fn must be safe to run concurrently with itself for different indices.
+// Must not be called from inside a job.
+void parallelFor(size_t count, void (*fn)(void* data, size_t i), void* data);
+
+#endif // JOBS_H
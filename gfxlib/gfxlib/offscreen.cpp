@@ -0,0 +1,326 @@
+#include "offscreen.h"
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef NEXPO_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+
+// Framebuffer object constants, the same in GL 3.0, ARB_framebuffer_object and the EXT extensions
+#define FBO_FRAMEBUFFER                 0x8D40
+#define FBO_READ_FRAMEBUFFER            0x8CA8
+#define FBO_DRAW_FRAMEBUFFER            0x8CA9
+#define FBO_RENDERBUFFER                0x8D41
+#define FBO_COLOR_ATTACHMENT0           0x8CE0
+#define FBO_DEPTH_ATTACHMENT            0x8D00
+#define FBO_STENCIL_ATTACHMENT          0x8D20
+#define FBO_FRAMEBUFFER_COMPLETE        0x8CD5
+#define FBO_MAX_SAMPLES                 0x8D57
+#define FBO_DEPTH24_STENCIL8            0x88F0
+#define FBO_RGBA8                       0x8058
+
+// Framebuffer object entry points, loaded at run time since they're extensions to GL 2.1
+typedef void (APIENTRY* GenFunc)(GLsizei n, GLuint* ids);
+typedef void (APIENTRY* DeleteFunc)(GLsizei n, const GLuint* ids);
+typedef void (APIENTRY* BindFunc)(GLenum target, GLuint id);
+typedef void (APIENTRY* FramebufferRenderbufferFunc)(GLenum target, GLenum attachment, GLenum renderbufferTarget, GLuint renderbuffer);
+typedef GLenum (APIENTRY* CheckFramebufferStatusFunc)(GLenum target);
+typedef void (APIENTRY* RenderbufferStorageFunc)(GLenum target, GLenum format, GLsizei width, GLsizei height);
+typedef void (APIENTRY* RenderbufferStorageMultisampleFunc)(GLenum target, GLsizei samples, GLenum format, GLsizei width, GLsizei height);
+typedef void (APIENTRY* BlitFramebufferFunc)(GLint srcX0, GLint srcY0, GLint srcX1, GLint srcY1, GLint dstX0, GLint dstY0,
+                                             GLint dstX1, GLint dstY1, GLbitfield mask, GLenum filter);
+
+static GenFunc gGenFramebuffers;
+static DeleteFunc gDeleteFramebuffers;
+static BindFunc gBindFramebuffer;
+static FramebufferRenderbufferFunc gFramebufferRenderbuffer;
+static CheckFramebufferStatusFunc gCheckFramebufferStatus;
+static GenFunc gGenRenderbuffers;
+static DeleteFunc gDeleteRenderbuffers;
+static BindFunc gBindRenderbuffer;
+static RenderbufferStorageFunc gRenderbufferStorage;
+static RenderbufferStorageMultisampleFunc gRenderbufferStorageMultisample;
+static BlitFramebufferFunc gBlitFramebuffer;
+
+bool OffscreenTarget::extensionSupported(const char* name)
+{
+    const char* extensions = (const char*)glGetString(GL_EXTENSIONS);
+    if (!extensions) return false;
+
+    size_t length = strlen(name);
+    for (const char* p = strstr(extensions, name); p; p = strstr(p + length, name)) {
+        if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Core (or ARB) name, falling back to the EXT one
+template <typename Func>
+static bool loadFunc(Func& func, const char* name)
+{
+    func = (Func)OffscreenTarget::procAddress(name);
+    if (!func) {
+        std::string extName = std::string(name) + "EXT";
+        func = (Func)OffscreenTarget::procAddress(extName.c_str());
+    }
+    return func != 0;
+}
+
+// Returns whether framebuffer objects are supported, and sets multisample if
+// multisampled ones are too
+static bool loadFramebufferFuncs(bool& multisample)
+{
+    const char* version = (const char*)glGetString(GL_VERSION);
+    bool core = version && atoi(version) >= 3;
+    bool arb = OffscreenTarget::extensionSupported("GL_ARB_framebuffer_object");
+    if (!core && !arb && !OffscreenTarget::extensionSupported("GL_EXT_framebuffer_object")) {
+        return false;
+    }
+
+    bool ok = loadFunc(gGenFramebuffers, "glGenFramebuffers")
+            && loadFunc(gDeleteFramebuffers, "glDeleteFramebuffers")
+            && loadFunc(gBindFramebuffer, "glBindFramebuffer")
+            && loadFunc(gFramebufferRenderbuffer, "glFramebufferRenderbuffer")
+            && loadFunc(gCheckFramebufferStatus, "glCheckFramebufferStatus")
+            && loadFunc(gGenRenderbuffers, "glGenRenderbuffers")
+            && loadFunc(gDeleteRenderbuffers, "glDeleteRenderbuffers")
+            && loadFunc(gBindRenderbuffer, "glBindRenderbuffer")
+            && loadFunc(gRenderbufferStorage, "glRenderbufferStorage");
+    if (!ok) return false;
+
+    multisample = (core || arb
+                   || (OffscreenTarget::extensionSupported("GL_EXT_framebuffer_multisample")
+                       && OffscreenTarget::extensionSupported("GL_EXT_framebuffer_blit")))
+            && loadFunc(gRenderbufferStorageMultisample, "glRenderbufferStorageMultisample")
+            && loadFunc(gBlitFramebuffer, "glBlitFramebuffer");
+    return true;
+}
+
+
+OffscreenTarget::OffscreenTarget(int width, int height)
+    : m_width(width)
+    , m_height(height)
+    , m_display(0)
+    , m_context(0)
+    , m_framebuffer(0)
+    , m_colorBuffer(0)
+    , m_stencilBuffer(0)
+    , m_resolveFramebuffer(0)
+    , m_resolveColorBuffer(0)
+{
+}
+
+OffscreenTarget* OffscreenTarget::create(int width, int height, int samples, bool stencil)
+{
+    if (width < 1 || height < 1) {
+        std::cerr << "Error: offscreen canvas size must be at least 1x1" << std::endl;
+        return 0;
+    }
+
+    OffscreenTarget* target = new OffscreenTarget(width, height);
+    if (!target->createContext() || !target->createFramebuffers(samples, stencil)) {
+        delete target;
+        return 0;
+    }
+    target->bind();
+    return target;
+}
+
+#ifdef NEXPO_EGL
+
+bool OffscreenTarget::createContext()
+{
+    // Mesa's surfaceless platform needs no display server or GPU device, otherwise
+    // take the default display
+    EGLDisplay display = EGL_NO_DISPLAY;
+    const char* clientExtensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    if (clientExtensions && strstr(clientExtensions, "EGL_MESA_platform_surfaceless")) {
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+                (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay) {
+            display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        }
+    }
+    if (display == EGL_NO_DISPLAY) {
+        display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    }
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+        std::cerr << "Error: failed to initialise EGL" << std::endl;
+        return false;
+    }
+    m_display = display;
+
+    // Drawing only goes to the framebuffer object, so any config will do
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint nconfigs = 0;
+    if (!eglBindAPI(EGL_OPENGL_API) || !eglChooseConfig(display, configAttribs, &config, 1, &nconfigs) || nconfigs < 1) {
+        std::cerr << "Error: EGL has no desktop OpenGL configs" << std::endl;
+        return false;
+    }
+
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    if (context == EGL_NO_CONTEXT) {
+        std::cerr << "Error: failed to create EGL context (" << std::hex << eglGetError() << std::dec << ")" << std::endl;
+        return false;
+    }
+    m_context = context;
+
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+        std::cerr << "Error: EGL can't make a context current without a surface" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+OffscreenTarget::~OffscreenTarget()
+{
+    if (m_context) {
+        if (gDeleteFramebuffers) {
+            GLuint framebuffers[] = { m_framebuffer, m_resolveFramebuffer };
+            GLuint renderbuffers[] = { m_colorBuffer, m_stencilBuffer, m_resolveColorBuffer };
+            gDeleteFramebuffers(2, framebuffers);
+            gDeleteRenderbuffers(3, renderbuffers);
+        }
+        eglMakeCurrent(m_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        eglDestroyContext(m_display, m_context);
+    }
+    if (m_display) {
+        eglTerminate(m_display);
+    }
+}
+
+void* OffscreenTarget::procAddress(const char* name)
+{
+    return (void*)eglGetProcAddress(name);
+}
+
+#else
+
+bool OffscreenTarget::createContext()
+{
+    glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+    GLFWwindow* window = glfwCreateWindow(1, 1, "", NULL, NULL);
+    glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+    if (!window) {
+        std::cerr << "Error: failed to create hidden window for offscreen canvas" << std::endl;
+        return false;
+    }
+    m_display = window;
+    glfwMakeContextCurrent(window);
+    return true;
+}
+
+OffscreenTarget::~OffscreenTarget()
+{
+    if (m_display) {
+        if (gDeleteFramebuffers) {
+            GLuint framebuffers[] = { m_framebuffer, m_resolveFramebuffer };
+            GLuint renderbuffers[] = { m_colorBuffer, m_stencilBuffer, m_resolveColorBuffer };
+            gDeleteFramebuffers(2, framebuffers);
+            gDeleteRenderbuffers(3, renderbuffers);
+        }
+        glfwDestroyWindow((GLFWwindow*)m_display);
+    }
+}
+
+void* OffscreenTarget::procAddress(const char* name)
+{
+    return (void*)glfwGetProcAddress(name);
+}
+
+#endif
+
+bool OffscreenTarget::createFramebuffers(int samples, bool stencil)
+{
+    bool multisample = false;
+    if (!loadFramebufferFuncs(multisample)) {
+        std::cerr << "Error: offscreen canvas needs framebuffer objects, which this driver doesn't support" << std::endl;
+        return false;
+    }
+
+    GLint maxSamples = 0;
+    if (multisample) {
+        glGetIntegerv(FBO_MAX_SAMPLES, &maxSamples);
+    }
+    samples = std::max(0, std::min(samples, (int)maxSamples));
+
+    gGenFramebuffers(1, &m_framebuffer);
+    gBindFramebuffer(FBO_FRAMEBUFFER, m_framebuffer);
+
+    gGenRenderbuffers(1, &m_colorBuffer);
+    gBindRenderbuffer(FBO_RENDERBUFFER, m_colorBuffer);
+    if (samples > 0) {
+        gRenderbufferStorageMultisample(FBO_RENDERBUFFER, samples, FBO_RGBA8, m_width, m_height);
+    } else {
+        gRenderbufferStorage(FBO_RENDERBUFFER, FBO_RGBA8, m_width, m_height);
+    }
+    gFramebufferRenderbuffer(FBO_FRAMEBUFFER, FBO_COLOR_ATTACHMENT0, FBO_RENDERBUFFER, m_colorBuffer);
+
+    // Stencil-only buffers are poorly supported, so take a packed depth and stencil one
+    if (stencil) {
+        gGenRenderbuffers(1, &m_stencilBuffer);
+        gBindRenderbuffer(FBO_RENDERBUFFER, m_stencilBuffer);
+        if (samples > 0) {
+            gRenderbufferStorageMultisample(FBO_RENDERBUFFER, samples, FBO_DEPTH24_STENCIL8, m_width, m_height);
+        } else {
+            gRenderbufferStorage(FBO_RENDERBUFFER, FBO_DEPTH24_STENCIL8, m_width, m_height);
+        }
+        gFramebufferRenderbuffer(FBO_FRAMEBUFFER, FBO_DEPTH_ATTACHMENT, FBO_RENDERBUFFER, m_stencilBuffer);
+        gFramebufferRenderbuffer(FBO_FRAMEBUFFER, FBO_STENCIL_ATTACHMENT, FBO_RENDERBUFFER, m_stencilBuffer);
+    }
+
+    if (gCheckFramebufferStatus(FBO_FRAMEBUFFER) != FBO_FRAMEBUFFER_COMPLETE) {
+        std::cerr << "Error: offscreen framebuffer is incomplete" << std::endl;
+        return false;
+    }
+
+    if (samples > 0) {
+        gGenFramebuffers(1, &m_resolveFramebuffer);
+        gBindFramebuffer(FBO_FRAMEBUFFER, m_resolveFramebuffer);
+        gGenRenderbuffers(1, &m_resolveColorBuffer);
+        gBindRenderbuffer(FBO_RENDERBUFFER, m_resolveColorBuffer);
+        gRenderbufferStorage(FBO_RENDERBUFFER, FBO_RGBA8, m_width, m_height);
+        gFramebufferRenderbuffer(FBO_FRAMEBUFFER, FBO_COLOR_ATTACHMENT0, FBO_RENDERBUFFER, m_resolveColorBuffer);
+        if (gCheckFramebufferStatus(FBO_FRAMEBUFFER) != FBO_FRAMEBUFFER_COMPLETE) {
+            std::cerr << "Error: offscreen resolve framebuffer is incomplete" << std::endl;
+            return false;
+        }
+    }
+
+    gBindRenderbuffer(FBO_RENDERBUFFER, 0);
+    return true;
+}
+
+void OffscreenTarget::bind()
+{
+    gBindFramebuffer(FBO_FRAMEBUFFER, m_framebuffer);
+    glViewport(0, 0, m_width, m_height);
+}
+
+void OffscreenTarget::bindForReading()
+{
+    if (m_resolveFramebuffer) {
+        gBindFramebuffer(FBO_READ_FRAMEBUFFER, m_framebuffer);
+        gBindFramebuffer(FBO_DRAW_FRAMEBUFFER, m_resolveFramebuffer);
+        gBlitFramebuffer(0, 0, m_width, m_height, 0, 0, m_width, m_height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        gBindFramebuffer(FBO_FRAMEBUFFER, m_resolveFramebuffer);
+    } else {
+        gBindFramebuffer(FBO_FRAMEBUFFER, m_framebuffer);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef OFFSCREEN_H
+#define OFFSCREEN_H
+#include "common.h"
+
+// Rendering without a window, for running scripts on machines without a display
+// such as build servers. Draws into a framebuffer object of a fixed size, with a
+// GL context made through EGL with no surface when NEXPO_EGL is defined (which
+// works with Mesa's software renderer and no display server), otherwise through
+// a hidden GLFW window.
+class OffscreenTarget
+{
+public:
+    // Returns null if there's no usable context or framebuffer. samples is clamped
+    // to what the driver supports.
+    static OffscreenTarget* create(int width, int height, int samples, bool stencil);
+    ~OffscreenTarget();
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    bool hasStencil() const { return m_stencilBuffer != 0; }
+
+    // Bind the framebuffer for drawing
+    void bind();
+
+    // Bind a single-sampled copy of what's been drawn for reading, resolving
+    // multisampling first if there is any. Rebind for drawing with bind().
+    void bindForReading();
+
+    // Entry points and extensions of the offscreen context, which GLFW doesn't know about
+    static void* procAddress(const char* name);
+    static bool extensionSupported(const char* name);
+
+private:
+    OffscreenTarget(int width, int height);
+
+    bool createContext();
+    bool createFramebuffers(int samples, bool stencil);
+
+    int m_width;
+    int m_height;
+    void* m_display;            // EGLDisplay, or the hidden GLFWwindow
+    void* m_context;            // EGLContext
+    GLuint m_framebuffer;
+    GLuint m_colorBuffer;
+    GLuint m_stencilBuffer;
+    GLuint m_resolveFramebuffer;    // single-sampled, only when m_framebuffer is multisampled
+    GLuint m_resolveColorBuffer;
+};
+
+#endif // OFFSCREEN_H
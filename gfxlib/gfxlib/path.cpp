@@ -1,28 +1,32 @@
 #include "path.h"
 #include <iostream>
-#include <sstream>
-#include "tesselator.h"
-
-TESSalloc talloc;
-
-static void appendQuadraticCurveTo(std::vector<vec2>& contour, const vec2& p0, const vec2& p1, const vec2& p2, int level);
-static void appendCubicCurveTo(std::vector<vec2>& contour, const vec2& p1, const vec2& c1, const vec2& c2, const vec2& p2, int segments);
-
-
-static void* stdAlloc(void*, unsigned int size)
-{
-    return malloc(size);
-}
-
-static void stdFree(void*, void* ptr)
-{
-    free(ptr);
-}
-
-static void* stdRealloc(void*, void* ptr, unsigned int size)
-{
-    return realloc(ptr, size);
-}
+#include <string.h>
+
+// MSVC doesn't define M_PI unless you do this
+#ifdef _MSC_VER
+#define _USE_MATH_DEFINES
+#endif
+#include <math.h>
+#include "tessellator.h"
+#include "stroke.h"
+#include "hittest.h"
+#include "bundle.h"
+#include "bufferpool.h"
+#include "jobs.h"
+#include <algorithm>
+
+static void appendQuadraticCurveTo(Contours& contours, const vec2& p1, const vec2& c, const vec2& p2, float tolerance);
+static void appendCubicCurveTo(Contours& contours, const vec2& p1, const vec2& c1, const vec2& c2, const vec2& p2, float tolerance);
+
+// Maximum distance in screen pixels between a curve and its flattened line segments
+static float gFlattenTolerance = 0.25f;
+
+// Backend for paths that don't choose their own
+static TriangulatorType gTriangulator = TRIANGULATOR_LIBTESS2;
+
+// Scratch space reused by every fill. One per thread so meshes can be built in
+// parallel by prebuildPathMeshes().
+static thread_local TessContext gTessContext;
 
 enum PathCommand {
     MOVE_TO,
@@ -33,31 +37,100 @@ enum PathCommand {
     CLOSE_PATH,
 };
 
-typedef std::vector<vec2> Contour;
+// Points each command takes from m_points
+static int commandPointCount(PathCommand command)
+{
+    switch (command) {
+    case MOVE_TO:
+    case LINE_TO:
+        return 1;
+    case QUADRATIC_CURVE_TO:
+    case ARC_TO:
+        return 2;
+    case CUBIC_CURVE_TO:
+        return 3;
+    default:
+        return 0;
+    }
+}
 
 class Path {
 public:
     Path();
     ~Path();
 
-    void invalidateMeshes();
-    std::vector<Contour> contoursFromPath();
+    const Contours& flatten(int toleranceBucket);
+    void updateBounds();
+    const BundleLevel* bundledLevel(int toleranceBucket) const;
 
     Mesh* m_strokedMesh;
     Mesh* m_filledMesh;
-    float m_cachedStrokeWidth;
+    MeshIndex m_strokedIndex;       // built on demand for hit-testing
+    MeshIndex m_filledIndex;
+    Stroker m_stroker;
+    StrokeStyle m_strokeStyle;
+    FillMode m_fillMode;
+    int m_triangulator;                         // a TriangulatorType, or -1 for gTriangulator
+    TriangulatorType m_filledTriangulator;      // backend the filled mesh was made with
+    int m_strokedGeneration;        // m_contoursGeneration the stroke was built from
+    unsigned int m_filledVersion;   // m_contoursVersion the fill was built from
 
     std::vector<vec2> m_points;
     std::vector<PathCommand> m_commands;
+
+    // Bounds of m_points, which contain the curves too. Extended as points are added.
+    vec2 m_boundsLo;
+    vec2 m_boundsHi;
+    size_t m_boundedPoints;
+
+    // Flattened outline, extended as commands are added. Rebuilt from scratch
+    // (starting a new generation) only when the tolerance changes.
+    Contours m_contours;
+    int m_contoursGeneration;
+    unsigned int m_contoursVersion; // changes whenever m_contours does, unlike the generation
+    int m_contoursToleranceBucket;
+    size_t m_flattenedCommands;     // commands and points already in m_contours
+    size_t m_flattenedPoints;
+    vec2 m_flattenedPos;            // current position after the flattened commands
+    bool m_contourOpen;             // whether the next segment extends the last contour
+
+    // Prebuilt geometry for paths loaded from a bundle, used while the path still
+    // has just the bundled commands
+    MeshBundle* m_bundle;
+    size_t m_bundled;               // index of the path's entry, which can move if the bundle is unmapped
+    bool m_strokedFromBundle;       // the stroke mesh was loaded, so m_stroker hasn't seen it
 };
 
 
 
 
+Mesh::~Mesh()
+{
+    if (buffers) buffers->release(buffers);
+}
+
+
 Path::Path()
     : m_strokedMesh(0)
     , m_filledMesh(0)
-    , m_cachedStrokeWidth(0)
+    , m_fillMode(FILL_TESSELLATE)
+    , m_triangulator(-1)
+    , m_filledTriangulator(TRIANGULATOR_LIBTESS2)
+    , m_strokedGeneration(-1)
+    , m_filledVersion(0)
+    , m_boundsLo(INFINITY, INFINITY)
+    , m_boundsHi(-INFINITY, -INFINITY)
+    , m_boundedPoints(0)
+    , m_contoursGeneration(-1)
+    , m_contoursVersion(0)
+    , m_contoursToleranceBucket(0)
+    , m_flattenedCommands(0)
+    , m_flattenedPoints(0)
+    , m_flattenedPos(0, 0)
+    , m_contourOpen(false)
+    , m_bundle(0)
+    , m_bundled(0)
+    , m_strokedFromBundle(false)
 {
 
 }
@@ -65,6 +138,7 @@ Path::Path()
 Path::~Path() {
     delete m_strokedMesh;
     delete m_filledMesh;
+    if (m_bundle) m_bundle->release();
 }
 
 LUAEXPORT(Path* newPath())
@@ -75,30 +149,25 @@ LUAEXPORT(Path* newPath())
 LUAEXPORT(void freePath(Path* path))
 {
     delete path;
-    std::cerr << "Deleted path" << std::endl;
 }
 
 LUAEXPORT(void moveTo(Path* path, float x, float y)) {
-    path->invalidateMeshes();
     path->m_commands.push_back(MOVE_TO);
     path->m_points.push_back(vec2(x, y));
 }
 
 LUAEXPORT(void lineTo(Path* path, float x, float y)) {
-    path->invalidateMeshes();
     path->m_commands.push_back(LINE_TO);
     path->m_points.push_back(vec2(x, y));
 }
 
 LUAEXPORT(void quadraticCurveTo(Path* path, float cx, float cy, float x, float y)) {
-    path->invalidateMeshes();
     path->m_commands.push_back(QUADRATIC_CURVE_TO);
     path->m_points.push_back(vec2(cx, cy));
     path->m_points.push_back(vec2(x, y));
 }
 
 LUAEXPORT(void cubicCurveTo(Path* path, float cx1, float cy1, float cx2, float cy2, float x, float y)) {
-    path->invalidateMeshes();
     path->m_commands.push_back(CUBIC_CURVE_TO);
     path->m_points.push_back(vec2(cx1, cy1));
     path->m_points.push_back(vec2(cx2, cy2));
@@ -107,147 +176,531 @@ LUAEXPORT(void cubicCurveTo(Path* path, float cx1, float cy1, float cx2, float c
 
 LUAEXPORT(void arcTo(Path* path, float x1, float y1, float x2, float y2, float radius))
 {
-    path->invalidateMeshes();
     path->m_commands.push_back(ARC_TO);
     path->m_points.push_back(vec2(x1, y1));
     path->m_points.push_back(vec2(x2, y2));
 }
 
-void Path::invalidateMeshes() {
-    delete m_strokedMesh;
-    delete m_filledMesh;
-    m_strokedMesh = m_filledMesh = 0;
+LUAEXPORT(void closePath(Path* path))
+{
+    path->m_commands.push_back(CLOSE_PATH);
+}
+
+
+// SVG path data parser (http://www.w3.org/TR/SVG/paths.html#PathDataBNF)
+//
+// Parses the string in a single pass, straight into the path's command and point
+// arrays. Relative commands are made absolute, H/V become lines, S/T control points
+// are reflected and arcs are converted to cubic curves, so the rest of gfxlib only
+// ever sees the basic commands.
+
+struct SvgParser
+{
+    const char* begin;
+    const char* p;
+    const char* error;      // position of the first error, or null
+    const char* errorMessage;
+};
+
+static inline bool isSvgSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+static inline bool isDigit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+static inline void skipSpace(SvgParser& ps)
+{
+    while (isSvgSpace(*ps.p)) ps.p++;
+}
+
+static inline void skipSeparator(SvgParser& ps)
+{
+    skipSpace(ps);
+    if (*ps.p == ',') {
+        ps.p++;
+        skipSpace(ps);
+    }
+}
+
+static bool svgFail(SvgParser& ps, const char* message)
+{
+    if (!ps.error) {
+        ps.error = ps.p;
+        ps.errorMessage = message;
+    }
+    return false;
+}
+
+// True if the next token can start a number, i.e. the previous command repeats
+static inline bool atNumber(SvgParser& ps)
+{
+    char c = *ps.p;
+    return isDigit(c) || c == '-' || c == '+' || c == '.';
+}
+
+static const double kPowersOf10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+    1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
 
+static double pow10i(int e)
+{
+    if (e >= 0 && e <= 22) return kPowersOf10[e];
+    if (e < 0 && e >= -22) return 1.0 / kPowersOf10[-e];
+    return pow(10.0, e);
 }
 
-static bool readFloatsFromStream(std::stringstream& ss, float* dst, int n)
+// Reads one number, followed by an optional comma and whitespace
+static bool readNumber(SvgParser& ps, float& out)
 {
-    for (int i=0; i<n; i++)
-    {
-        char peek = ss.peek();
-        while(peek == ',') {
-            char c;
-            ss >> c;
-            peek = ss.peek();
+    const char* p = ps.p;
+    bool negative = false;
+    if (*p == '+' || *p == '-') {
+        negative = *p == '-';
+        p++;
+    }
+
+    // Accumulate up to 19 significant digits in an integer, then scale once
+    unsigned long long mantissa = 0;
+    int digits = 0;
+    int exponent = 0;
+    bool any = false;
+
+    while (isDigit(*p)) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa) digits++;
+        } else {
+            exponent++;
+        }
+        p++;
+        any = true;
+    }
+
+    if (*p == '.') {
+        p++;
+        while (isDigit(*p)) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa) digits++;
+                exponent--;
+            }
+            p++;
+            any = true;
         }
+    }
 
-        ss >> dst[i];
+    if (!any) {
+        return svgFail(ps, "expected a number");
+    }
 
-        if (ss.fail()) {
-            std::cerr << "failed to read number from path string" << std::endl;
-            return false;
+    // Exponent, but not the start of a following command like 'e' in "1em"
+    if ((*p == 'e' || *p == 'E') && (isDigit(p[1]) || ((p[1] == '-' || p[1] == '+') && isDigit(p[2])))) {
+        p++;
+        bool negativeExponent = false;
+        if (*p == '+' || *p == '-') {
+            negativeExponent = *p == '-';
+            p++;
+        }
+        int e = 0;
+        while (isDigit(*p)) {
+            if (e < 10000) e = e * 10 + (*p - '0');
+            p++;
         }
+        exponent += negativeExponent ? -e : e;
+    }
+
+    double value = exponent ? (double)mantissa * pow10i(exponent) : (double)mantissa;
+    out = (float)(negative ? -value : value);
+
+    ps.p = p;
+    skipSeparator(ps);
+    return true;
+}
+
+static bool readNumbers(SvgParser& ps, float* dst, int n)
+{
+    for (int i=0; i<n; i++) {
+        if (!readNumber(ps, dst[i])) return false;
+    }
+    return true;
+}
 
+// Arc flags are a single '0' or '1', which may run straight into the next number
+static bool readFlag(SvgParser& ps, bool& out)
+{
+    if (*ps.p != '0' && *ps.p != '1') {
+        return svgFail(ps, "expected an arc flag (0 or 1)");
     }
+    out = *ps.p == '1';
+    ps.p++;
+    skipSeparator(ps);
     return true;
 }
 
+static inline void pushCubic(Path* path, const vec2& c1, const vec2& c2, const vec2& p)
+{
+    path->m_commands.push_back(CUBIC_CURVE_TO);
+    path->m_points.push_back(c1);
+    path->m_points.push_back(c2);
+    path->m_points.push_back(p);
+}
+
+static float vectorAngle(const vec2& u, const vec2& v)
+{
+    return atan2f(u.x * v.y - u.y * v.x, u.x * v.x + u.y * v.y);
+}
+
+// Converts an SVG elliptical arc to cubic curves, following the endpoint to center
+// conversion in http://www.w3.org/TR/SVG/implnote.html#ArcImplementationNotes
+static void appendSvgArc(Path* path, const vec2& p0, float rx, float ry, float rotation,
+                         bool largeArc, bool sweep, const vec2& p1)
+{
+    rx = fabsf(rx);
+    ry = fabsf(ry);
+    if (rx == 0 || ry == 0) {
+        path->m_commands.push_back(LINE_TO);
+        path->m_points.push_back(p1);
+        return;
+    }
+    if (p0 == p1) {
+        return;
+    }
+
+    float phi = rotation * (float)M_PI / 180.0f;
+    float cosPhi = cosf(phi);
+    float sinPhi = sinf(phi);
+
+    vec2 d = 0.5f * (p0 - p1);
+    vec2 q(cosPhi * d.x + sinPhi * d.y, -sinPhi * d.x + cosPhi * d.y);
+
+    // Scale up radii that are too small to reach the end point
+    float lambda = (q.x * q.x) / (rx * rx) + (q.y * q.y) / (ry * ry);
+    if (lambda > 1) {
+        float s = sqrtf(lambda);
+        rx *= s;
+        ry *= s;
+    }
+
+    float rx2 = rx * rx;
+    float ry2 = ry * ry;
+    float num = rx2 * ry2 - rx2 * q.y * q.y - ry2 * q.x * q.x;
+    float den = rx2 * q.y * q.y + ry2 * q.x * q.x;
+    float k = den > 0 && num > 0 ? sqrtf(num / den) : 0;
+    if (largeArc == sweep) k = -k;
+
+    vec2 cq(k * rx * q.y / ry, -k * ry * q.x / rx);
+    vec2 center(cosPhi * cq.x - sinPhi * cq.y + 0.5f * (p0.x + p1.x),
+                sinPhi * cq.x + cosPhi * cq.y + 0.5f * (p0.y + p1.y));
+
+    vec2 u((q.x - cq.x) / rx, (q.y - cq.y) / ry);
+    vec2 v((-q.x - cq.x) / rx, (-q.y - cq.y) / ry);
+    float theta = atan2f(u.y, u.x);
+    float delta = vectorAngle(u, v);
+    if (!sweep && delta > 0) delta -= 2 * (float)M_PI;
+    if (sweep && delta < 0) delta += 2 * (float)M_PI;
+
+    // At most a quarter turn per cubic
+    int segments = (int)ceilf(fabsf(delta) / (0.5f * (float)M_PI) - 1e-4f);
+    if (segments < 1) segments = 1;
+    float step = delta / segments;
+    float t = 4.0f / 3.0f * tanf(step / 4);
+
+    float a = theta;
+    for (int i=0; i<segments; i++) {
+        float cosA = cosf(a), sinA = sinf(a);
+        float cosB = cosf(a + step), sinB = sinf(a + step);
+
+        // Unit circle control points, then scaled, rotated and translated onto the ellipse
+        vec2 e1(cosA - t * sinA, sinA + t * cosA);
+        vec2 e2(cosB + t * sinB, sinB - t * cosB);
+        vec2 e3(cosB, sinB);
+
+        vec2 c1(center.x + rx * e1.x * cosPhi - ry * e1.y * sinPhi, center.y + rx * e1.x * sinPhi + ry * e1.y * cosPhi);
+        vec2 c2(center.x + rx * e2.x * cosPhi - ry * e2.y * sinPhi, center.y + rx * e2.x * sinPhi + ry * e2.y * cosPhi);
+        vec2 to = i == segments - 1 ? p1 :
+                vec2(center.x + rx * e3.x * cosPhi - ry * e3.y * sinPhi, center.y + rx * e3.x * sinPhi + ry * e3.y * cosPhi);
+
+        pushCubic(path, c1, c2, to);
+        a += step;
+    }
+}
 
-LUAEXPORT(void appendSvgPath(Path* path, const char* pathString))
+// Appends SVG path data to a path. Returns -1 on success, or the character offset
+// of the first error. Commands before the error are kept, as the SVG spec asks.
+LUAEXPORT(int appendSvgPath(Path* path, const char* pathString))
 {
-    std::stringstream ss;
-    ss << pathString;
 
+    // Guess at the output size from the input length. Numbers take at least a few
+    // characters each, so this rarely needs to grow and never wildly overshoots.
+    size_t len = strlen(pathString);
+    path->m_points.reserve(path->m_points.size() + len / 8);
+    path->m_commands.reserve(path->m_commands.size() + len / 24);
+
+    SvgParser ps;
+    ps.begin = pathString;
+    ps.p = pathString;
+    ps.error = 0;
+    ps.errorMessage = 0;
+
+    vec2 current(0, 0);
+    vec2 subpathStart(0, 0);
+    vec2 lastControl(0, 0);     // last control point of the previous curve, for S and T
+    char lastCommand = 0;
     char cmd = 0;
-    while (!ss.eof())
-    {
-        ss >> cmd;
-        if (ss.fail()) {
-            std::cerr << "Expected path command character but didn't read one" << std::endl;
-            return;
+
+    skipSpace(ps);
+
+    while (*ps.p) {
+        const char* cmdStart = ps.p;
+        if (atNumber(ps)) {
+            // Repeated command, which is only allowed after a command that takes parameters
+            if (cmd == 0 || cmd == 'z' || cmd == 'Z') {
+                svgFail(ps, "expected a path command");
+                break;
+            }
+        } else {
+            cmd = *ps.p++;
+            skipSpace(ps);
+        }
+
+        bool relative = cmd >= 'a' && cmd <= 'z';
+        vec2 origin = relative ? current : vec2(0, 0);
+        float v[7];
+
+        if (lastCommand == 0 && cmd != 'M' && cmd != 'm') {
+            ps.p = cmdStart;
+            svgFail(ps, "path data must start with a move command");
+            break;
         }
 
         switch(cmd) {
         case 'M':
+        case 'm':
+            if (!readNumbers(ps, v, 2)) break;
+            current = origin + vec2(v[0], v[1]);
+            subpathStart = current;
+            path->m_commands.push_back(MOVE_TO);
+            path->m_points.push_back(current);
+            // Any further coordinate pairs are implicit line commands
+            cmd = relative ? 'l' : 'L';
+            lastCommand = 'M';
+            continue;
+
+        case 'L':
+        case 'l':
+            if (!readNumbers(ps, v, 2)) break;
+            current = origin + vec2(v[0], v[1]);
+            path->m_commands.push_back(LINE_TO);
+            path->m_points.push_back(current);
+            break;
+
+        case 'H':
+        case 'h':
+            if (!readNumbers(ps, v, 1)) break;
+            current.x = origin.x + v[0];
+            path->m_commands.push_back(LINE_TO);
+            path->m_points.push_back(current);
+            break;
+
+        case 'V':
+        case 'v':
+            if (!readNumbers(ps, v, 1)) break;
+            current.y = origin.y + v[0];
+            path->m_commands.push_back(LINE_TO);
+            path->m_points.push_back(current);
+            break;
+
+        case 'C':
+        case 'c':
         {
-            float p[2];
-            //std::cerr << "Move to: " << std::endl;
-            if (!readFloatsFromStream(ss, p, 2)) return;
-            moveTo(path, p[0], p[1]);
+            if (!readNumbers(ps, v, 6)) break;
+            vec2 c1 = origin + vec2(v[0], v[1]);
+            vec2 c2 = origin + vec2(v[2], v[3]);
+            current = origin + vec2(v[4], v[5]);
+            pushCubic(path, c1, c2, current);
+            lastControl = c2;
             break;
         }
-        case 'C':
+
+        case 'S':
+        case 's':
         {
-            float p[6];
-            //std::cerr << "Cubic to: " << std::endl;
-            readFloatsFromStream(ss, p, 6);
-            cubicCurveTo(path, p[0], p[1], p[2], p[3], p[4], p[5]);
+            if (!readNumbers(ps, v, 4)) break;
+            bool smooth = lastCommand == 'C' || lastCommand == 'S';
+            vec2 c1 = smooth ? 2.0f * current - lastControl : current;
+            vec2 c2 = origin + vec2(v[0], v[1]);
+            current = origin + vec2(v[2], v[3]);
+            pushCubic(path, c1, c2, current);
+            lastControl = c2;
             break;
         }
+
         case 'Q':
+        case 'q':
         {
-            float p[4];
-            readFloatsFromStream(ss, p, 4);
-            quadraticCurveTo(path, p[0], p[1], p[2], p[3]);
+            if (!readNumbers(ps, v, 4)) break;
+            vec2 c = origin + vec2(v[0], v[1]);
+            current = origin + vec2(v[2], v[3]);
+            path->m_commands.push_back(QUADRATIC_CURVE_TO);
+            path->m_points.push_back(c);
+            path->m_points.push_back(current);
+            lastControl = c;
             break;
         }
 
-        case 'L':
+        case 'T':
+        case 't':
         {
-            float p[2];
-            //std::cerr << "Line to: " << std::endl;
-            readFloatsFromStream(ss, p, 2);
-            lineTo(path, p[0], p[1]);
+            if (!readNumbers(ps, v, 2)) break;
+            bool smooth = lastCommand == 'Q' || lastCommand == 'T';
+            vec2 c = smooth ? 2.0f * current - lastControl : current;
+            current = origin + vec2(v[0], v[1]);
+            path->m_commands.push_back(QUADRATIC_CURVE_TO);
+            path->m_points.push_back(c);
+            path->m_points.push_back(current);
+            lastControl = c;
             break;
+        }
 
+        case 'A':
+        case 'a':
+        {
+            bool largeArc, sweep;
+            if (!readNumbers(ps, v, 3)) break;
+            if (!readFlag(ps, largeArc) || !readFlag(ps, sweep)) break;
+            if (!readNumbers(ps, v + 3, 2)) break;
+            vec2 end = origin + vec2(v[3], v[4]);
+            appendSvgArc(path, current, v[0], v[1], v[2], largeArc, sweep, end);
+            current = end;
+            break;
         }
+
+        case 'Z':
         case 'z':
-            //std::cerr << "End path" << std::endl;
-            return;
-        case ' ':
+            path->m_commands.push_back(CLOSE_PATH);
+            current = subpathStart;
             break;
+
         default:
-            std::cerr << "Unknown path command: " << cmd << std::endl;
-            return;
+            ps.p = cmdStart;
+            svgFail(ps, "unknown path command");
+            break;
         }
 
+        if (ps.error) break;
+        lastCommand = (char)(cmd & ~0x20);     // upper case
+    }
+
+    if (ps.error) {
+        int offset = (int)(ps.error - ps.begin);
+        std::cerr << "Error in SVG path data at character " << offset << ": " << ps.errorMessage;
+        if (*ps.error) {
+            std::cerr << " near \"" << std::string(ps.error, strnlen(ps.error, 16)) << "\"";
+        }
+        std::cerr << std::endl;
+        return offset;
+    }
+
+    return -1;
+}
+
+LUAEXPORT(void setFlattenTolerance(float pixels))
+{
+    if (pixels > 0) {
+        gFlattenTolerance = pixels;
     }
 }
 
-std::vector<Contour> Path::contoursFromPath()
+// Curves are flattened to a tolerance in path units, which depends on how many pixels
+// one path unit covers on screen. The tolerance is rounded down to a power of two so
+// that cached meshes survive small changes of scale and are only rebuilt when the
+// scale changes by enough to matter.
+static int toleranceBucket(float pixelsPerUnit)
+{
+    if (!(pixelsPerUnit > 0)) {
+        pixelsPerUnit = 1;
+    }
+    return (int)floorf(log2f(gFlattenTolerance / pixelsPerUnit));
+}
+
+static float toleranceForBucket(int bucket)
+{
+    return ldexpf(1.0f, bucket);
+}
+
+// Brings m_contours up to date with the path. Commands are only ever appended,
+// so only the ones added since the last call need flattening.
+const Contours& Path::flatten(int toleranceBucket)
 {
-    std::vector<Contour> contours;
+    if (m_contoursGeneration < 0 || toleranceBucket != m_contoursToleranceBucket) {
+        m_contours.clear();
+        m_contours.points.reserve(m_points.size());
+        m_contoursGeneration++;
+        m_contoursVersion++;
+        m_contoursToleranceBucket = toleranceBucket;
+        m_flattenedCommands = 0;
+        m_flattenedPoints = 0;
+        m_flattenedPos = vec2(0, 0);
+        m_contourOpen = false;
+
+        // Start from the bundle's contours if it has them at this tolerance, and
+        // flatten only commands added since
+        const BundleEntry* entry = m_bundle ? m_bundle->entry(m_bundled) : 0;
+        const BundleLevel* level = entry ? m_bundle->level(entry, toleranceBucket) : 0;
+        if (level && m_commands.size() >= entry->commandCount) {
+            m_bundle->loadContours(level, m_contours);
+            m_flattenedCommands = entry->commandCount;
+            m_flattenedPoints = entry->pointCount;
+            m_flattenedPos = vec2(level->flattenedPos[0], level->flattenedPos[1]);
+            m_contourOpen = level->contourOpen != 0;
+        }
+    }
 
-    contours.push_back(Contour());
+    float tolerance = toleranceForBucket(toleranceBucket);
+    Contours& contours = m_contours;
+    vec2& currentPos = m_flattenedPos;
+    size_t pointIndex = m_flattenedPoints;
+    bool changed = false;
 
-    vec2 currentPos;
-    currentPos.x = 0;
-    currentPos.y = 0;
+    for (size_t pathIndex = m_flattenedCommands; pathIndex < m_commands.size(); pathIndex++) {
+        PathCommand command = m_commands[pathIndex];
 
-    int pointIndex = 0;
+        // Only moving, or closing with no contour open, leaves the contours as they were
+        if (command != MOVE_TO && (command != CLOSE_PATH || m_contourOpen)) {
+            changed = true;
+        }
 
-    for (size_t pathIndex = 0; pathIndex < m_commands.size(); pathIndex++) {
-        switch(m_commands[pathIndex])
+        // Drawing after a moveTo or close starts a new contour at the current position.
+        // A moveTo on its own doesn't make a contour, so repeated moveTos just move.
+        if (command != MOVE_TO && command != CLOSE_PATH && !m_contourOpen) {
+            contours.begin(currentPos);
+            m_contourOpen = true;
+        }
+
+        switch(command)
         {
         case MOVE_TO:
         {
             currentPos = m_points[pointIndex++];
-
-            if (contours.back().size() == 0) {
-                // Empty contour, append point
-                contours.back().push_back(currentPos);
-            } else if (contours.back().size() == 1) {
-                // Contour only contains a moveTo, replace existing point
-                std::cerr << "Replacing single moveTo" << std::endl;
-                contours.back()[0] = currentPos;
-            } else {
-                // Contour contains line segments already, start a new contour
-                contours.push_back(Contour());
-                contours.back().push_back(currentPos);
-            }
+            m_contourOpen = false;
             break;
         }
         case LINE_TO:
         {
             currentPos = m_points[pointIndex++];
-            contours.back().push_back(currentPos);
+            contours.append(currentPos);
             break;
         }
         case QUADRATIC_CURVE_TO:
         {
             const vec2& c1 = m_points[pointIndex++];
             const vec2& p2 = m_points[pointIndex++];
-            appendQuadraticCurveTo(contours.back(), currentPos, c1, p2, 0);
+            appendQuadraticCurveTo(contours, currentPos, c1, p2, tolerance);
             currentPos = p2;
             break;
         }
@@ -256,56 +709,87 @@ std::vector<Contour> Path::contoursFromPath()
             const vec2& c1 = m_points[pointIndex++];
             const vec2& c2 = m_points[pointIndex++];
             const vec2& p2 = m_points[pointIndex++];
-            appendCubicCurveTo(contours.back(), currentPos, c1, c2, p2, 64);
+            appendCubicCurveTo(contours, currentPos, c1, c2, p2, tolerance);
             currentPos = p2;
             break;
         }
+        case CLOSE_PATH:
+        {
+            // Mark the contour closed and return to its start, where drawing continues
+            // in a new contour if there's no moveTo. The closing segment is implied,
+            // so an explicit line back to the start is dropped.
+            if (!m_contourOpen) break;
+            size_t last = contours.count() - 1;
+            vec2 start = *contours.contour(last);
+            if (contours.points.back() == start && contours.contourSize(last) > 2) {
+                contours.points.pop_back();
+                contours.offsets.back()--;
+            }
+            contours.closed[last] = 1;
+            currentPos = start;
+            m_contourOpen = false;
+            break;
+        }
         default:
-            std::cerr << "Unknown path command" << std::endl;
-            return contours;
+            // Skip commands that can't be flattened, such as ARC_TO, with their
+            // points, so the commands after them still get the right points
+            std::cerr << "Unsupported path command " << command << std::endl;
+            pointIndex += commandPointCount(command);
+            break;
         }
     }
 
+    m_flattenedCommands = m_commands.size();
+    m_flattenedPoints = pointIndex;
+    if (changed) {
+        m_contoursVersion++;
+    }
     return contours;
 }
 
 
 
-#define PATH_RECURSION_LIMIT 5
-#define PATH_COLLINEARITY_EPSILON FLT_EPSILON
+#define PATH_MAX_CURVE_SEGMENTS 1024
 
-// cos(theta) where theta is maximum angle between line segments
-const float BEZIER_FLATNESS = 0.998f;
+// Number of line segments needed to keep a bezier curve within tolerance of its
+// flattened version (Wang's formula). secondDiff is the largest second difference
+// of the control points and degreeFactor is n(n-1)/8 for a curve of degree n.
+static int curveSegmentCount(float secondDiff, float degreeFactor, float tolerance)
+{
+    float n = ceilf(sqrtf(degreeFactor * secondDiff / tolerance));
+    if (!(n >= 1)) return 1;
+    if (n > PATH_MAX_CURVE_SEGMENTS) return PATH_MAX_CURVE_SEGMENTS;
+    return (int)n;
+}
 
-void appendQuadraticCurveTo(std::vector<vec2>& contour, const vec2& p1, const vec2& p2, const vec2& p3, int level)
+void appendQuadraticCurveTo(Contours& contours, const vec2& p1, const vec2& c, const vec2& p2, float tolerance)
 {
-    vec2 m12 = 0.5f * (p1 + p2);
-    vec2 m23 = 0.5f * (p2 + p3);
-    vec2 m123 = 0.5f * (m12 + m23);
+    vec2 a = p1 - c * 2.0f + p2;
+    int segments = curveSegmentCount(glm::length(a), 0.25f, tolerance);
 
-    //vec2 d31 = p3 - p1;
-    //float d = fabsf(m23[0] * d31[1] - m23[1] * d31[0]);
+    // Forward differencing, as for cubics below
+    float subdiv_step = 1.0f / segments;
+    float subdiv_step2 = subdiv_step * subdiv_step;
 
-    if (level > PATH_RECURSION_LIMIT) {
-        contour.push_back(m123);
-        contour.push_back(p3);
-        return;
-    }
+    vec2 f = p1;
+    vec2 df = (c - p1) * (2 * subdiv_step) + a * subdiv_step2;
+    vec2 ddf = a * (2 * subdiv_step2);
 
-    float dotp = glm::dot(glm::normalize(p1 - p2), glm::normalize(p3 - p2));
-    if (fabs(dotp) > BEZIER_FLATNESS) {
-        contour.push_back(m123);
-        contour.push_back(p3);
-        return;
+    while (--segments > 0) {
+        f += df;
+        df += ddf;
+        contours.append(f);
     }
 
-
-    appendQuadraticCurveTo(contour, p1, m12, m123, level+1);
-    appendQuadraticCurveTo(contour, m123, m23, p3, level+1);
+    // Finish exactly on the end point so accumulated rounding can't open a gap
+    contours.append(p2);
 }
 
-void appendCubicCurveTo(std::vector<vec2>& contour, const vec2& p1, const vec2& c1, const vec2& c2, const vec2& p2, int segments)
+void appendCubicCurveTo(Contours& contours, const vec2& p1, const vec2& c1, const vec2& c2, const vec2& p2, float tolerance)
 {
+    float dd = glm::max(glm::length(p1 - c1 * 2.0f + c2), glm::length(c1 - c2 * 2.0f + p2));
+    int segments = curveSegmentCount(dd, 0.75f, tolerance);
+
     // Algorithm from: http://www.antigrain.com/research/bezier_interpolation/index.html#PAGE_BEZIER_INTERPOLATION
     float subdiv_step = 1.0f / segments;
     float subdiv_step2 = subdiv_step * subdiv_step;
@@ -324,134 +808,316 @@ void appendCubicCurveTo(std::vector<vec2>& contour, const vec2& p1, const vec2&
     vec2 ddf = tmp1 * pre4 + tmp2 * pre5;
     vec2 dddf = tmp2 * pre5;
 
-    while (segments-- > 0) {
+    while (--segments > 0) {
         f += df;
         df += ddf;
         ddf += dddf;
-        contour.push_back(f);
+        contours.append(f);
     }
+
+    contours.append(p2);
 }
 
 
-const Mesh* fillPath(Path* path)
+const Mesh* fillPath(Path* path, float pixelsPerUnit)
 {
-    if (path->m_filledMesh) {
+    // Edits only flatten the new commands, but the fill has to be tessellated again
+    // as a whole, so that's put off until the path is actually drawn, and skipped
+    // if the edits didn't change the contours
+    int bucket = toleranceBucket(pixelsPerUnit);
+    const Contours& contours = path->flatten(bucket);
+    TriangulatorType triangulator = path->m_triangulator < 0 ? gTriangulator : (TriangulatorType)path->m_triangulator;
+    if (path->m_filledMesh && path->m_filledVersion == path->m_contoursVersion
+            && path->m_filledTriangulator == triangulator) {
         return path->m_filledMesh;
     }
 
-    TESSalloc talloc;
-
-    memset(&talloc, 0, sizeof(talloc));
-    talloc.memalloc = stdAlloc;
-    talloc.memfree = stdFree;
-    talloc.memfree = stdFree;
+    // Reuse the old mesh's storage if there is one
+    if (!path->m_filledMesh) {
+        path->m_filledMesh = new Mesh();
+    }
 
-    TESStesselator* tess = tessNewTess(&talloc);
-    if (!tess) {
-        std::cerr << "Couldn't allocate tessellator" << std::endl;
+    path->m_filledIndex.clear();
+    const BundleLevel* level = path->bundledLevel(bucket);
+    if (level && level->triangulator == triangulator) {
+        path->m_bundle->loadFill(level, path->m_filledMesh);
+    } else if (!gTessContext.tessellate(contours, path->m_filledMesh, triangulator)) {
+        delete path->m_filledMesh;
+        path->m_filledMesh = 0;
         return 0;
     }
 
-    std::vector<Contour> contours = path->contoursFromPath();
+    path->m_filledMesh->version++;
+    path->m_filledVersion = path->m_contoursVersion;
+    path->m_filledTriangulator = triangulator;
+    return path->m_filledMesh;
+}
 
-    for (size_t i=0; i<contours.size(); i++) {
-        tessAddContour(tess, 2, contours[i].data(), (int)sizeof(vec2), (int)contours[i].size());
+const Mesh* strokePath(Path* path, float pixelsPerUnit)
+{
+    int bucket = toleranceBucket(pixelsPerUnit);
+    const Contours& contours = path->flatten(bucket);
+
+    if (!path->m_strokedMesh) {
+        path->m_strokedMesh = new Mesh();
     }
 
-    // Triangulate
-    int success = tessTesselate(tess, TESS_WINDING_ODD, TESS_POLYGONS, 3, 2, 0);
-    if (success == 0) {
-        std::cerr << "Failed to tessellate path" << std::endl;
-        return 0;
+    // Extend the existing stroke, unless the contours were flattened again from scratch
+    Mesh* mesh = path->m_strokedMesh;
+    bool restroke = path->m_strokedGeneration != path->m_contoursGeneration;
+    if (path->m_strokedFromBundle && path->m_commands.size() != path->m_bundle->entry(path->m_bundled)->commandCount) {
+        // The stroker didn't build the loaded stroke, so it can't extend it
+        restroke = true;
+    }
+    if (restroke) {
+        path->m_strokedGeneration = path->m_contoursGeneration;
+        path->m_strokedIndex.clear();
+        mesh->version++;
+
+        const BundleLevel* level = path->bundledLevel(bucket);
+        path->m_strokedFromBundle = level && level->strokeJoin == (int)path->m_strokeStyle.join
+                && level->strokeCap == (int)path->m_strokeStyle.cap
+                && level->miterLimit == path->m_strokeStyle.miterLimit;
+        if (path->m_strokedFromBundle) {
+            path->m_bundle->loadStroke(level, mesh);
+        } else {
+            path->m_stroker.reset(mesh);
+        }
+    }
+    if (path->m_strokedFromBundle) {
+        return mesh;
+    }
+    if (path->m_stroker.update(contours, path->m_strokeStyle, mesh)) {
+        path->m_strokedIndex.clear();
+        mesh->version++;
     }
 
-    const unsigned int* pind = tessGetElements(tess);
-    size_t nind = tessGetElementCount(tess) * 3;
-    std::vector<unsigned int> indices(pind, pind + nind);
+    return path->m_strokedMesh;
+}
 
-    const vec2* pvert = (const vec2*) tessGetVertices(tess);
-    size_t nvert = tessGetVertexCount(tess);
-    std::vector<vec2> vertices(pvert, pvert + nvert);
+// The bundled geometry at the given tolerance, if the path hasn't changed since it was loaded
+const BundleLevel* Path::bundledLevel(int toleranceBucket) const
+{
+    if (!m_bundle) return 0;
+    const BundleEntry* entry = m_bundle->entry(m_bundled);
+    if (m_commands.size() != entry->commandCount) return 0;
+    return m_bundle->level(entry, toleranceBucket);
+}
 
-    tessDeleteTess(tess);
+void Path::updateBounds()
+{
+    for (; m_boundedPoints < m_points.size(); m_boundedPoints++) {
+        m_boundsLo = glm::min(m_boundsLo, m_points[m_boundedPoints]);
+        m_boundsHi = glm::max(m_boundsHi, m_points[m_boundedPoints]);
+    }
+}
 
+// Whether p, in path units, is inside the path as drawn: filled, or stroked
+// if strokeWidth > 0. Uses the same meshes as drawing at pixelsPerUnit.
+bool pathContains(Path* path, const vec2& p, float strokeWidth, float pixelsPerUnit)
+{
+    // Most queries miss most paths, so rule them out before finding the mesh. Strokes
+    // reach at most a miter or a square cap's corner beyond the outline.
+    path->updateBounds();
+    float margin = strokeWidth > 0 ? strokeWidth * glm::max(path->m_strokeStyle.miterLimit, 1.5f) : 0;
+    if (p.x < path->m_boundsLo.x - margin || p.y < path->m_boundsLo.y - margin
+            || p.x > path->m_boundsHi.x + margin || p.y > path->m_boundsHi.y + margin) {
+        return false;
+    }
 
-    path->m_filledMesh = new Mesh(vertices, indices);
-    return path->m_filledMesh;
+    if (strokeWidth > 0) {
+        const Mesh* mesh = strokePath(path, pixelsPerUnit);
+        if (!path->m_strokedIndex.valid()) {
+            path->m_strokedIndex.build(*mesh);
+        }
+        return path->m_strokedIndex.contains(*mesh, p, strokeWidth);
+    }
+
+    // Stencil fills have no mesh, and don't need one to be made here
+    if (path->m_fillMode != FILL_TESSELLATE) {
+        return contoursContain(flattenPath(path, pixelsPerUnit), p, path->m_fillMode == FILL_STENCIL_NONZERO);
+    }
+
+    const Mesh* mesh = fillPath(path, pixelsPerUnit);
+    if (!mesh) return false;
+    if (!path->m_filledIndex.valid()) {
+        path->m_filledIndex.build(*mesh);
+    }
+    return path->m_filledIndex.contains(*mesh, p, 0);
+}
+
+// Flattened outline for drawing without a mesh, see FillMode
+const Contours& flattenPath(Path* path, float pixelsPerUnit)
+{
+    return path->flatten(toleranceBucket(pixelsPerUnit));
+}
 
+FillMode pathFillMode(const Path* path)
+{
+    return path->m_fillMode;
 }
 
-const Mesh* strokePath(Path* path, float strokeWidth)
+// mode takes the values of FillMode
+LUAEXPORT(void setFillMode(Path* path, int mode))
 {
-    if (path->m_strokedMesh && path->m_cachedStrokeWidth == strokeWidth) {
-        return path->m_strokedMesh;
+    if (mode < FILL_TESSELLATE || mode > FILL_STENCIL_NONZERO) {
+        std::cerr << "Unknown fill mode " << mode << std::endl;
+        return;
+    }
+
+    path->m_fillMode = (FillMode)mode;
+
+    // The stencil modes don't use a mesh
+    if (path->m_fillMode != FILL_TESSELLATE) {
+        delete path->m_filledMesh;
+        path->m_filledMesh = 0;
     }
+}
 
-    delete path->m_strokedMesh;
-    path->m_strokedMesh = new Mesh();
-    path->m_cachedStrokeWidth = strokeWidth;
+// type takes the values of TriangulatorType. Paths are re-triangulated when next filled.
+LUAEXPORT(void setTriangulator(int type))
+{
+    if (type < 0 || type >= TRIANGULATOR_COUNT) {
+        std::cerr << "Unknown triangulator " << type << std::endl;
+        return;
+    }
+    gTriangulator = (TriangulatorType)type;
+}
 
-    std::vector<Contour> contours = path->contoursFromPath();
-    size_t numverts = 0;
-    for (size_t i=0; i<contours.size(); i++) {
-        numverts += contours[i].size();
+// As setTriangulator() for one path, or -1 to go back to the global choice
+LUAEXPORT(void setPathTriangulator(Path* path, int type))
+{
+    if (type < -1 || type >= TRIANGULATOR_COUNT) {
+        std::cerr << "Unknown triangulator " << type << std::endl;
+        return;
     }
+    path->m_triangulator = type;
+}
 
+// join and cap take the values of StrokeJoin and StrokeCap
+LUAEXPORT(void setStrokeStyle(Path* path, int join, int cap, float miterLimit))
+{
+    StrokeStyle style;
+    style.join = (StrokeJoin)join;
+    style.cap = (StrokeCap)cap;
+    style.miterLimit = miterLimit >= 1 ? miterLimit : 1;
+
+    if (!(style == path->m_strokeStyle)) {
+        path->m_strokeStyle = style;
+        path->m_strokedGeneration = -1;
+    }
+}
 
-    path->m_strokedMesh->vertices.reserve(numverts * 2);
-    path->m_strokedMesh->indices.reserve((numverts-1) * 6);
+struct PrebuildBatch
+{
+    Path** paths;
+    const float* pixelsPerUnit;
+    const float* strokeWidths;     // only used to choose between fill and stroke
+    std::vector<int> order;         // entries sorted by path
+    std::vector<size_t> groups;     // start of each run of the same path in order, plus the end
+};
 
-    for (size_t c=0; c<contours.size(); c++) {
-        const Contour& contour = contours[c];
-        if (contour.size() < 2) {
-            std::cerr << "Path contour has less than two points, not stroking it" << std::endl;
-            continue;
+static void prebuildPathGroup(void* data, size_t g)
+{
+    // A path can appear more than once (filled and stroked, say). All entries for one
+    // path are built by the same job, since they share the path's cached meshes.
+    PrebuildBatch* batch = (PrebuildBatch*)data;
+    for (size_t k=batch->groups[g]; k<batch->groups[g+1]; k++) {
+        int i = batch->order[k];
+        if (batch->strokeWidths && batch->strokeWidths[i] > 0) {
+            strokePath(batch->paths[i], batch->pixelsPerUnit[i]);
+        } else {
+            fillPath(batch->paths[i], batch->pixelsPerUnit[i]);
         }
+    }
+}
 
-        path->m_strokedMesh->vertices.push_back(contour[0]);
-        vec2& contourStart1 = path->m_strokedMesh->vertices.back();
-        path->m_strokedMesh->vertices.push_back(contour[0]);
-        vec2& contourStart2 = path->m_strokedMesh->vertices.back();
-
-        for (size_t i=1; i<contour.size()-1; i++) {
-            const vec2& p0 = contour[i-1];
-            const vec2& p1 = contour[i];
-            const vec2& p2 = contour[i+1];
-
-            vec2 tangent1 = glm::normalize(p1 - p0);
-            vec2 tangent2 = glm::normalize(p2 - p1);
-            vec2 normal1(-tangent1[1], tangent2[0]);
-            vec2 bisector = glm::normalize(0.5f * (tangent1 - tangent2));
-            bisector *= strokeWidth / glm::dot(normal1, bisector);
-            path->m_strokedMesh->vertices.push_back(p1 + bisector);
-            path->m_strokedMesh->vertices.push_back(p1 - bisector);
+// Builds the meshes that drawing each path would otherwise build on first use, spread
+// across the job threads. strokeWidths may be null to fill everything; otherwise entries
+// with a width > 0 are stroked and the rest filled. Returns when all meshes are ready.
+LUAEXPORT(void prebuildPathMeshes(Path** paths, const float* pixelsPerUnit, const float* strokeWidths, int count))
+{
+    if (count <= 0) return;
+
+    PrebuildBatch batch;
+    batch.paths = paths;
+    batch.pixelsPerUnit = pixelsPerUnit;
+    batch.strokeWidths = strokeWidths;
+
+    batch.order.resize(count);
+    for (int i=0; i<count; i++) batch.order[i] = i;
+    std::stable_sort(batch.order.begin(), batch.order.end(), [paths](int a, int b) {
+        return std::less<Path*>()(paths[a], paths[b]);
+    });
+
+    for (int k=0; k<count; k++) {
+        if (!paths[batch.order[k]]) continue;
+        if (batch.groups.empty() || paths[batch.order[k]] != paths[batch.order[batch.groups.back()]]) {
+            batch.groups.push_back(k);
         }
+    }
+    if (batch.groups.empty()) return;
+    batch.groups.push_back(count);
+
+    // Null paths sort first, so skipping them above leaves them out of every group
+    parallelFor(batch.groups.size() - 1, prebuildPathGroup, &batch);
+}
 
-        // Fix up start of first segment (no bisector)
-        vec2 tangent = glm::normalize(contour[1] - contour[0]) * strokeWidth;
-        vec2 normal(-tangent[1], tangent[0]);
-        contourStart1 += normal;
-        contourStart2 -= normal;
-
-        // Add end of last segment (no bisector)
-        tangent = glm::normalize(contour.back() - contour[contour.size()-2]) * strokeWidth;
-        normal[0] = -tangent[1];
-        normal[1] = tangent[0];
-        path->m_strokedMesh->vertices.push_back(contour.back() + normal);
-        path->m_strokedMesh->vertices.push_back(contour.back() - normal);
-
-        // Add indices
-        for (size_t i=0; i<contour.size()-1; i++) {
-            unsigned int j=(unsigned int)i*2;
-            path->m_strokedMesh->indices.push_back(j);
-            path->m_strokedMesh->indices.push_back(j+1);
-            path->m_strokedMesh->indices.push_back(j+2);
-            path->m_strokedMesh->indices.push_back(j+2);
-            path->m_strokedMesh->indices.push_back(j+1);
-            path->m_strokedMesh->indices.push_back(j+3);
+// Makes a path from the bundle's entry for source, the SVG path data or other string
+// the path was built from. Returns null if the bundle has no such entry.
+LUAEXPORT(Path* bundledPath(MeshBundle* bundle, const char* source))
+{
+    const BundleEntry* entry = bundle ? bundle->find(bundleKey(source)) : 0;
+    if (!entry) return 0;
+
+    Path* path = new Path;
+    const uint8_t* commands = bundle->array<uint8_t>(entry->commands);
+    path->m_commands.reserve(entry->commandCount);
+    size_t pointCount = 0;
+    for (uint32_t i=0; i<entry->commandCount; i++) {
+        if (commands[i] > CLOSE_PATH) {
+            std::cerr << "Error: invalid command in mesh bundle" << std::endl;
+            delete path;
+            return 0;
         }
+        path->m_commands.push_back((PathCommand)commands[i]);
+        pointCount += commandPointCount((PathCommand)commands[i]);
+    }
+    if (pointCount != entry->pointCount) {
+        std::cerr << "Error: path in mesh bundle has " << entry->pointCount << " points, its commands need " << pointCount << std::endl;
+        delete path;
+        return 0;
     }
+    const vec2* points = bundle->array<vec2>(entry->points);
+    path->m_points.assign(points, points + entry->pointCount);
 
+    bundle->retain();
+    path->m_bundle = bundle;
+    path->m_bundled = bundle->entryIndex(entry);
+    return path;
+}
 
-    return path->m_strokedMesh;
+// Adds the path's geometry at pixelsPerUnit to a bundle, under the source it was made
+// from. Paths with strokeWidth > 0 store their stroke mesh, others their fill mesh;
+// add a path twice to store both. Returns 0 if the path couldn't be filled.
+LUAEXPORT(int addToMeshBundle(MeshBundleWriter* writer, const char* source, Path* path, float pixelsPerUnit, float strokeWidth))
+{
+    int bucket = toleranceBucket(pixelsPerUnit);
+    const Mesh* mesh = strokeWidth > 0 ? strokePath(path, pixelsPerUnit) : fillPath(path, pixelsPerUnit);
+    if (!mesh) return 0;
+
+    std::vector<uint8_t> commands(path->m_commands.begin(), path->m_commands.end());
+    MeshBundleWriter::Level& level = writer->level(bundleKey(source), commands, path->m_points, bucket);
+    level.contours = path->flatten(bucket);
+    level.flattenedPos = path->m_flattenedPos;
+    level.contourOpen = path->m_contourOpen;
+    if (strokeWidth > 0) {
+        level.stroke = *mesh;
+        level.stroked = true;
+        level.strokeStyle = path->m_strokeStyle;
+    } else {
+        level.fill = *mesh;
+        level.triangulator = path->m_filledTriangulator;
+    }
+    return 1;
 }
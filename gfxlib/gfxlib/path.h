@@ -6,35 +6,90 @@
 
 using glm::vec2;
 
+struct MeshBuffers;
+
 struct Mesh
 {
-    Mesh(std::vector<vec2>& v, std::vector<unsigned int> i)
-        : vertices(v)
-        , indices(i)
+    Mesh(std::vector<vec2> v, std::vector<unsigned int> i)
+        : vertices(std::move(v))
+        , indices(std::move(i))
+        , version(0)
+        , buffers(0)
     {
     }
 
     Mesh()
+        : version(0)
+        , buffers(0)
     {
     }
 
+    // Copies get GPU buffers of their own when they're drawn
+    Mesh(const Mesh& o)
+        : vertices(o.vertices)
+        , extrusions(o.extrusions)
+        , indices(o.indices)
+        , version(0)
+        , buffers(0)
+    {
+    }
+
+    Mesh& operator=(const Mesh& o) {
+        vertices = o.vertices;
+        extrusions = o.extrusions;
+        indices = o.indices;
+        version++;
+        return *this;
+    }
+
+    ~Mesh();
+
     std::vector<vec2> vertices;
+    std::vector<vec2> extrusions;       // stroke meshes only, see strokeContours()
     std::vector<unsigned int> indices;
+
+    unsigned int version;               // bump after changing the mesh, so its GPU copy is updated
+    mutable MeshBuffers* buffers;       // GPU copy made when first drawn, see bufferpool.h
 };
 
 class Path;
+struct Contours;
+class MeshBundle;
+class MeshBundleWriter;
+
+// How drawFilledPath() fills a path
+enum FillMode {
+    FILL_TESSELLATE,            // triangulate once and draw the cached mesh, for paths that rarely change
+    FILL_STENCIL_ODD,           // stencil-then-cover with the even-odd rule, nothing to rebuild when the path changes
+    FILL_STENCIL_NONZERO,       // stencil-then-cover with the nonzero rule
+};
 
-const Mesh* fillPath(Path* path);
-const Mesh* strokePath(Path* path, float strokeWidth);
+// pixelsPerUnit is the on-screen size of one path unit, used to choose how finely curves are flattened.
+// Stroke meshes are independent of the stroke width, which is applied by the vertex shader.
+const Mesh* fillPath(Path* path, float pixelsPerUnit);
+const Mesh* strokePath(Path* path, float pixelsPerUnit);
+const Contours& flattenPath(Path* path, float pixelsPerUnit);
+FillMode pathFillMode(const Path* path);
+bool pathContains(Path* path, const vec2& p, float strokeWidth, float pixelsPerUnit);
 
 
 DLLEXPORT Path* newPath();
+DLLEXPORT void freePath(Path* path);
 DLLEXPORT void moveTo(Path* path, float x, float y);
 DLLEXPORT void lineTo(Path* path, float x, float y);
 DLLEXPORT void quadraticCurveTo(Path* path, float cx, float cy, float x, float y);
 DLLEXPORT void cubicCurveTo(Path* path, float cx1, float cy1, float cx2, float cy2, float x, float y);
 DLLEXPORT void arcTo(Path* path, float x1, float y1, float x2, float y2, float radius);
-DLLEXPORT void appendSvgPath(Path* path, const char* pathString);
+DLLEXPORT void closePath(Path* path);
+DLLEXPORT int appendSvgPath(Path* path, const char* pathString);
+DLLEXPORT void setFlattenTolerance(float pixels);
+DLLEXPORT void setStrokeStyle(Path* path, int join, int cap, float miterLimit);
+DLLEXPORT void setFillMode(Path* path, int mode);
+DLLEXPORT void setTriangulator(int type);
+DLLEXPORT void setPathTriangulator(Path* path, int type);
+DLLEXPORT void prebuildPathMeshes(Path** paths, const float* pixelsPerUnit, const float* strokeWidths, int count);
+DLLEXPORT Path* bundledPath(MeshBundle* bundle, const char* source);
+DLLEXPORT int addToMeshBundle(MeshBundleWriter* writer, const char* source, Path* path, float pixelsPerUnit, float strokeWidth);
 
 
 #endif // PATH_H
@@ -0,0 +1,247 @@
+#include "scene.h"
+#include "canvas.h"
+#include "shader.h"
+#include <string.h>
+
+// MSVC doesn't define M_PI unless you do this
+#ifdef _MSC_VER
+#define _USE_MATH_DEFINES
+#endif
+#include <math.h>
+
+
+Scene::Node::Node()
+    : visible(true)
+    , shape(SHAPE_RECT)
+    , path(0)
+    , strokeWidth(0)
+    , program(0)
+    , rotation(0)
+    , transformDirty(true)
+    , pixelsPerUnit(1)
+{
+    scale[0] = scale[1] = 1;
+    position[0] = position[1] = 0;
+}
+
+Scene::Scene()
+    : m_uniformEpoch(0)
+{
+    memset(m_view, 0, sizeof(m_view));
+}
+
+int Scene::add()
+{
+    if (!m_freeNodes.empty()) {
+        int i = m_freeNodes.back();
+        m_freeNodes.pop_back();
+        m_nodes[i] = Node();
+        return i;
+    }
+    m_nodes.push_back(Node());
+    return (int)m_nodes.size() - 1;
+}
+
+void Scene::remove(int node)
+{
+    if (node < 0 || node >= (int)m_nodes.size() || !m_nodes[node].visible) return;
+    m_nodes[node] = Node();
+    m_nodes[node].visible = false;
+    m_freeNodes.push_back(node);
+}
+
+Scene::Node* Scene::node(int node)
+{
+    if (node < 0 || node >= (int)m_nodes.size()) return 0;
+    return &m_nodes[node];
+}
+
+// The same transform setTransform() in Nexpo.lua makes
+void Scene::updateTransform(Node& node)
+{
+    float rad = node.rotation * (float)M_PI / 180.0f;
+    float c = cosf(rad);
+    float s = sinf(rad);
+    float* t = node.transform;
+    t[0] = m_view[0] * node.scale[0] * c;
+    t[1] = m_view[0] * node.scale[0] * s;
+    t[2] = m_view[0] * (node.position[0] - m_view[2]);
+    t[3] = m_view[1] * -node.scale[1] * s;
+    t[4] = m_view[1] * node.scale[1] * c;
+    t[5] = m_view[1] * (node.position[1] - m_view[3]);
+    t[6] = 0;
+    t[7] = 0;
+    t[8] = 1;
+
+    node.pixelsPerUnit = m_view[4] * fmaxf(fabsf(node.scale[0]), fabsf(node.scale[1]));
+    node.transformDirty = false;
+}
+
+// Returns true if the parameter had to be sent
+bool Scene::setParam(ParamCache& cache, const Param& param)
+{
+    size_t slot = (size_t)param.location;
+    if (slot >= cache.valid.size()) {
+        cache.valid.resize(slot + 1, false);
+        cache.values.resize((slot + 1) * 4);
+    }
+
+    float* cached = &cache.values[slot * 4];
+    if (cache.valid[slot] && memcmp(cached, param.value, param.size * sizeof(float)) == 0) return false;
+    memcpy(cached, param.value, param.size * sizeof(float));
+    cache.valid[slot] = true;
+
+    switch (param.size) {
+    case 1: glUniform1fv(param.location, 1, param.value); break;
+    case 2: glUniform2fv(param.location, 1, param.value); break;
+    case 3: glUniform3fv(param.location, 1, param.value); break;
+    case 4: glUniform4fv(param.location, 1, param.value); break;
+    }
+    return true;
+}
+
+void Scene::draw(const float* view)
+{
+    // Node transforms include the window transform
+    bool viewChanged = memcmp(view, m_view, sizeof(m_view)) != 0;
+    if (viewChanged) {
+        memcpy(m_view, view, sizeof(m_view));
+    }
+
+    // Parameters set from Lua since the last frame may have replaced ours
+    if (m_uniformEpoch != uniformEpoch()) {
+        m_paramCaches.clear();
+    }
+
+    GLuint previousProgram = shaderInUse();
+    GLuint program = 0;
+    ParamCache* cache = 0;
+    GLint transformLocation = -1;
+    bool paramsSent = false;
+
+    for (size_t i=0; i<m_nodes.size(); i++) {
+        Node& node = m_nodes[i];
+        if (!node.visible || !node.program) continue;
+
+        if (node.program != program) {
+            program = node.program;
+            useShader(program);
+            cache = &m_paramCaches[program];
+
+            std::map<GLuint, GLint>::iterator it = m_transformLocations.find(program);
+            if (it == m_transformLocations.end()) {
+                it = m_transformLocations.insert(std::make_pair(program, glGetUniformLocation(program, "v_transform"))).first;
+            }
+            transformLocation = it->second;
+        }
+
+        for (size_t p=0; p<node.params.size(); p++) {
+            paramsSent |= setParam(*cache, node.params[p]);
+        }
+
+        if (node.transformDirty || viewChanged) {
+            updateTransform(node);
+        }
+        glUniformMatrix3fv(transformLocation, 1, GL_TRUE, node.transform);
+
+        switch (node.shape) {
+        case SHAPE_PATH:
+            if (node.strokeWidth > 0) {
+                drawStrokedPath(node.path, node.strokeWidth, node.pixelsPerUnit);
+            } else {
+                drawFilledPath(node.path, node.pixelsPerUnit);
+            }
+            break;
+        case SHAPE_RECT:
+            drawFilledSquare();
+            break;
+        case SHAPE_CIRCLE:
+            drawFilledCircle();
+            break;
+        }
+    }
+
+    if (program != previousProgram) {
+        useShader(previousProgram);
+    }
+    if (paramsSent) {
+        changeUniformEpoch();
+    }
+    m_uniformEpoch = uniformEpoch();
+}
+
+
+LUAEXPORT(Scene* newScene())
+{
+    return new Scene;
+}
+
+LUAEXPORT(void freeScene(Scene* scene))
+{
+    delete scene;
+}
+
+LUAEXPORT(int addSceneNode(Scene* scene))
+{
+    return scene->add();
+}
+
+LUAEXPORT(void removeSceneNode(Scene* scene, int node))
+{
+    scene->remove(node);
+}
+
+LUAEXPORT(void setSceneNodeShape(Scene* scene, int node, int shape, Path* path, float strokeWidth))
+{
+    Scene::Node* n = scene->node(node);
+    if (!n) return;
+    n->shape = shape;
+    n->path = path;
+    n->strokeWidth = shape == SHAPE_PATH ? strokeWidth : 0;
+}
+
+LUAEXPORT(void setSceneNodeTransform(Scene* scene, int node, float xscale, float yscale, float rotation, float x, float y))
+{
+    Scene::Node* n = scene->node(node);
+    if (!n) return;
+    n->scale[0] = xscale;
+    n->scale[1] = yscale;
+    n->rotation = rotation;
+    n->position[0] = x;
+    n->position[1] = y;
+    n->transformDirty = true;
+}
+
+// Also clears the node's parameters, which belong to the old shader
+LUAEXPORT(void setSceneNodeShader(Scene* scene, int node, unsigned int program))
+{
+    Scene::Node* n = scene->node(node);
+    if (!n) return;
+    n->program = program;
+    n->params.clear();
+}
+
+LUAEXPORT(void setSceneNodeParam(Scene* scene, int node, int location, int size, const float* value))
+{
+    Scene::Node* n = scene->node(node);
+    if (!n || location < 0 || size < 1 || size > 4) return;
+
+    Scene::Param param;
+    param.location = location;
+    param.size = size;
+    memcpy(param.value, value, size * sizeof(float));
+    for (size_t i=0; i<n->params.size(); i++) {
+        if (n->params[i].location == location) {
+            n->params[i] = param;
+            return;
+        }
+    }
+    n->params.push_back(param);
+}
+
+// view holds the window transform: x and y scale to device coordinates, the window
+// centre and the window's pixels per unit
+LUAEXPORT(void drawScene(Scene* scene, const float* view))
+{
+    scene->draw(view);
+}
@@ -0,0 +1,77 @@
+#ifndef SCENE_H
+#define SCENE_H
+#include <vector>
+#include <map>
+#include "common.h"
+
+class Path;
+
+// Objects registered once and drawn every frame by a single drawScene() call.
+// Nodes keep everything needed to draw them: shape, shader, parameter values and
+// the transform to device coordinates, which is only recomputed when the node or
+// the window transform changes. Parameters are only sent to GL when they differ
+// from what the program already has, as far as this scene knows. Setting them
+// changes uniformEpoch(), so other scenes sharing a program forget what it had.
+class Scene
+{
+public:
+    struct Param {
+        GLint location;
+        int size;
+        float value[4];
+    };
+
+    struct Node {
+        Node();
+
+        bool visible;
+        int shape;                  // a ShapeType
+        Path* path;
+        float strokeWidth;          // 0 to fill
+        GLuint program;
+        std::vector<Param> params;
+
+        float scale[2];
+        float rotation;
+        float position[2];
+        bool transformDirty;
+        float transform[9];         // row major, to device coordinates
+        float pixelsPerUnit;
+    };
+
+    Scene();
+
+    int add();
+    void remove(int node);
+    Node* node(int node);
+
+    void draw(const float* view);
+
+private:
+    struct ParamCache {
+        std::vector<float> values;      // 4 per location
+        std::vector<bool> valid;
+    };
+
+    void updateTransform(Node& node);
+    bool setParam(ParamCache& cache, const Param& param);
+
+    std::vector<Node> m_nodes;
+    std::vector<int> m_freeNodes;
+    float m_view[5];                // window transform the node transforms were made with
+    unsigned int m_uniformEpoch;
+    std::map<GLuint, ParamCache> m_paramCaches;
+    std::map<GLuint, GLint> m_transformLocations;
+};
+
+DLLEXPORT Scene* newScene();
+DLLEXPORT void freeScene(Scene* scene);
+DLLEXPORT int addSceneNode(Scene* scene);
+DLLEXPORT void removeSceneNode(Scene* scene, int node);
+DLLEXPORT void setSceneNodeShape(Scene* scene, int node, int shape, Path* path, float strokeWidth);
+DLLEXPORT void setSceneNodeTransform(Scene* scene, int node, float xscale, float yscale, float rotation, float x, float y);
+DLLEXPORT void setSceneNodeShader(Scene* scene, int node, unsigned int program);
+DLLEXPORT void setSceneNodeParam(Scene* scene, int node, int location, int size, const float* value);
+DLLEXPORT void drawScene(Scene* scene, const float* view);
+
+#endif // SCENE_H
@@ -0,0 +1,304 @@
+#include "sequence.h"
+#include "canvas.h"
+#include "shader.h"
+#include "frametiming.h"
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Draws a texture over the whole canvas. The unit square's texcoords run from -0.5
+// to 0.5, and a transform scaling it by 2 covers the canvas.
+static const char* kSequenceShaderSource =
+        "uniform sampler2D frame;\n"
+        "vec4 getcolor() { return texture2D(frame, texcoord + 0.5); }\n";
+
+static const float kFullCanvas[9] = { 2, 0, 0, 0, 2, 0, 0, 0, 1 };
+
+static GLuint gSequenceProgram;
+static GLint gSequenceTransformLocation;
+
+
+FrameSequence::FrameSequence(int frames, int width, int height, size_t gpuBytes)
+    : m_width(width)
+    , m_height(height)
+    , m_frameBytes((size_t)width * height * 4)
+    , m_gpuBytes(gpuBytes)
+    , m_textureFrames(0)
+    , m_textures(frames)
+    , m_stored(frames)
+    , m_store(0)
+    , m_storeSize(0)
+#ifdef _WIN32
+    , m_mapping(0)
+#endif
+{
+    m_uploadTextures[0] = m_uploadTextures[1] = 0;
+}
+
+FrameSequence::~FrameSequence()
+{
+    for (size_t i=0; i<m_textures.size(); i++) {
+        if (m_textures[i]) glDeleteTextures(1, &m_textures[i]);
+    }
+    if (m_uploadTextures[0]) {
+        glDeleteTextures(2, m_uploadTextures);
+    }
+#ifdef _WIN32
+    if (m_store) UnmapViewOfFile(m_store);
+    if (m_mapping) CloseHandle(m_mapping);
+#else
+    if (m_store) munmap(m_store, m_storeSize);
+#endif
+}
+
+FrameSequence* FrameSequence::create(int frames, size_t gpuBytes)
+{
+    if (frames < 1) {
+        std::cerr << "Error: a frame sequence needs at least one frame" << std::endl;
+        return 0;
+    }
+    int size[2];
+    canvasPixelSize(size);
+    if (size[0] <= 0 || size[1] <= 0) {
+        std::cerr << "Error: there's no canvas to draw a frame sequence on" << std::endl;
+        return 0;
+    }
+
+    if (!gSequenceProgram) {
+        GLuint previous = shaderInUse();
+        gSequenceProgram = addShader(kSequenceShaderSource);
+        useShader(previous);
+        if (!gSequenceProgram) return 0;
+        gSequenceTransformLocation = glGetUniformLocation(gSequenceProgram, "v_transform");
+    }
+
+    return new FrameSequence(frames, size[0], size[1], gpuBytes);
+}
+
+static GLuint createFrameTexture(int width, int height)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    return texture;
+}
+
+// Returns false once the budget is spent or the GPU is out of memory, after which
+// every remaining frame goes in the store
+bool FrameSequence::allocateTexture(int i)
+{
+    if (m_gpuBytes < m_frameBytes) return false;
+
+    while (glGetError() != GL_NO_ERROR) {}
+    GLuint texture = createFrameTexture(m_width, m_height);
+    if (glGetError() == GL_OUT_OF_MEMORY) {
+        glDeleteTextures(1, &texture);
+        m_gpuBytes = 0;
+        return false;
+    }
+
+    m_textures[i] = texture;
+    m_gpuBytes -= m_frameBytes;
+    m_textureFrames++;
+    return true;
+}
+
+// The store has room for every frame, but only the pages written to use memory
+bool FrameSequence::mapStore()
+{
+    if (m_store) return true;
+    m_storeSize = m_frameBytes * m_stored.size();
+
+#ifdef _WIN32
+    // Committed up front, since pages of a SEC_RESERVE section fault until each one
+    // is committed. This counts against the commit limit, but physical memory is
+    // still only used for the pages written to.
+    unsigned long long size = m_storeSize;
+    m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, 0, PAGE_READWRITE,
+                                   (DWORD)(size >> 32), (DWORD)size, 0);
+    if (m_mapping) {
+        m_store = (unsigned char*)MapViewOfFile(m_mapping, FILE_MAP_WRITE, 0, 0, 0);
+    }
+#else
+    // A file rather than anonymous memory, so the system can page frames out to
+    // disk without needing swap
+    const char* dir = getenv("TMPDIR");
+    std::string path = std::string(dir ? dir : "/tmp") + "/nexposequenceXXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd >= 0) {
+        unlink(path.c_str());
+        if (ftruncate(fd, (off_t)m_storeSize) == 0) {
+            void* data = mmap(0, m_storeSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            m_store = data == MAP_FAILED ? 0 : (unsigned char*)data;
+        }
+        // The mapping keeps the file open
+        close(fd);
+    }
+#endif
+
+    if (!m_store) {
+        std::cerr << "Error: couldn't map a store for frames that don't fit in GPU memory" << std::endl;
+        return false;
+    }
+
+    m_uploadTextures[0] = createFrameTexture(m_width, m_height);
+    m_uploadTextures[1] = createFrameTexture(m_width, m_height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return true;
+}
+
+bool FrameSequence::store(int i)
+{
+    if (i < 0 || i >= frameCount()) {
+        std::cerr << "Error: frame " << i << " is outside the sequence" << std::endl;
+        return false;
+    }
+    int size[2];
+    canvasPixelSize(size);
+    if (size[0] != m_width || size[1] != m_height) {
+        std::cerr << "Error: the canvas has changed size since the frame sequence was made" << std::endl;
+        return false;
+    }
+
+    if (!m_textures[i] && !allocateTexture(i) && !mapStore()) {
+        return false;
+    }
+
+    bindCanvasForReading();
+    if (m_textures[i]) {
+        glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+        glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, m_width, m_height);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    } else {
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glReadPixels(0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, m_store + i * m_frameBytes);
+    }
+    bindCanvasForDrawing();
+
+    clearCanvas();
+    m_stored[i] = true;
+    return true;
+}
+
+// Returns the texture to show frame i from, uploading it first if it's in the store
+GLuint FrameSequence::prepare(int i, int slot)
+{
+    if (m_textures[i]) return m_textures[i];
+
+    GLuint texture = m_uploadTextures[slot];
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, m_width, m_height, GL_RGBA, GL_UNSIGNED_BYTE, m_store + i * m_frameBytes);
+    return texture;
+}
+
+bool FrameSequence::play(int first, int count, SequenceReport* report)
+{
+    *report = SequenceReport();
+    if (first < 0 || count < 1 || first + count > frameCount()) {
+        std::cerr << "Error: frames " << first << " to " << first + count - 1 << " are outside the sequence" << std::endl;
+        return false;
+    }
+    for (int i=first; i<first+count; i++) {
+        if (!m_stored[i]) {
+            std::cerr << "Error: frame " << i << " of the sequence hasn't been drawn" << std::endl;
+            return false;
+        }
+    }
+
+    GLuint previousProgram = shaderInUse();
+    useShader(gSequenceProgram);
+    glUniformMatrix3fv(gSequenceTransformLocation, 1, GL_FALSE, kFullCanvas);
+    glActiveTexture(GL_TEXTURE0);
+
+    // Each frame from the store is uploaded while the one before it is waiting to
+    // be shown, into the texture that isn't being drawn from
+    report->firstFrame = ::frameCount();
+    GLuint texture = prepare(first, 0);
+    ScopedNestedFrames nested;
+    for (int i=0; i<count; i++) {
+        beginFrame();
+        glBindTexture(GL_TEXTURE_2D, texture);
+        drawFilledSquare();
+        endFrame();
+        swapBuffers();
+        report->shown++;
+
+        // Events are only queued, so polling runs no Lua, and timestamps them
+        // to within a frame
+        pollEvents();
+        if (shouldClose()) break;
+        if (i + 1 < count) {
+            texture = prepare(first + i + 1, (i + 1) % 2);
+        }
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    useShader(previousProgram);
+
+    // A frame that missed refreshes left the one before it up for too long. Only
+    // the most recent frames are recorded, so a very long sequence is only partly
+    // checked.
+    const FrameRecord* records = frameRecords();
+    unsigned int capacity = frameRecordCapacity();
+    unsigned int firstKept = std::max(report->firstFrame, firstRecordedFrame());
+    unsigned int last = report->firstFrame + report->shown - 1;
+    const FrameRecord& start = records[firstKept % capacity];
+    if (firstKept == report->firstFrame) {
+        report->late = start.missed;
+    }
+    report->onset = start.swapReturned;
+    report->duration = records[last % capacity].swapReturned - start.swapReturned;
+    for (unsigned int i=std::max(firstKept, report->firstFrame + 1); i<=last; i++) {
+        const FrameRecord& frame = records[i % capacity];
+        if (frame.missed > 0) {
+            report->repeated++;
+            report->missed += frame.missed;
+        }
+    }
+    return true;
+}
+
+
+// gpuMegabytes is how much GPU memory frames may take before the rest go in the
+// memory mapped store, which they also do if the GPU runs out first
+LUAEXPORT(FrameSequence* newSequence(int frames, double gpuMegabytes))
+{
+    return FrameSequence::create(frames, (size_t)std::max(0.0, gpuMegabytes * 1024 * 1024));
+}
+
+LUAEXPORT(void freeSequence(FrameSequence* sequence))
+{
+    delete sequence;
+}
+
+LUAEXPORT(int sequenceTextureFrames(FrameSequence* sequence))
+{
+    return sequence->textureFrames();
+}
+
+LUAEXPORT(bool storeSequenceFrame(FrameSequence* sequence, int i))
+{
+    return sequence->store(i);
+}
+
+// Takes over the canvas until the frames have been shown or the canvas is closed.
+// The report only counts refreshes missed with vertical sync on.
+LUAEXPORT(bool playSequence(FrameSequence* sequence, int first, int count, SequenceReport* report))
+{
+    return sequence->play(first, count, report);
+}
@@ -0,0 +1,71 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+#include "common.h"
+#include <vector>
+
+// Frames drawn ahead of time and played back one per refresh, for stimuli that take
+// too long to draw on the fly. Each frame is drawn on the canvas as usual and then
+// copied into a texture, or once the GPU memory budget is spent, into a memory
+// mapped store that's uploaded a frame ahead during playback. Playback runs
+// entirely in C, so nothing the script does can hold up a frame.
+//
+// SequenceReport is also declared in Nexpo.lua's ffi.cdef, so keep the two in sync.
+
+struct SequenceReport
+{
+    unsigned int shown;         // frames shown
+    unsigned int firstFrame;    // frame number (from frameCount()) of the first one
+    unsigned int late;          // refreshes the first frame missed
+    unsigned int repeated;      // frames left up for more than one refresh, not counting the last
+    unsigned int missed;        // extra refreshes those frames were left up for
+    double onset;               // when the first frame was shown, on the canvasTime() clock
+    double duration;            // from the first frame being shown to the last
+};
+
+class FrameSequence
+{
+public:
+    // Frames are the size of the canvas now. Returns null if there's no canvas.
+    static FrameSequence* create(int frames, size_t gpuBytes);
+    ~FrameSequence();
+
+    int frameCount() const { return (int)m_stored.size(); }
+    int textureFrames() const { return m_textureFrames; }
+
+    // Copies what's been drawn on the canvas into frame i and clears the canvas
+    bool store(int i);
+
+    // Shows frames first to first + count - 1, one per swap, and reports their timing
+    bool play(int first, int count, SequenceReport* report);
+
+private:
+    FrameSequence(int frames, int width, int height, size_t gpuBytes);
+
+    bool allocateTexture(int i);
+    bool mapStore();
+    GLuint prepare(int i, int slot);
+
+    int m_width;
+    int m_height;
+    size_t m_frameBytes;
+    size_t m_gpuBytes;                  // budget left for frame textures
+    int m_textureFrames;
+    std::vector<GLuint> m_textures;     // 0 for frames in the store
+    std::vector<bool> m_stored;
+
+    // Frame i is at i * m_frameBytes. Pages are only backed once they're written.
+    unsigned char* m_store;
+    size_t m_storeSize;
+    GLuint m_uploadTextures[2];         // frames from the store alternate between these
+#ifdef _WIN32
+    void* m_mapping;
+#endif
+};
+
+DLLEXPORT FrameSequence* newSequence(int frames, double gpuMegabytes);
+DLLEXPORT void freeSequence(FrameSequence* sequence);
+DLLEXPORT int sequenceTextureFrames(FrameSequence* sequence);
+DLLEXPORT bool storeSequenceFrame(FrameSequence* sequence, int i);
+DLLEXPORT bool playSequence(FrameSequence* sequence, int first, int count, SequenceReport* report);
+
+#endif // SEQUENCE_H
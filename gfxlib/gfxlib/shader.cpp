@@ -3,21 +3,61 @@
 #include <assert.h>
 #include <iostream>
 #include <string.h> // strncpy
+#include <ctype.h>
+#include <map>
 
 static const char* vertexShaderSource =
         "uniform mat3 v_transform;"
+        "uniform float v_strokewidth;"
 
         "attribute vec2 a_position;"
+        "attribute vec2 a_extrude;"
 
         "varying vec2 position;"
         "varying vec2 texcoord;"
 
         "void main() {"
-            "texcoord = a_position;"
-            "vec3 position = v_transform * vec3(a_position, 1.0);"
+            "vec2 p = a_position + a_extrude * v_strokewidth;"
+            "texcoord = p;"
+            "vec3 position = v_transform * vec3(p, 1.0);"
             "gl_Position = vec4(position.x, position.y, 0.5, position.z);"
         "}";
 
+// Vertex shader for batch programs, see batchProgram(). Each object's transform to
+// device coordinates arrives as two attribute rows, and its own value of one shader
+// parameter as a_param, passed on to the fragment shader through BATCH_VARYING.
+// With PRETRANSFORMED, positions are already in device coordinates and the
+// untransformed positions come in a_texcoord.
+static const char* batchVertexShaderSource =
+        "uniform float v_strokewidth;\n"
+
+        "attribute vec2 a_position;\n"
+        "attribute vec2 a_extrude;\n"
+        "attribute vec3 a_transform0;\n"
+        "attribute vec3 a_transform1;\n"
+        "attribute vec4 a_param;\n"
+        "attribute vec2 a_texcoord;\n"
+
+        "varying vec2 position;\n"
+        "varying vec2 texcoord;\n"
+        "#ifdef BATCH_VARYING\n"
+        "varying BATCH_TYPE BATCH_VARYING;\n"
+        "#endif\n"
+
+        "void main() {\n"
+            "#ifdef BATCH_VARYING\n"
+            "BATCH_VARYING = BATCH_TYPE(a_param);\n"
+            "#endif\n"
+            "#ifdef PRETRANSFORMED\n"
+            "texcoord = a_texcoord;\n"
+            "gl_Position = vec4(a_position, 0.5, 1.0);\n"
+            "#else\n"
+            "vec3 p = vec3(a_position + a_extrude * v_strokewidth, 1.0);\n"
+            "texcoord = p.xy;\n"
+            "gl_Position = vec4(dot(a_transform0, p), dot(a_transform1, p), 0.5, 1.0);\n"
+            "#endif\n"
+        "}\n";
+
 static const char* fragmentShaderBegin =
         "varying vec2 position;\n"
         "varying vec2 texcoord;\n";
@@ -27,6 +67,17 @@ static const char* fragmentShaderEnd =
         "   gl_FragColor = getcolor();\n"
         "}";
 
+// Location of v_strokewidth in each program, and the program in use
+static std::map<GLuint, GLint> gStrokeWidthLocations;
+static GLuint gCurrentProgram;
+
+// Incremented whenever a parameter is set from Lua or a scene, see uniformEpoch()
+static unsigned int gUniformEpoch;
+
+// Fragment source each program was made from, and the batch variants made from it
+static std::map<GLuint, std::string> gFragmentSources;
+static std::map<std::string, BatchProgram> gBatchPrograms;
+
 static const char* enumString(GLenum e)
 {
     switch(e) {
@@ -71,6 +122,15 @@ static GLuint createAndLinkProgram(GLuint vert, GLuint frag) {
     GLint program = glCreateProgram();
     glAttachShader(program, vert);
     glAttachShader(program, frag);
+
+    // Bind vertex attribs, these only take effect when linking
+    glBindAttribLocation(program, 0, "a_position");
+    glBindAttribLocation(program, 1, "a_extrude");
+    glBindAttribLocation(program, 2, "a_transform0");
+    glBindAttribLocation(program, 3, "a_transform1");
+    glBindAttribLocation(program, 4, "a_param");
+    glBindAttribLocation(program, 5, "a_texcoord");
+
     glLinkProgram(program);
 
     // Report linking error if any
@@ -84,8 +144,7 @@ static GLuint createAndLinkProgram(GLuint vert, GLuint frag) {
         return 0;
     }
 
-    // Bind position attrib
-    glBindAttribLocation(program, 0, "a_position");
+    gStrokeWidthLocations[program] = glGetUniformLocation(program, "v_strokewidth");
 
     return program;
 }
@@ -93,6 +152,30 @@ static GLuint createAndLinkProgram(GLuint vert, GLuint frag) {
 LUAEXPORT(void useShader(unsigned int i))
 {
     glUseProgram(i);
+    gCurrentProgram = i;
+}
+
+GLuint shaderInUse()
+{
+    return gCurrentProgram;
+}
+
+unsigned int uniformEpoch()
+{
+    return gUniformEpoch;
+}
+
+void changeUniformEpoch()
+{
+    gUniformEpoch++;
+}
+
+void setStrokeWidth(float width)
+{
+    std::map<GLuint, GLint>::const_iterator it = gStrokeWidthLocations.find(gCurrentProgram);
+    if (it != gStrokeWidthLocations.end() && it->second >= 0) {
+        glUniform1f(it->second, width);
+    }
 }
 
 LUAEXPORT(unsigned int addShader(const char *src))
@@ -116,6 +199,7 @@ LUAEXPORT(unsigned int addShader(const char *src))
     if (program != 0) {
         useShader(program);
         glEnableVertexAttribArray(0);
+        gFragmentSources[program] = src;
     }
 
     // No longer need the shaders
@@ -128,24 +212,36 @@ LUAEXPORT(unsigned int addShader(const char *src))
 LUAEXPORT(void setShaderParameter1(int loc, float x))
 {
     glUniform1f(loc, x);
+    gUniformEpoch++;
 }
 
 LUAEXPORT(void setShaderParameter2(int loc, float x, float y))
 {
     glUniform2f(loc, x, y);
+    gUniformEpoch++;
 }
 
 LUAEXPORT(void setShaderParameter3(int loc, float x, float y, float z))
 {
     glUniform3f(loc, x, y, z);
+    gUniformEpoch++;
 }
 
 LUAEXPORT(void setShaderParameter4(int loc, float x, float y, float z, float w))
 {
     glUniform4f(loc, x, y, z, w);
+    gUniformEpoch++;
 }
 
 LUAEXPORT(void setShaderParameter3x3(int loc, float* value))
+{
+    glUniformMatrix3fv(loc, 1, GL_TRUE, value);
+    gUniformEpoch++;
+}
+
+// Sets v_transform. Scenes set it for every node they draw, so unlike the other
+// parameters it doesn't change the epoch, which would clear their caches every frame.
+LUAEXPORT(void setShaderTransform(int loc, float* value))
 {
     glUniformMatrix3fv(loc, 1, GL_TRUE, value);
 }
@@ -164,3 +260,200 @@ LUAEXPORT(bool getShaderParameterNameAndType(int program, int varindex, char* na
     strncpy(stype, enumString(type), buflen);
     return true;
 }
+
+
+static bool isIdentifierChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Reads the identifier at src[i], skipping whitespace and comments before it
+static std::string nextToken(const std::string& src, size_t& i)
+{
+    for (;;) {
+        while (i < src.size() && isspace((unsigned char)src[i])) i++;
+        if (src.compare(i, 2, "//") == 0) {
+            i = src.find('\n', i);
+            if (i == std::string::npos) i = src.size();
+        } else if (src.compare(i, 2, "/*") == 0) {
+            i = src.find("*/", i);
+            i = i == std::string::npos ? src.size() : i + 2;
+        } else {
+            break;
+        }
+    }
+
+    size_t start = i;
+    if (i < src.size() && !isIdentifierChar(src[i])) return std::string(1, src[i++]);
+    while (i < src.size() && isIdentifierChar(src[i])) i++;
+    return src.substr(start, i - start);
+}
+
+// Blanks out the declaration "uniform <type> <name>;" from src, returning the type,
+// or an empty string if there's no such declaration
+static std::string removeUniform(std::string& src, const std::string& name)
+{
+    size_t i = 0;
+    while (i < src.size()) {
+        size_t start = i;
+        std::string token = nextToken(src, i);
+        if (token != "uniform") continue;
+        start = i - token.size();
+
+        std::string type = nextToken(src, i);
+        if (nextToken(src, i) == name && nextToken(src, i) == ";") {
+            src.replace(start, i - start, i - start, ' ');
+            return type;
+        }
+    }
+    return std::string();
+}
+
+// Copies a parameter's value from one program to another, returning false for types
+// it doesn't know how to copy
+static bool copyUniform(GLuint from, GLint fromLocation, GLint to, GLenum type)
+{
+    GLfloat value[16];
+    GLint ivalue[4];
+    switch (type) {
+    case GL_FLOAT:
+    case GL_FLOAT_VEC2:
+    case GL_FLOAT_VEC3:
+    case GL_FLOAT_VEC4:
+    case GL_FLOAT_MAT2:
+    case GL_FLOAT_MAT3:
+    case GL_FLOAT_MAT4:
+        glGetUniformfv(from, fromLocation, value);
+        break;
+    case GL_INT:
+    case GL_INT_VEC2:
+    case GL_INT_VEC3:
+    case GL_INT_VEC4:
+    case GL_BOOL:
+    case GL_BOOL_VEC2:
+    case GL_BOOL_VEC3:
+    case GL_BOOL_VEC4:
+    case GL_SAMPLER_1D:
+    case GL_SAMPLER_2D:
+    case GL_SAMPLER_3D:
+    case GL_SAMPLER_CUBE:
+    case GL_SAMPLER_1D_SHADOW:
+    case GL_SAMPLER_2D_SHADOW:
+        glGetUniformiv(from, fromLocation, ivalue);
+        break;
+    default:
+        return false;
+    }
+
+    switch (type) {
+    case GL_FLOAT: glUniform1fv(to, 1, value); break;
+    case GL_FLOAT_VEC2: glUniform2fv(to, 1, value); break;
+    case GL_FLOAT_VEC3: glUniform3fv(to, 1, value); break;
+    case GL_FLOAT_VEC4: glUniform4fv(to, 1, value); break;
+    case GL_FLOAT_MAT2: glUniformMatrix2fv(to, 1, GL_FALSE, value); break;
+    case GL_FLOAT_MAT3: glUniformMatrix3fv(to, 1, GL_FALSE, value); break;
+    case GL_FLOAT_MAT4: glUniformMatrix4fv(to, 1, GL_FALSE, value); break;
+    case GL_INT_VEC2: case GL_BOOL_VEC2: glUniform2iv(to, 1, ivalue); break;
+    case GL_INT_VEC3: case GL_BOOL_VEC3: glUniform3iv(to, 1, ivalue); break;
+    case GL_INT_VEC4: case GL_BOOL_VEC4: glUniform4iv(to, 1, ivalue); break;
+    default: glUniform1iv(to, 1, ivalue); break;     // ints, bools and samplers
+    }
+    return true;
+}
+
+// Variant of a program for drawing a batch of objects in one go. Each object's
+// transform, and its own value of the parameter named param (if not null), come from
+// vertex attributes; the rest of the parameters are copied from the original program
+// by useBatchProgram(). Returns null if the variant can't be made, say if the shader
+// has no float or vector parameter called param, or has parameters that can't be
+// copied, such as arrays.
+static BatchProgram* batchProgram(GLuint program, const char* param, bool pretransformed)
+{
+    std::string key = std::to_string(program) + (pretransformed ? "p " : " ") + (param ? param : "");
+    std::map<std::string, BatchProgram>::iterator it = gBatchPrograms.find(key);
+    if (it != gBatchPrograms.end()) {
+        return it->second.program ? &it->second : 0;
+    }
+
+    // Failures are remembered too, so they're only reported once
+    BatchProgram& batch = gBatchPrograms[key];
+    batch.program = 0;
+    batch.paramSize = 0;
+
+    std::map<GLuint, std::string>::const_iterator src = gFragmentSources.find(program);
+    if (src == gFragmentSources.end()) return 0;
+
+    std::string fragSource = src->second;
+    std::string defines = pretransformed ? "#define PRETRANSFORMED\n" : "";
+    if (param) {
+        std::string type = removeUniform(fragSource, param);
+        batch.paramSize = type == "float" ? 1 : type == "vec2" ? 2 : type == "vec3" ? 3 : type == "vec4" ? 4 : 0;
+        if (batch.paramSize == 0) {
+            std::cerr << "Error: can't batch shader parameter " << param << ", it must be declared on its own as a uniform float or vector" << std::endl;
+            return 0;
+        }
+        fragSource = "varying " + type + " " + param + ";\n" + fragSource;
+        defines += "#define BATCH_VARYING " + std::string(param) + "\n#define BATCH_TYPE " + type + "\n";
+    }
+
+    GLuint frag = compileShader(fragmentShaderBegin + fragSource + fragmentShaderEnd, GL_FRAGMENT_SHADER);
+    GLuint vert = compileShader(defines + batchVertexShaderSource, GL_VERTEX_SHADER);
+    if (frag != 0 && vert != 0) {
+        batch.program = createAndLinkProgram(vert, frag);
+    }
+    if (frag != 0) glDeleteShader(frag);
+    if (vert != 0) glDeleteShader(vert);
+    if (batch.program == 0) return 0;
+
+    batch.strokeWidthLocation = gStrokeWidthLocations[batch.program];
+
+    // Match up the parameters the two programs share
+    GLint count = 0;
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+    for (GLint i=0; i<count; i++) {
+        char name[256];
+        GLint size = 0;
+        GLenum type = 0;
+        glGetActiveUniform(program, i, sizeof(name), 0, &size, &type, name);
+        if (strcmp(name, "v_transform") == 0 || strcmp(name, "v_strokewidth") == 0) continue;
+
+        BatchProgram::Uniform u;
+        u.from = glGetUniformLocation(program, name);
+        u.to = glGetUniformLocation(batch.program, name);
+        u.type = type;
+        if (u.from < 0 || u.to < 0) continue;
+
+        // Checked by copying it now, which useBatchProgram() does again before each batch
+        glUseProgram(batch.program);
+        bool copied = size == 1 && copyUniform(program, u.from, u.to, type);
+        glUseProgram(gCurrentProgram);
+        if (!copied) {
+            std::cerr << "Error: can't batch a shader with parameter " << name << ", only single values can be copied to the batch shader" << std::endl;
+            glDeleteProgram(batch.program);
+            batch.program = 0;
+            return 0;
+        }
+        batch.uniforms.push_back(u);
+    }
+
+    return &batch;
+}
+
+const BatchProgram* useBatchProgram(const char* param, bool pretransformed)
+{
+    GLuint program = gCurrentProgram;
+    BatchProgram* batch = batchProgram(program, param, pretransformed);
+    if (!batch) return 0;
+
+    glUseProgram(batch->program);
+    for (size_t i=0; i<batch->uniforms.size(); i++) {
+        const BatchProgram::Uniform& u = batch->uniforms[i];
+        copyUniform(program, u.from, u.to, u.type);
+    }
+    return batch;
+}
+
+void endBatchProgram()
+{
+    glUseProgram(gCurrentProgram);
+}
@@ -1,5 +1,46 @@
 #ifndef SHADER_H
 #define SHADER_H
+#include <vector>
+#include "common.h"
+
+DLLEXPORT void useShader(unsigned int i);
+DLLEXPORT unsigned int addShader(const char* src);
+GLuint shaderInUse();
+
+// Changes whenever a shader parameter other than the transform is set through the
+// Lua API, or by a scene, so code that remembers the values it set knows when they
+// may have been overwritten. Code that sets parameters itself calls
+// changeUniformEpoch() after.
+unsigned int uniformEpoch();
+void changeUniformEpoch();
+
+// Sets the stroke width uniform of the shader in use. Stroke meshes are
+// extruded by this amount in the vertex shader.
+void setStrokeWidth(float width);
+
+// Variant of a shader program for drawBatch()
+struct BatchProgram
+{
+    struct Uniform {
+        GLint from;         // location in the original program
+        GLint to;           // location in this one
+        GLenum type;
+    };
+
+    GLuint program;
+    GLint strokeWidthLocation;
+    int paramSize;                  // components of the per-object parameter, 0 if there isn't one
+    std::vector<Uniform> uniforms;  // copied from the original program on use
+};
+
+// Switches to the batch variant of the shader in use, with param taken from vertex
+// attribute 4 instead of a uniform. Transforms come from attributes 2 and 3, or with
+// pretransformed, positions are in device coordinates and the untransformed positions
+// are in attribute 5. Returns null if the shader can't be batched like that.
+const BatchProgram* useBatchProgram(const char* param, bool pretransformed);
+
+// Switches back to the shader in use before useBatchProgram()
+void endBatchProgram();
 
 
 #endif // SHADER_H
@@ -0,0 +1,296 @@
+#include "stroke.h"
+#include "path.h"
+#include "tessellator.h"
+
+// MSVC doesn't define M_PI unless you do this
+#ifdef _MSC_VER
+#define _USE_MATH_DEFINES
+#endif
+#include <math.h>
+
+// Joins flatter than this (cos of the turn angle, about 8 degrees) always use a
+// miter. Flattened curves are made of many such joins, and a round or bevel join
+// there would add geometry without any visible difference.
+static const float kSmoothJoinCos = 0.99f;
+
+// Angle covered by each triangle of a round join or cap
+static const float kRoundStep = (float)M_PI / 8;
+
+static inline vec2 perpendicular(const vec2& v)
+{
+    return vec2(-v.y, v.x);
+}
+
+static inline float cross(const vec2& a, const vec2& b)
+{
+    return a.x * b.y - a.y * b.x;
+}
+
+class StrokeBuilder
+{
+public:
+    StrokeBuilder(Mesh* mesh)
+        : m_mesh(mesh)
+    {
+    }
+
+    unsigned int vertex(const vec2& p, const vec2& extrusion) {
+        m_mesh->vertices.push_back(p);
+        m_mesh->extrusions.push_back(extrusion);
+        return (unsigned int)m_mesh->vertices.size() - 1;
+    }
+
+    void triangle(unsigned int a, unsigned int b, unsigned int c) {
+        m_mesh->indices.push_back(a);
+        m_mesh->indices.push_back(b);
+        m_mesh->indices.push_back(c);
+    }
+
+    void quad(unsigned int l0, unsigned int r0, unsigned int l1, unsigned int r1) {
+        triangle(l0, r0, l1);
+        triangle(l1, r0, r1);
+    }
+
+    // Triangle fan around p, sweeping the extrusion from e0 to e1 through angle
+    void arc(const vec2& p, unsigned int center, unsigned int first, const vec2& e0, float angle, unsigned int last) {
+        int steps = (int)ceilf(fabsf(angle) / kRoundStep);
+        unsigned int prev = first;
+        for (int i=1; i<steps; i++) {
+            float a = angle * i / steps;
+            float c = cosf(a);
+            float s = sinf(a);
+            unsigned int next = vertex(p, vec2(e0.x * c - e0.y * s, e0.x * s + e0.y * c));
+            triangle(center, prev, next);
+            prev = next;
+        }
+        triangle(center, prev, last);
+    }
+
+private:
+    Mesh* m_mesh;
+};
+
+// Vertex pairs (left and right of the contour) at the two sides of a join
+struct JoinEnds
+{
+    unsigned int inLeft, inRight;       // end of the incoming segment
+    unsigned int outLeft, outRight;     // start of the outgoing segment
+};
+
+static JoinEnds addJoin(StrokeBuilder& b, const StrokeStyle& style, const vec2& p,
+                        const vec2& d0, const vec2& n0, const vec2& d1, const vec2& n1)
+{
+    JoinEnds ends;
+    float cosTurn = glm::dot(n0, n1);
+
+    // Miter vector: bisects the two normals and reaches the outline corner
+    if (cosTurn > -0.999f) {
+        vec2 miter = (n0 + n1) / (1 + cosTurn);
+        bool withinLimit = glm::dot(miter, miter) <= style.miterLimit * style.miterLimit;
+        if (cosTurn > kSmoothJoinCos || (style.join == JOIN_MITER && withinLimit)) {
+            ends.inLeft = ends.outLeft = b.vertex(p, miter);
+            ends.inRight = ends.outRight = b.vertex(p, -miter);
+            return ends;
+        }
+    }
+
+    // Separate ends for each segment, overlapping on the inside of the turn,
+    // with the gap on the outside filled by a bevel or round wedge
+    ends.inLeft = b.vertex(p, n0);
+    ends.inRight = b.vertex(p, -n0);
+    ends.outLeft = b.vertex(p, n1);
+    ends.outRight = b.vertex(p, -n1);
+    unsigned int center = b.vertex(p, vec2(0, 0));
+
+    // Turning left leaves the gap on the right, and vice versa
+    bool leftTurn = cross(d0, d1) > 0;
+    unsigned int from = leftTurn ? ends.inRight : ends.inLeft;
+    unsigned int to = leftTurn ? ends.outRight : ends.outLeft;
+
+    if (style.join == JOIN_ROUND) {
+        vec2 e0 = leftTurn ? -n0 : n0;
+        float angle = acosf(glm::clamp(cosTurn, -1.0f, 1.0f));
+        b.arc(p, center, from, e0, leftTurn ? angle : -angle, to);
+    } else {
+        // Bevel, and miters over the limit
+        b.triangle(center, from, to);
+    }
+
+    return ends;
+}
+
+// Adds the cap at an open end and returns its left and right vertices.
+// dir points out of the stroke, n is the segment's left normal.
+static void addCap(StrokeBuilder& b, const StrokeStyle& style, const vec2& p, const vec2& dir, const vec2& n,
+                   unsigned int& left, unsigned int& right)
+{
+    if (style.cap == CAP_SQUARE) {
+        left = b.vertex(p, n + dir);
+        right = b.vertex(p, -n + dir);
+        return;
+    }
+
+    left = b.vertex(p, n);
+    right = b.vertex(p, -n);
+
+    if (style.cap == CAP_ROUND) {
+        // Half circle from the left side, around the outward direction, to the right side
+        unsigned int center = b.vertex(p, vec2(0, 0));
+        bool leftToOutIsCW = cross(n, dir) < 0;
+        b.arc(p, center, left, n, leftToOutIsCW ? -(float)M_PI : (float)M_PI, right);
+    }
+}
+
+// Strokes a complete closed contour of n unique points
+static void strokeClosedContour(StrokeBuilder& b, const StrokeStyle& style, const vec2* pts, size_t n,
+                                std::vector<vec2>& dirs)
+{
+    dirs.resize(n);
+    for (size_t i=0; i<n; i++) {
+        dirs[i] = glm::normalize(pts[(i + 1) % n] - pts[i]);
+    }
+
+    // The join at the first point connects the closing segment to the first one
+    JoinEnds first = addJoin(b, style, pts[0], dirs[n-1], perpendicular(dirs[n-1]), dirs[0], perpendicular(dirs[0]));
+    unsigned int prevLeft = first.outLeft;
+    unsigned int prevRight = first.outRight;
+
+    for (size_t i=1; i<n; i++) {
+        JoinEnds ends = addJoin(b, style, pts[i], dirs[i-1], perpendicular(dirs[i-1]), dirs[i], perpendicular(dirs[i]));
+        b.quad(prevLeft, prevRight, ends.inLeft, ends.inRight);
+        prevLeft = ends.outLeft;
+        prevRight = ends.outRight;
+    }
+
+    b.quad(prevLeft, prevRight, first.inLeft, first.inRight);
+}
+
+Stroker::Stroker()
+    : m_contour(0)
+    , m_point(0)
+    , m_contourVertices(0)
+    , m_contourIndices(0)
+    , m_capVertices(0)
+    , m_capIndices(0)
+    , m_uniquePoints(0)
+    , m_lastLeft(0)
+    , m_lastRight(0)
+{
+}
+
+static void truncateMesh(Mesh* mesh, size_t vertices, size_t indices)
+{
+    mesh->vertices.resize(vertices);
+    mesh->extrusions.resize(vertices);
+    mesh->indices.resize(indices);
+}
+
+void Stroker::reset(Mesh* mesh)
+{
+    truncateMesh(mesh, 0, 0);
+    m_contour = 0;
+    beginContour(mesh);
+}
+
+void Stroker::beginContour(Mesh* mesh)
+{
+    m_point = 0;
+    m_uniquePoints = 0;
+    m_contourVertices = m_capVertices = mesh->vertices.size();
+    m_contourIndices = m_capIndices = mesh->indices.size();
+}
+
+// Extends the open contour to p. The stroke always stops one segment short of
+// the last point, where the end cap goes.
+void Stroker::addPoint(StrokeBuilder& b, const StrokeStyle& style, const vec2& p)
+{
+    // Zero length segments have no direction
+    if (m_uniquePoints > 0 && p == m_last) return;
+
+    if (m_uniquePoints == 0) {
+        m_first = p;
+    } else {
+        vec2 dir = glm::normalize(p - m_last);
+        if (m_uniquePoints == 1) {
+            addCap(b, style, m_first, -dir, perpendicular(dir), m_lastLeft, m_lastRight);
+        } else {
+            JoinEnds ends = addJoin(b, style, m_last, m_lastDir, perpendicular(m_lastDir), dir, perpendicular(dir));
+            b.quad(m_lastLeft, m_lastRight, ends.inLeft, ends.inRight);
+            m_lastLeft = ends.outLeft;
+            m_lastRight = ends.outRight;
+        }
+        m_lastDir = dir;
+    }
+
+    m_last = p;
+    m_uniquePoints++;
+}
+
+void Stroker::addEndCap(StrokeBuilder& b, const StrokeStyle& style)
+{
+    if (m_uniquePoints < 2) return;
+
+    unsigned int left, right;
+    addCap(b, style, m_last, m_lastDir, perpendicular(m_lastDir), left, right);
+    b.quad(m_lastLeft, m_lastRight, left, right);
+}
+
+bool Stroker::update(const Contours& contours, const StrokeStyle& style, Mesh* mesh)
+{
+    // Nothing new unless the contour being stroked has grown or been closed, or
+    // there are more after it
+    if (m_contour >= contours.count()) return false;
+    if (m_contour + 1 == contours.count() && !contours.isClosed(m_contour)
+            && m_point == contours.contourSize(m_contour)) {
+        return false;
+    }
+
+    // The open contour may carry on, so its end cap has to go
+    truncateMesh(mesh, m_capVertices, m_capIndices);
+
+    StrokeBuilder builder(mesh);
+    std::vector<vec2> points;
+    std::vector<vec2> dirs;
+
+    while (m_contour < contours.count()) {
+        const vec2* contour = contours.contour(m_contour);
+        size_t size = contours.contourSize(m_contour);
+
+        if (contours.isClosed(m_contour)) {
+            // Closing replaces the start cap with a join, so stroke the whole
+            // contour again. A closed contour never changes after that.
+            truncateMesh(mesh, m_contourVertices, m_contourIndices);
+
+            points.clear();
+            for (size_t i=0; i<size; i++) {
+                if (points.empty() || contour[i] != points.back()) {
+                    points.push_back(contour[i]);
+                }
+            }
+            if (points.size() > 1 && points.back() == points.front()) {
+                points.pop_back();
+            }
+            if (points.size() >= 3) {
+                strokeClosedContour(builder, style, points.data(), points.size(), dirs);
+            }
+        } else {
+            for (; m_point < size; m_point++) {
+                addPoint(builder, style, contour[m_point]);
+            }
+
+            // Only the last contour can still grow
+            if (m_contour + 1 == contours.count()) break;
+            addEndCap(builder, style);
+        }
+
+        m_contour++;
+        beginContour(mesh);
+    }
+
+    m_capVertices = mesh->vertices.size();
+    m_capIndices = mesh->indices.size();
+    if (m_contour < contours.count()) {
+        addEndCap(builder, style);
+    }
+    return true;
+}
@@ -0,0 +1,81 @@
+#ifndef STROKE_H
+#define STROKE_H
+#include "common.h"
+
+struct Mesh;
+struct Contours;
+class StrokeBuilder;
+
+enum StrokeJoin {
+    JOIN_MITER,
+    JOIN_ROUND,
+    JOIN_BEVEL,
+};
+
+enum StrokeCap {
+    CAP_BUTT,
+    CAP_ROUND,
+    CAP_SQUARE,
+};
+
+struct StrokeStyle
+{
+    StrokeStyle()
+        : join(JOIN_MITER)
+        , cap(CAP_BUTT)
+        , miterLimit(4)
+    {
+    }
+
+    bool operator==(const StrokeStyle& o) const {
+        return join == o.join && cap == o.cap && miterLimit == o.miterLimit;
+    }
+
+    StrokeJoin join;
+    StrokeCap cap;
+    float miterLimit;       // longest miter allowed, in stroke widths, before falling back to bevel
+};
+
+// Builds a stroke mesh whose geometry doesn't depend on the stroke width.
+// Each vertex is a point on the contour plus an extrusion vector in
+// mesh->extrusions, scaled for a stroke width of 1. The vertex shader adds
+// extrusion * v_strokewidth, so the width can change freely without rebuilding.
+//
+// The stroker remembers how far it got, so when points are appended to the
+// contours only the new segments are stroked. The end cap of the last contour
+// is the only geometry that gets replaced.
+class Stroker
+{
+public:
+    Stroker();
+
+    // Strokes whatever has been added to contours since the last update. Between
+    // resets, contours may only grow: points appended to the last contour, the
+    // last contour closed, or new contours added. Returns true if the mesh changed.
+    bool update(const Contours& contours, const StrokeStyle& style, Mesh* mesh);
+
+    // Forget the stroked geometry, the next update starts again from scratch
+    void reset(Mesh* mesh);
+
+private:
+    void beginContour(Mesh* mesh);
+    void addPoint(StrokeBuilder& b, const StrokeStyle& style, const vec2& p);
+    void addEndCap(StrokeBuilder& b, const StrokeStyle& style);
+
+    size_t m_contour;           // contour being stroked
+    size_t m_point;             // points of it stroked so far
+    size_t m_contourVertices;   // mesh size where the contour starts
+    size_t m_contourIndices;
+    size_t m_capVertices;       // mesh size where the last end cap starts
+    size_t m_capIndices;
+
+    // Open end of the contour being stroked
+    size_t m_uniquePoints;
+    vec2 m_first;
+    vec2 m_last;
+    vec2 m_lastDir;
+    unsigned int m_lastLeft;
+    unsigned int m_lastRight;
+};
+
+#endif // STROKE_H
@@ -0,0 +1,435 @@
+#include "tessellator.h"
+#include "path.h"
+#include "tesselator.h"
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+
+// Allocations are aligned to 16 bytes and prefixed with their size so realloc knows how much to copy
+static const size_t kArenaAlign = 16;
+static const size_t kArenaHeader = 16;
+static const size_t kArenaBlockHeader = 16;
+static const size_t kArenaInitialSize = 256 * 1024;
+
+static size_t alignArena(size_t size)
+{
+    return (size + kArenaAlign - 1) & ~(kArenaAlign - 1);
+}
+
+static unsigned char* blockData(void* block)
+{
+    return (unsigned char*)block + kArenaBlockHeader;
+}
+
+TessArena::TessArena()
+    : m_blocks(0)
+    , m_used(0)
+    , m_totalSize(0)
+    , m_last(0)
+{
+}
+
+TessArena::~TessArena()
+{
+    while (m_blocks) {
+        Block* next = m_blocks->next;
+        free(m_blocks);
+        m_blocks = next;
+    }
+}
+
+void* TessArena::alloc(size_t size)
+{
+    size_t needed = kArenaHeader + alignArena(size);
+
+    if (!m_blocks || m_used + needed > m_blocks->size) {
+        size_t blockSize = m_blocks ? m_blocks->size * 2 : kArenaInitialSize;
+        while (blockSize < needed) blockSize *= 2;
+
+        Block* block = (Block*)malloc(kArenaBlockHeader + blockSize);
+        if (!block) return 0;
+        block->next = m_blocks;
+        block->size = blockSize;
+        m_blocks = block;
+        m_used = 0;
+        m_totalSize += blockSize;
+    }
+
+    unsigned char* p = blockData(m_blocks) + m_used;
+    *(size_t*)p = size;
+    m_used += needed;
+    m_last = p + kArenaHeader;
+    return m_last;
+}
+
+void* TessArena::realloc(void* ptr, size_t size)
+{
+    if (!ptr) return alloc(size);
+
+    size_t* header = (size_t*)((unsigned char*)ptr - kArenaHeader);
+    size_t oldSize = *header;
+
+    // Grow in place if this was the last allocation and the block has room
+    if (ptr == m_last) {
+        size_t start = (unsigned char*)header - blockData(m_blocks);
+        size_t needed = kArenaHeader + alignArena(size);
+        if (start + needed <= m_blocks->size) {
+            *header = size;
+            m_used = start + needed;
+            return ptr;
+        }
+    }
+
+    void* p = alloc(size);
+    if (p) memcpy(p, ptr, oldSize < size ? oldSize : size);
+    return p;
+}
+
+void TessArena::reset()
+{
+    // If the last run overflowed into several blocks, replace them with one
+    // block big enough for all of them so the next run fits without growing
+    if (m_blocks && m_blocks->next) {
+        size_t total = m_totalSize;
+        while (m_blocks) {
+            Block* next = m_blocks->next;
+            free(m_blocks);
+            m_blocks = next;
+        }
+        m_totalSize = 0;
+        m_blocks = (Block*)malloc(kArenaBlockHeader + total);
+        if (m_blocks) {
+            m_blocks->next = 0;
+            m_blocks->size = total;
+            m_totalSize = total;
+        }
+    }
+
+    m_used = 0;
+    m_last = 0;
+}
+
+static void* arenaAlloc(void* userData, unsigned int size)
+{
+    return ((TessArena*)userData)->alloc(size);
+}
+
+static void* arenaRealloc(void* userData, void* ptr, unsigned int size)
+{
+    return ((TessArena*)userData)->realloc(ptr, size);
+}
+
+static void arenaFree(void*, void*)
+{
+    // Released in bulk by TessArena::reset()
+}
+
+static int bucketSize(size_t n)
+{
+    if (n < 16) return 16;
+    if (n > 4096) return 4096;
+    return (int)n;
+}
+
+// Paths with a single convex or simple (not self-intersecting) contour are
+// triangulated directly, which is much cheaper than a libtess2 sweep. Ear clipping
+// is O(n^2) though, so larger non-convex contours still go to libtess2.
+static const size_t kMaxSimplePolygonPoints = 128;
+
+enum PolygonType {
+    POLYGON_CONVEX,
+    POLYGON_SIMPLE,
+    POLYGON_COMPLEX,
+};
+
+static inline float cross(const vec2& o, const vec2& a, const vec2& b)
+{
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+}
+
+static inline int sign(float x)
+{
+    return (x > 0) - (x < 0);
+}
+
+// Whether segments ab and cd touch at all, including at their ends
+static bool segmentsTouch(const vec2& a, const vec2& b, const vec2& c, const vec2& d)
+{
+    int abc = sign(cross(a, b, c));
+    int abd = sign(cross(a, b, d));
+    int cda = sign(cross(c, d, a));
+    int cdb = sign(cross(c, d, b));
+
+    if (abc * abd > 0 || cda * cdb > 0) return false;
+    if (abc != 0 || abd != 0 || cda != 0 || cdb != 0) return true;
+
+    // Collinear, check for overlap
+    return glm::min(a.x, b.x) <= glm::max(c.x, d.x) && glm::min(c.x, d.x) <= glm::max(a.x, b.x)
+        && glm::min(a.y, b.y) <= glm::max(c.y, d.y) && glm::min(c.y, d.y) <= glm::max(a.y, b.y);
+}
+
+bool edgesTouch(const vec2* points, const unsigned int* offsets, size_t count,
+                std::vector<int>& order, std::vector<int>& next)
+{
+    // Edge i runs from points[i] to points[next[i]]
+    size_t n = offsets[count];
+    order.resize(n);
+    next.resize(n);
+    for (size_t c=0; c<count; c++) {
+        for (unsigned int i=offsets[c]; i<offsets[c+1]; i++) {
+            next[i] = i + 1 < offsets[c+1] ? i + 1 : offsets[c];
+        }
+    }
+    for (size_t i=0; i<n; i++) order[i] = (int)i;
+
+    // Sorted by their lowest y, each edge only needs testing against the ones
+    // after it that start below its top
+    std::sort(order.begin(), order.end(), [points, &next](int a, int b) {
+        return glm::min(points[a].y, points[next[a]].y) < glm::min(points[b].y, points[next[b]].y);
+    });
+
+    for (size_t k=0; k<n; k++) {
+        int i = order[k];
+        const vec2& a = points[i];
+        const vec2& b = points[next[i]];
+        float top = glm::max(a.y, b.y);
+        for (size_t m=k+1; m<n; m++) {
+            int j = order[m];
+            const vec2& c = points[j];
+            const vec2& d = points[next[j]];
+            if (glm::min(c.y, d.y) > top) break;
+
+            if (next[i] == j || next[j] == i) continue;
+            if (segmentsTouch(a, b, c, d)) return true;
+        }
+    }
+
+    return false;
+}
+
+// Copies a contour into poly without repeated points, counter-clockwise, and works out
+// what kind of polygon it is. order and next are scratch space.
+static PolygonType classifyPolygon(const vec2* points, size_t size, std::vector<vec2>& poly,
+                                   std::vector<int>& order, std::vector<int>& next)
+{
+    poly.clear();
+    for (size_t i=0; i<size; i++) {
+        if (poly.empty() || points[i] != poly.back()) {
+            poly.push_back(points[i]);
+        }
+    }
+    while (poly.size() > 1 && poly.back() == poly.front()) {
+        poly.pop_back();
+    }
+
+    size_t n = poly.size();
+    if (n < 3) return POLYGON_CONVEX;
+
+    float area = 0;
+    for (size_t i=0, j=n-1; i<n; j=i++) {
+        area += poly[j].x * poly[i].y - poly[i].x * poly[j].y;
+    }
+    if (area < 0) {
+        std::reverse(poly.begin(), poly.end());
+    }
+
+    // Convex if it only ever turns left and goes round once, which a polygon does when
+    // its edges change direction in x (and in y) no more than twice
+    bool convex = true;
+    int xChanges = 0, yChanges = 0;
+    int xDir = 0, yDir = 0;
+    for (size_t i=0; i<n + 1 && convex; i++) {
+        const vec2& a = poly[i % n];
+        const vec2& b = poly[(i + 1) % n];
+        const vec2& c = poly[(i + 2) % n];
+        float turn = cross(a, b, c);
+        if (turn < 0 || (turn == 0 && glm::dot(b - a, c - b) < 0)) {
+            convex = false;
+        }
+
+        int dx = sign(b.x - a.x);
+        int dy = sign(b.y - a.y);
+        if (dx != 0) {
+            if (xDir != 0 && dx != xDir) xChanges++;
+            xDir = dx;
+        }
+        if (dy != 0) {
+            if (yDir != 0 && dy != yDir) yChanges++;
+            yDir = dy;
+        }
+    }
+    // The first edge is looked at again at the end, so the changes are counted all the way round
+    if (convex && xChanges <= 2 && yChanges <= 2) return POLYGON_CONVEX;
+
+    if (n > kMaxSimplePolygonPoints) return POLYGON_COMPLEX;
+
+    // Simple if no two edges touch, other than neighbours at their shared point
+    unsigned int offsets[2] = { 0, (unsigned int)n };
+    if (edgesTouch(poly.data(), offsets, 1, order, next)) return POLYGON_COMPLEX;
+
+    return POLYGON_SIMPLE;
+}
+
+static bool pointInTriangle(const vec2& p, const vec2& a, const vec2& b, const vec2& c)
+{
+    return cross(a, b, p) >= 0 && cross(b, c, p) >= 0 && cross(c, a, p) >= 0;
+}
+
+// Ear clipping for a simple counter-clockwise polygon. Returns false if it gets stuck,
+// which rounding can cause on nearly degenerate input.
+static bool clipEars(const std::vector<vec2>& poly, std::vector<int>& prev, std::vector<int>& next,
+                     std::vector<unsigned int>& indices)
+{
+    int n = (int)poly.size();
+    prev.resize(n);
+    next.resize(n);
+    for (int i=0; i<n; i++) {
+        prev[i] = i == 0 ? n - 1 : i - 1;
+        next[i] = i == n - 1 ? 0 : i + 1;
+    }
+
+    int remaining = n;
+    int i = 0;
+    int tried = 0;      // vertices tried since the last one was removed
+    while (remaining > 3) {
+        int a = prev[i];
+        int c = next[i];
+        float turn = cross(poly[a], poly[i], poly[c]);
+
+        // An ear is a left turn with no other vertex inside it. Only reflex
+        // vertices can be inside, so convex ones are skipped.
+        bool ear = turn > 0;
+        if (ear) {
+            vec2 lo = glm::min(poly[a], glm::min(poly[i], poly[c]));
+            vec2 hi = glm::max(poly[a], glm::max(poly[i], poly[c]));
+            for (int j = next[c]; j != a; j = next[j]) {
+                const vec2& p = poly[j];
+                if (p.x < lo.x || p.y < lo.y || p.x > hi.x || p.y > hi.y) continue;
+                if (cross(poly[prev[j]], p, poly[next[j]]) <= 0 && pointInTriangle(p, poly[a], poly[i], poly[c])) {
+                    ear = false;
+                    break;
+                }
+            }
+        }
+
+        // Collinear points are dropped without a triangle
+        if (ear || turn == 0) {
+            if (ear) {
+                indices.push_back(a);
+                indices.push_back(i);
+                indices.push_back(c);
+            }
+            next[a] = c;
+            prev[c] = a;
+            remaining--;
+            tried = 0;
+            i = c;
+        } else {
+            i = c;
+            if (++tried > remaining) return false;
+        }
+    }
+
+    indices.push_back(prev[i]);
+    indices.push_back(i);
+    indices.push_back(next[i]);
+    return true;
+}
+
+bool Libtess2Triangulator::triangulate(const Contours& contours, Mesh* mesh)
+{
+    mesh->vertices.clear();
+    mesh->indices.clear();
+
+    // An empty path (a lone moveTo, say) is an empty mesh, libtess2 treats it as an error
+    if (contours.count() == 0) return true;
+
+    if (contours.count() == 1) {
+        PolygonType type = classifyPolygon(contours.contour(0), contours.contourSize(0), mesh->vertices, m_prev, m_next);
+        size_t n = mesh->vertices.size();
+        if (n < 3) {
+            mesh->vertices.clear();
+            return true;
+        }
+
+        if (type == POLYGON_CONVEX) {
+            mesh->indices.reserve((n - 2) * 3);
+            for (size_t i=1; i+1<n; i++) {
+                mesh->indices.push_back(0);
+                mesh->indices.push_back((unsigned int)i);
+                mesh->indices.push_back((unsigned int)i + 1);
+            }
+            return true;
+        }
+
+        if (type == POLYGON_SIMPLE) {
+            mesh->indices.reserve((n - 2) * 3);
+            if (clipEars(mesh->vertices, m_prev, m_next, mesh->indices)) return true;
+            mesh->indices.clear();
+        }
+
+        mesh->vertices.clear();
+    }
+
+    m_arena.reset();
+
+    // Size the libtess2 pools from the input so a typical path needs one bucket of each.
+    // The tesselator itself lives in the arena, so it's recreated for each run
+    // without touching the system allocator.
+    size_t n = contours.points.size();
+    TESSalloc talloc;
+    memset(&talloc, 0, sizeof(talloc));
+    talloc.memalloc = arenaAlloc;
+    talloc.memrealloc = arenaRealloc;
+    talloc.memfree = arenaFree;
+    talloc.userData = &m_arena;
+    talloc.meshEdgeBucketSize = bucketSize(n * 2);
+    talloc.meshVertexBucketSize = bucketSize(n);
+    talloc.meshFaceBucketSize = bucketSize(n);
+    talloc.dictNodeBucketSize = bucketSize(n / 2);
+    talloc.regionBucketSize = bucketSize(n / 2);
+    talloc.extraVertices = bucketSize(n / 8);
+
+    TESStesselator* tess = tessNewTess(&talloc);
+    if (!tess) {
+        std::cerr << "Couldn't allocate tessellator" << std::endl;
+        return false;
+    }
+
+    for (size_t i=0; i<contours.count(); i++) {
+        tessAddContour(tess, 2, contours.contour(i), (int)sizeof(vec2), (int)contours.contourSize(i));
+    }
+
+    // Triangulate
+    if (tessTesselate(tess, TESS_WINDING_ODD, TESS_POLYGONS, 3, 2, 0) == 0) {
+        std::cerr << "Failed to tessellate path" << std::endl;
+        return false;
+    }
+
+    // Copy the output once, from the arena into the mesh's (reused) storage
+    const vec2* pvert = (const vec2*) tessGetVertices(tess);
+    mesh->vertices.assign(pvert, pvert + tessGetVertexCount(tess));
+
+    const unsigned int* pind = tessGetElements(tess);
+    mesh->indices.assign(pind, pind + tessGetElementCount(tess) * 3);
+
+    // No tessDeleteTess(), the arena is reset before the next run
+    return true;
+}
+
+Triangulator* TessContext::backend(TriangulatorType type)
+{
+    switch (type) {
+    case TRIANGULATOR_POLY2TRI: return &m_poly2tri;
+    default: return &m_libtess2;
+    }
+}
+
+bool TessContext::tessellate(const Contours& contours, Mesh* mesh, TriangulatorType type)
+{
+    if (type != TRIANGULATOR_LIBTESS2 && backend(type)->triangulate(contours, mesh)) {
+        return true;
+    }
+    return m_libtess2.triangulate(contours, mesh);
+}
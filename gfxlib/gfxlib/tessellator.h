@@ -0,0 +1,138 @@
+#ifndef TESSELLATOR_H
+#define TESSELLATOR_H
+#include <vector>
+#include <stddef.h>
+#include "common.h"
+
+struct Mesh;
+
+// Flattened path outlines. All contours share one point buffer; contour i
+// spans points[offsets[i]] up to (but not including) points[offsets[i+1]].
+// Closed contours don't repeat their first point at the end.
+struct Contours
+{
+    Contours()
+        : offsets(1, 0)
+    {
+    }
+
+    void clear() {
+        points.clear();
+        offsets.assign(1, 0);
+        closed.clear();
+    }
+
+    // Start a new contour at p
+    void begin(const vec2& p) {
+        offsets.push_back(offsets.back());
+        closed.push_back(0);
+        append(p);
+    }
+
+    // Extend the last contour to p
+    void append(const vec2& p) {
+        points.push_back(p);
+        offsets.back() = (unsigned int)points.size();
+    }
+
+    size_t count() const { return offsets.size() - 1; }
+    const vec2* contour(size_t i) const { return points.data() + offsets[i]; }
+    size_t contourSize(size_t i) const { return offsets[i+1] - offsets[i]; }
+    bool isClosed(size_t i) const { return closed[i] != 0; }
+
+    std::vector<vec2> points;
+    std::vector<unsigned int> offsets;
+    std::vector<unsigned char> closed;      // one flag per contour
+};
+
+// Bump allocator for libtess2. Everything allocated during one tessellation is
+// released at once by reset(). Memory is kept between tessellations, so once
+// the arena has grown to fit the largest path it stops calling malloc.
+class TessArena
+{
+public:
+    TessArena();
+    ~TessArena();
+
+    void* alloc(size_t size);
+    void* realloc(void* ptr, size_t size);
+    void reset();
+
+private:
+    struct Block {
+        Block* next;
+        size_t size;
+    };
+
+    Block* m_blocks;        // current block first, older overflow blocks follow
+    size_t m_used;          // bytes used in the current block
+    size_t m_totalSize;     // size of all blocks, used to coalesce on reset
+    void* m_last;           // most recent allocation, which realloc can grow in place
+};
+
+// Fill triangulation backends, selectable per path or globally
+enum TriangulatorType {
+    TRIANGULATOR_LIBTESS2,      // fastest, handles any input
+    TRIANGULATOR_POLY2TRI,      // constrained Delaunay, no slivers, for contours that don't cross
+    TRIANGULATOR_COUNT,
+};
+
+// Turns flattened contours into triangles covering the area inside them
+// under the even-odd rule
+class Triangulator
+{
+public:
+    virtual ~Triangulator() {}
+
+    // Returns false if the input couldn't be triangulated, leaving mesh empty
+    virtual bool triangulate(const Contours& contours, Mesh* mesh) = 0;
+};
+
+// libtess2, with shortcuts for single convex or simple contours
+class Libtess2Triangulator : public Triangulator
+{
+public:
+    bool triangulate(const Contours& contours, Mesh* mesh);
+
+private:
+    TessArena m_arena;
+    std::vector<int> m_prev;
+    std::vector<int> m_next;
+};
+
+// poly2tri (constrained Delaunay triangulation). Only takes contours that
+// don't touch each other or themselves, so it fails on input libtess2 would accept.
+class Poly2triTriangulator : public Triangulator
+{
+public:
+    bool triangulate(const Contours& contours, Mesh* mesh);
+
+private:
+    Contours m_rings;
+    std::vector<int> m_depth;       // number of contours each one is inside
+    std::vector<int> m_parent;      // for holes, the outline directly around them
+    std::vector<int> m_order;
+    std::vector<int> m_next;
+};
+
+// Reusable triangulation state, one set of backends per thread
+class TessContext
+{
+public:
+    // Falls back to libtess2 when another backend can't handle the contours
+    bool tessellate(const Contours& contours, Mesh* mesh, TriangulatorType type = TRIANGULATOR_LIBTESS2);
+
+    Triangulator* backend(TriangulatorType type);
+
+private:
+    Libtess2Triangulator m_libtess2;
+    Poly2triTriangulator m_poly2tri;
+};
+
+// Whether any edges of the closed contours in points touch, other than neighbouring
+// edges of one contour at their shared point. Contour i spans offsets[i] up to
+// offsets[i+1]. order and next are scratch space.
+bool edgesTouch(const vec2* points, const unsigned int* offsets, size_t count,
+                std::vector<int>& order, std::vector<int>& next);
+
+#endif // TESSELLATOR_H
@@ -5,12 +5,53 @@ nexpo.key = {}
 nexpo.window = {}
 nexpo.controls = {}
 nexpo.console = {}
+nexpo.timing = {}
+nexpo.capture = {}
 
 local ffi = require 'ffi'
 
 ffi.cdef [[
   typedef struct {} Path;
   typedef struct {} Font;
+  typedef struct {} MeshBundle;
+  typedef struct {} MeshBundleWriter;
+  typedef struct {} Scene;
+  typedef struct {} FrameSequence;
+
+  // Declared in gfxlib's inputevents.h
+  typedef struct {
+    double time, x, y;
+    int type, code, scancode, action, mods;
+  } InputEvent;
+
+  // Declared in gfxlib's frametiming.h
+  typedef struct {
+    double frameStart, frameEnd, swapIssued, swapReturned, interval, gpuTime, completed, gcTime;
+    int missed;
+    unsigned int index;
+  } FrameRecord;
+  typedef struct {
+    unsigned int frames, dropped, missed;
+    double refreshPeriod, meanInterval, medianInterval, p95Interval, p99Interval, maxInterval, maxFrameTime;
+    unsigned int gpuFrames;
+    double meanGpuTime, maxGpuTime;
+    unsigned int latencyFrames;
+    double meanLatency, maxLatency;
+    double meanGcTime, maxGcTime;
+  } FrameSummary;
+  typedef struct { double cpu, gpu; } DrawTiming;
+
+  // Declared in gfxlib's capture.h
+  typedef struct {
+    unsigned int frames, written, dropped, failed, queued, maxQueued;
+    int lastDropped, width, height;
+  } CaptureStats;
+
+  // Declared in gfxlib's sequence.h
+  typedef struct {
+    unsigned int shown, firstFrame, late, repeated, missed;
+    double onset, duration;
+  } SequenceReport;
 
 unsigned int getNumExports();
 const char* getExportSignature(unsigned int i);
@@ -37,6 +78,8 @@ if jit.os == 'Windows' then
   gfxlib = ffi.load(getNexpoPath() .. 'gfxlib.dll')
 elseif jit.os == 'OSX' then
   gfxlib = ffi.load(getNexpoPath() .. 'libgfxlib.dylib')
+elseif jit.os == 'Linux' then
+  gfxlib = ffi.load(getNexpoPath() .. 'libgfxlib.so')
 else
   error 'Unimplemented OS'
 end
@@ -47,6 +90,14 @@ local windowCenterX = 0
 local windowCenterY = 0
 local windowScaleX
 local windowScaleY
+
+-- Converts a cursor position in pixels from the center of the window, as from
+-- gfxlib.cursorPos and input events, to canvas units
+local function toCanvasPosition(x, y)
+  return x / windowPixelsPerUnit - windowCenterX,
+         y / windowPixelsPerUnit - windowCenterY
+end
+
 local shaders = {}
 local shaderForName = {}
 local currentShader
@@ -55,6 +106,9 @@ local startTime
 local kControlPrefix = '\x05'
 local controlHandlers = {}
 local controls = {}
+local controlsById = {}
+local nextControlId = 1
+local controlChannel = false    -- set by init() when run from the IDE
 
 local function initShader(shader)
   local nparam = gfxlib.getShaderParameterCount(shader.id)
@@ -152,7 +206,7 @@ local function setTransform(xscale, yscale, rotation, translatex, translatey)
   ffiMat3[7] = 0
   ffiMat3[8] = 1
 
-  gfxlib.setShaderParameter3x3(currentShader.transformLocation, ffiMat3)
+  gfxlib.setShaderTransform(currentShader.transformLocation, ffiMat3)
 end
 
 local function setObjectTransform(obj)
@@ -164,6 +218,14 @@ local function setObjectTransform(obj)
   setTransform(xscale, yscale, rotation, translatex, translatey)
 end
 
+local function objectPixelsPerUnit(obj)
+  -- Number of screen pixels covered by one unit of the object's shape, used
+  -- to decide how finely curves need to be flattened
+  local xscale = math.abs(obj.width or obj.size or 1)
+  local yscale = math.abs(obj.height or obj.size or 1)
+  return windowPixelsPerUnit * math.max(xscale, yscale)
+end
+
 local function setShaderParameter(index, param)
   if type(param) == 'number' then
     gfxlib.setShaderParameter1(index, param)
@@ -244,6 +306,10 @@ local function isFont(f)
   return type(f) == 'cdata' and ffi.typeof(f) == fontPtrType
 end
 
+-- Ids of the built in shapes, for gfxlib functions that take many shapes at once.
+-- Paths are 0.
+local builtinShapes = { rect = 1, circle = 2 }
+
 local function drawMany(obj)
   for i=1,#obj do
     draw(obj[i])
@@ -269,10 +335,11 @@ function nexpo.graphics.draw(obj)
   end
 
   if isPath(obj.shape) then
+    local pixelsPerUnit = objectPixelsPerUnit(obj)
     if fill then
-      gfxlib.drawFilledPath(obj.shape)
+      gfxlib.drawFilledPath(obj.shape, pixelsPerUnit)
     else
-      gfxlib.drawStrokedPath(obj.shape, strokewidth)
+      gfxlib.drawStrokedPath(obj.shape, strokewidth, pixelsPerUnit)
     end
   elseif obj.shape == 'rect' then
     if fill then
@@ -291,15 +358,125 @@ function nexpo.graphics.draw(obj)
   end
 end
 
+local batchCapacity = 0
+local batchTransforms
+local batchParams
+local batchView = ffi.new('float[4]')
+
+local pixelSize = ffi.new 'int[2]'
+
+--- Copy what has been drawn so far this frame, for checking or saving rendered stimuli.
+-- Call it at the end of nexpo.graphics.onframe, after drawing, since the frame is
+-- cleared once onframe returns. Works with windows and with offscreen canvases
+-- (see the offscreen setting).
+-- @param buffer Optional uint8_t array of at least width * height * 4 bytes to
+-- fill, to avoid allocating a new one every frame
+-- @return The pixels as rows of RGBA bytes from the top down, then the width and
+-- height in pixels
+-- @usage
+-- local pixels, w, h = nexpo.graphics.readpixels(pixels)
+function nexpo.graphics.readpixels(buffer)
+  gfxlib.canvasPixelSize(pixelSize)
+  local width, height = pixelSize[0], pixelSize[1]
+  local bytes = width * height * 4
+  if buffer == nil then
+    buffer = ffi.new('uint8_t[?]', bytes)
+  else
+    assert(ffi.sizeof(buffer) >= bytes, 'pixel buffer is too small')
+  end
+  gfxlib.readCanvasPixels(buffer, 0)
+  return buffer, width, height
+end
+
+--- Draw many objects that share a shape and style in a few draw calls.
+-- Much faster than drawing them one at a time, for displays with hundreds or
+-- thousands of similar items. Each object has its own position, size and
+-- rotation, and can have its own value of one shader parameter such as color;
+-- everything else (shape, drawtype, strokewidth and the rest of the style) is
+-- taken from the first object. Objects are drawn in order, as with nexpo.graphics.draw.
+-- Stroked rects and circles, and shaders that can't be batched, are drawn one at a time.
+-- @param objects An array of objects
+-- @param param Optional name of the shader parameter each object sets in its style, eg 'color'
+-- @usage nexpo.graphics.drawbatch(discs, 'color')
+function nexpo.graphics.drawbatch(objects, param)
+  assert(type(objects) == 'table', 'expected an array of objects')
+  assert(param == nil or type(param) == 'string', 'param must be the name of a shader parameter')
+  local n = #objects
+  if n == 0 then return end
+
+  local first = objects[1]
+  local shape = first.shape
+  local shapeId = isPath(shape) and 0 or builtinShapes[shape]
+  assert(shapeId, 'Unknown shape field in object')
+  local strokewidth = first.drawtype == 'stroke' and (first.strokewidth or 1) or 0
+  if strokewidth > 0 and shapeId ~= 0 then
+    -- Only paths have stroke meshes to batch
+    for i=1,n do
+      nexpo.graphics.draw(objects[i])
+    end
+    return
+  end
+
+  setShaderParameters(first)
+  local default = param and ((first.style and first.style[param]) or currentShader.defaults[param])
+
+  if n > batchCapacity then
+    batchCapacity = math.max(n, batchCapacity * 2)
+    batchTransforms = ffi.new('float[?]', batchCapacity * 5)
+    batchParams = ffi.new('float[?]', batchCapacity * 4)
+  end
+
+  local pixelsPerUnit = 0
+  for i=1,n do
+    local obj = objects[i]
+    local j = (i - 1) * 5
+    batchTransforms[j] = obj.width or obj.size or 1
+    batchTransforms[j + 1] = obj.height or obj.size or 1
+    batchTransforms[j + 2] = obj.rotation or 0
+    batchTransforms[j + 3] = obj.x or 0
+    batchTransforms[j + 4] = obj.y or 0
+    if shapeId == 0 then
+      pixelsPerUnit = math.max(pixelsPerUnit, objectPixelsPerUnit(obj))
+    end
+
+    if param then
+      local value = (obj.style and obj.style[param]) or default
+      local k = (i - 1) * 4
+      if value == nil then
+        error(string.format('Object %d has no value for %s', i, param), 2)
+      elseif type(value) == 'number' then
+        batchParams[k], batchParams[k + 1], batchParams[k + 2], batchParams[k + 3] = value, 0, 0, 0
+      else
+        batchParams[k], batchParams[k + 1], batchParams[k + 2], batchParams[k + 3] =
+          value[1] or 0, value[2] or 0, value[3] or 0, value[4] or 0
+      end
+    end
+  end
+
+  batchView[0] = windowScaleX
+  batchView[1] = windowScaleY
+  batchView[2] = windowCenterX
+  batchView[3] = windowCenterY
+  local drawn = gfxlib.drawBatch(shapeId, shapeId == 0 and shape or nil, strokewidth, pixelsPerUnit,
+                                 n, batchTransforms, param, batchParams, batchView)
+  if drawn == 0 then
+    -- The shader can't take param per object, so draw them one at a time
+    for i=1,n do
+      nexpo.graphics.draw(objects[i])
+    end
+  end
+end
+
+-- Defined with the input callbacks below
+local dispatchInputEvents
+
+-- gfxlib.pollEvents only queues events, so no Lua runs inside it and it can be
+-- JIT compiled. The queue is then emptied here, calling the input callbacks.
 local function pollEvents()
     gfxlib.pollEvents()
+    dispatchInputEvents()
 end
 
--- gfxlib.pollEvents is a C function which calls lua callbacks.
--- It's necessary to disable JIT compilation for the function call,
--- as per http://luajit.org/ext_ffi_semantics.html#callback
-jit.off(pollEvents)
-
 local function showHelp(target)
   assert(type(target) == 'string', 'parameter must be a string')
   print(kControlPrefix..'help '..target)
@@ -356,7 +533,32 @@ local function removeSpaces(str)
   return str:gsub(' ', '')
 end
 
-local function createControl(target)
+-- For a target like 'obj.field', where obj is an FFI struct and field is a double,
+-- returns a pointer to the field and the struct, which must be kept alive while
+-- the pointer is in use
+local function findDoubleField(target)
+  local parentExpression, field = target:match('^(.+)%.([%a_][%w_]*)$')
+  if not parentExpression then return end
+  local getParent = loadstring('return ' .. parentExpression)
+  if not getParent then return end
+  local ok, parent = pcall(getParent)
+  if not ok or type(parent) ~= 'cdata' then return end
+  local offset
+  ok, offset = pcall(ffi.offsetof, parent, field)
+  if not ok or not offset then return end
+
+  -- Only a double field reads back 0.1 exactly, through a double pointer too
+  local isDouble = pcall(function()
+    local probe = ffi.new(ffi.typeof(parent))
+    probe[field] = 0.1
+    assert(probe[field] == 0.1 and ffi.cast('double*', ffi.cast('char*', probe) + offset)[0] == 0.1)
+  end)
+  if not isDouble then return end
+
+  return ffi.cast('const double*', ffi.cast('char*', parent) + offset), parent
+end
+
+local function createControl(target, rate, threshold)
   local name
   if type(target) == 'string' then
     name = target
@@ -370,7 +572,26 @@ local function createControl(target)
   control.numberSetter = createNumberSetter(target)
   control.stringSetter = createStringSetter(target)
   control.name = name
+  -- a control replacing one of the same name keeps its id
+  if controls[name] then
+    control.id = controls[name].id
+  else
+    control.id = nextControlId
+    nextControlId = nextControlId + 1
+  end
   controls[name] = control
+  controlsById[control.id] = control
+
+  -- gfxlib schedules sampling, and reads FFI struct fields itself
+  local pointer
+  if controlChannel and type(target) == 'string' then
+    pointer, control.anchor = findDoubleField(target)
+  end
+  if pointer then
+    gfxlib.watchControlPointer(control.id, pointer, rate or 0, threshold or 0)
+  else
+    gfxlib.watchControl(control.id, rate or 0, threshold or 0)
+  end
   return control  
 end
 
@@ -416,53 +637,92 @@ function nexpo.controls.slider(target, min, max, initial)
     initial = value or (max-min)/2
   end
   
-  print(kControlPrefix..'slider '..control.name..' '..min..' '..max..' '..initial)
+  if controlChannel then
+    gfxlib.sendControlSlider(control.id, control.name, min, max, initial)
+  else
+    print(kControlPrefix..'slider '..control.name..' '..min..' '..max..' '..initial)
+  end
 end
 
 --- Create a time series plot.
--- The value of a variable or function will be plotted over time.
+-- The value of a variable or function will be plotted over time. A target that's
+-- a double field of an FFI struct is read without running any Lua, from the struct
+-- it named when the plot was created.
 -- @param target A string containing the target variable to plot, eg 'mycircle.diameter'
+-- @param rate Optional samples per second, by default one per frame
+-- @param threshold Optional amount the value must change by before the plot is updated
 -- @usage c = circle()
 -- plot 'c.diameter'
+-- plot('c.x', 10)
 -- @see slider
-function nexpo.controls.plot(target)
+function nexpo.controls.plot(target, rate, threshold)
   assert(target, 'missing target argument')
   assert(type(target) == 'string' or type(target) == 'function', 'invalid target type')
-  local control = createControl(target)
-  print(kControlPrefix..'timeseriesplot '.. control.name)
+  assert(rate == nil or type(rate) == 'number', 'rate must be a number')
+  assert(threshold == nil or type(threshold) == 'number', 'threshold must be a number')
+  local control = createControl(target, rate, threshold)
+  if controlChannel then
+    gfxlib.sendControlPlot(control.id, control.name)
+  else
+    print(kControlPrefix..'timeseriesplot '.. control.name)
+  end
 end
 
-local function sendControlValue(name, value)
-  if type(value) == 'number' then
-    print(kControlPrefix .. 'numbervalue ' .. name .. ' ' .. value)
-  elseif type(value) == 'string' then
-    print(kControlPrefix .. 'stringvalue ' .. name .. ' ' .. value)
+-- Numbers that changed are queued in gfxlib, or printed without a control channel
+local function sampleControl(control)
+  local success, value = pcall(control.getter)
+  if not success then
+    warn(string.format("Error while executing getter for %q: %s", tostring(control.name), value))
+    -- TODO: send message that this control is being deleted
+    controls[control.name] = nil
+    controlsById[control.id] = nil
+    gfxlib.unwatchControl(control.id)
+  elseif type(value) == 'number' then
+    if gfxlib.sampleControl(control.id, value) and not controlChannel then
+      print(kControlPrefix .. 'numbervalue ' .. control.name .. ' ' .. value)
+    end
+  elseif type(value) == 'string' and value ~= control.lastSent then
+    if not controlChannel then
+      print(kControlPrefix .. 'stringvalue ' .. control.name .. ' ' .. value)
+      control.lastSent = value
+    elseif gfxlib.sendControlString(control.id, value) then
+      control.lastSent = value
+    end
   end
 end
 
+local kDueControlBatch = 64
+local dueControlIds = ffi.new('unsigned int[?]', kDueControlBatch)
+
+-- Only controls that gfxlib says are due are sampled, so a frame between samples
+-- runs no getters
 local function sendControlUpdates()
-  for name, control in pairs(controls) do
-    local success, value = pcall(control.getter)
-    if not success then
-      warn(string.format("Error while executing getter for %q: %s", tostring(name), value))
-      -- TODO: send message that this control is being deleted
-      controls[name] = nil
-    else
-      if control.lastSent ~= value then
-        sendControlValue(name, value)
-        control.lastSent = value
-      end
+  repeat
+    local n = gfxlib.dueControls(dueControlIds, kDueControlBatch)
+    for i=0,n-1 do
+      local control = controlsById[dueControlIds[i]]
+      if control then sampleControl(control) end
     end
-  end
+  until n < kDueControlBatch
 end
 
 
 
 local function sendControlData()
   -- frame info
-  print(kControlPrefix..'frameinfo '.. nexpo.graphics.time())
+  if controlChannel then
+    gfxlib.sendControlFrame(nexpo.graphics.time())
+  else
+    print(kControlPrefix..'frameinfo '.. nexpo.graphics.time())
+  end
   
   sendControlUpdates()
+  if controlChannel then gfxlib.sendControlSamples() end
+end
+
+local function setControlValue(control, value)
+  control.numberSetter(value)
+  gfxlib.setSampledControlValue(control.id, value)
 end
 
 function controlHandlers.numbervalue(params)
@@ -471,8 +731,7 @@ function controlHandlers.numbervalue(params)
   local value = tonumber(params[3])
   local control = controls[name]
   if control then
-    control.numberSetter(value)
-    control.lastSent = value
+    setControlValue(control, value)
   end
 end
 
@@ -517,7 +776,19 @@ local function getInputLine()
   return ffi.string(inputLineBuffer)
 end
 
+local receivedControlId = ffi.new 'unsigned int[1]'
+local receivedControlValue = ffi.new 'double[1]'
+local function checkControlChannel()
+  while gfxlib.receiveControlNumber(receivedControlId, receivedControlValue) do
+    local control = controlsById[receivedControlId[0]]
+    if control then
+      xpcall(setControlValue, function(e) warn(tostring(e)) end, control, receivedControlValue[0])
+    end
+  end
+end
+
 local function checkInput()
+  if controlChannel then checkControlChannel() end
   while true do
     local line = getInputLine()
     if line == nil then return end
@@ -537,27 +808,317 @@ function nexpo.graphics.onframe(elapsed) end
 -- we want to force the user to implement this
 nexpo.graphics.onframe = false
 
---- Start running a script. This should be the last line of every Nexpo script.
--- It passes control to Nexpo, which will run the render loop and process user input.
--- @see nexpo.stop
--- @see nexpo.graphics.onframe
-function nexpo.start()
-  assert(type(nexpo.graphics.onframe) == 'function', 'Missing "nexpo.graphics.onframe" function, nothing to do')
-  startTime = gfxlib.canvasTime()
-  
+--- Called after a frame missed one or more refreshes, so was shown late.
+-- Override it to flag or repeat the trial that was running; by default it
+-- does nothing. Only detected with vertical sync on.
+-- @param frame The frame number, as from nexpo.timing.framecount
+-- @param missed The number of refreshes missed
+-- @see nexpo.timing.summary
+function nexpo.timing.ondropped(frame, missed) end
+
+local frameSummary = ffi.new 'FrameSummary'
+
+local function checkFrameTiming()
+  local n = gfxlib.frameCount()
+  if n == 0 then return end
+  local frame = gfxlib.frameRecords()[(n - 1) % gfxlib.frameRecordCapacity()]
+  if frame.missed > 0 then
+    nexpo.timing.ondropped(frame.index, frame.missed)
+  end
+end
+
+--- The number of frames shown so far. Note it at the start of a trial and pass
+-- it to nexpo.timing.summary at the end to check the trial's timing.
+-- @return The number of the next frame to be shown
+function nexpo.timing.framecount()
+  return gfxlib.frameCount()
+end
+
+--- The measured time between display refreshes, in seconds.
+-- Starts at the monitor's nominal refresh rate and follows the rate frames are
+-- actually shown at.
+function nexpo.timing.refreshperiod()
+  return gfxlib.refreshPeriod()
+end
+
+--- Summarise the timing of recent frames.
+-- Intervals are between successive swap buffer returns. Only the most recent
+-- frames are kept (see nexpo.timing.setcapacity), so frames older than that are
+-- left out.
+-- @param since Summarise frames numbered since or later (default 0, every frame kept)
+-- @return A table with fields frames, dropped (frames shown late), missed (refreshes
+-- missed in total), refreshperiod, mean, median, p95, p99 and max (intervals, in
+-- seconds), maxframetime (the longest onframe call, in seconds), with GPU timing
+-- on, gpuframes (frames with a GPU time), gpumean and gpumax (in seconds), and with
+-- frames in flight limited (see nexpo.timing.lowlatency), latencyframes (frames
+-- with a latency), latencymean and latencymax (seconds from onframe being called
+-- to the frame being completed), and gcmean and gcmax (seconds collecting garbage
+-- after onframe, see nexpo.timing.gc)
+-- @usage
+-- local trialStart = nexpo.timing.framecount()
+-- ...
+-- if nexpo.timing.summary(trialStart).dropped > 0 then repeatTrial() end
+function nexpo.timing.summary(since)
+  gfxlib.frameSummary(since or 0, frameSummary)
+  local s = frameSummary
+  return {
+    frames = s.frames,
+    dropped = s.dropped,
+    missed = s.missed,
+    refreshperiod = s.refreshPeriod,
+    mean = s.meanInterval,
+    median = s.medianInterval,
+    p95 = s.p95Interval,
+    p99 = s.p99Interval,
+    max = s.maxInterval,
+    maxframetime = s.maxFrameTime,
+    gpuframes = s.gpuFrames,
+    gpumean = s.meanGpuTime,
+    gpumax = s.maxGpuTime,
+    latencyframes = s.latencyFrames,
+    latencymean = s.meanLatency,
+    latencymax = s.maxLatency,
+    gcmean = s.meanGcTime,
+    gcmax = s.maxGcTime
+  }
+end
+
+--- The raw timing records, without copying.
+-- Frame n is at records[n % capacity] for first <= n < nexpo.timing.framecount().
+-- Each record has fields frameStart, frameEnd, swapIssued, swapReturned, interval,
+-- gpuTime (-1 if not measured or not back yet), completed (when the GPU had finished
+-- the frame and its swap, -1 unless frames in flight are limited), gcTime (seconds
+-- collecting garbage after onframe), missed and index,
+-- with times in seconds on the nexpo.graphics.time clock plus an
+-- offset. Records are overwritten as new frames are shown.
+-- @return The records (a FrameRecord cdata array), its capacity, and the oldest frame number kept
+function nexpo.timing.records()
+  return gfxlib.frameRecords(), gfxlib.frameRecordCapacity(), gfxlib.firstRecordedFrame()
+end
+
+--- Set how many frames of timing records are kept, 16384 by default.
+-- Existing records are cleared.
+-- @param frames The number of frames to keep
+function nexpo.timing.setcapacity(frames)
+  assert(type(frames) == 'number' and frames >= 1, 'expected a number of frames')
+  gfxlib.setFrameRecordCapacity(frames)
+end
+
+local gpuTimingModes = { [false] = 0, frames = 1, draws = 2 }
+local drawTimingInfo = ffi.new 'unsigned int[2]'
+
+--- Measure how long the GPU takes over each frame, and optionally each draw.
+-- Tells whether slow frames are held up by the script (see maxframetime in
+-- nexpo.timing.summary) or by the GPU. Uses GL timer queries, whose results
+-- come back a few frames late so that the script never waits for the GPU.
+-- GPU times include any time the GPU spent waiting for commands.
+-- @param mode 'frames' to time whole frames, 'draws' to also time each draw, or false to stop
+-- @return true, or false if the graphics driver can't time the GPU
+function nexpo.timing.gpu(mode)
+  local m = gpuTimingModes[mode or false]
+  assert(m, 'expected \'frames\', \'draws\' or false')
+  return gfxlib.setGpuTiming(m)
+end
+
+--- The time taken by each draw of a recent frame, when timing draws with nexpo.timing.gpu.
+-- Draws are listed in the order they were made in, each a table with fields cpu
+-- and gpu (seconds spent in the draw function, including any tessellation, and
+-- on the GPU).
+-- @return The array of draw times, and the number of the frame they're from
+-- (or an empty table and nil before any results are back)
+function nexpo.timing.draws()
+  local timings = gfxlib.drawTimings(drawTimingInfo, drawTimingInfo + 1)
+  local result = {}
+  for i=0,drawTimingInfo[0]-1 do
+    result[i + 1] = { cpu = timings[i].cpu, gpu = timings[i].gpu }
+  end
+  if drawTimingInfo[0] == 0 then return result, nil end
+  return result, drawTimingInfo[1]
+end
+
+local framesInFlight = { [false] = 0, [1] = 1, [2] = 2 }
+
+--- Keep the time from drawing a frame to showing it short and known, for reaction
+-- time tasks. Graphics drivers may queue several frames ahead of the display,
+-- each adding a refresh of latency. This limits the queue to 1 or 2 frames by
+-- waiting for each frame to be finished by the GPU, and notes when it was, so
+-- nexpo.timing.summary reports the latency achieved. onframe is called late, a
+-- margin before the refresh its frame is meant for, so the frame is drawn from
+-- the most recent input. Input events are polled every millisecond while waiting
+-- for the frame to start or be finished, so their times are accurate to about
+-- the margin. Starting late needs vertical sync.
+-- @param frames 1 or 2 to limit the frames queued, or false for no limit
+-- @param margin Seconds before the refresh to call onframe, 'auto' (the default)
+-- to judge it from how long recent frames took, or 0 to call it straight away
+-- @return true, or false if the graphics driver can't limit the frames queued
+-- @usage nexpo.timing.lowlatency(1, 'auto')
+function nexpo.timing.lowlatency(frames, margin)
+  local n = framesInFlight[frames or false]
+  assert(n, 'expected 1, 2 or false')
+  assert(margin == nil or margin == 'auto' or (type(margin) == 'number' and margin >= 0),
+         'expected a margin in seconds, \'auto\' or nil')
+  gfxlib.setFrameStartMargin((margin == nil or margin == 'auto') and -1 or margin)
+  return gfxlib.setFramesInFlight(n)
+end
+
+local gcBudget = 0.002
+local gcMargin = 0.002
+local gcGrowth = 2
+local gcStepKb = 16
+local gcMinimumKb = 4096
+local gcFullThresholdKb
+
+--- Set how garbage is collected while a script runs.
+-- Instead of Lua's collector running whenever memory is allocated, garbage is
+-- collected a step at a time after onframe returns, until the budget is spent or
+-- the margin before the frame is due to be shown. If the script makes garbage
+-- faster than that collects it, a full collection is made once memory has grown
+-- by the growth factor since the last collection finished. The time spent
+-- each frame is reported by nexpo.timing.summary. Defaults can be set with
+-- gc_budget_ms, gc_margin_ms and gc_growth in settings.lua.
+-- @param budget Most seconds to spend collecting each frame, 0.002 by default
+-- @param margin Seconds before the refresh to stop collecting, 0.002 by default
+-- @param growth Memory growth that forces a full collection, 2 by default
+-- @usage nexpo.timing.gc(0.004)
+function nexpo.timing.gc(budget, margin, growth)
+  assert(budget == nil or (type(budget) == 'number' and budget >= 0), 'expected a budget in seconds')
+  assert(margin == nil or (type(margin) == 'number' and margin >= 0), 'expected a margin in seconds')
+  assert(growth == nil or (type(growth) == 'number' and growth > 1), 'expected a growth factor greater than 1')
+  gcBudget = budget or gcBudget
+  gcMargin = margin or gcMargin
+  gcGrowth = growth or gcGrowth
+end
+
+local function setGcThreshold()
+  gcFullThresholdKb = math.max(gcMinimumKb, collectgarbage('count') * gcGrowth)
+end
+
+-- Runs between onframe and the swap, in the time left before the frame is due.
+-- Lua's own collector is stopped while frames are drawn, so this is the only
+-- collection that happens then.
+local function collectFrameGarbage()
+  local start = gfxlib.canvasTime()
+  if collectgarbage('count') > gcFullThresholdKb then
+    collectgarbage('collect')
+    setGcThreshold()
+  else
+    local stop = start + gcBudget
+    local refresh = gfxlib.nextRefreshTime()
+    if refresh > 0 then stop = math.min(stop, refresh - gcMargin) end
+    while gfxlib.canvasTime() < stop do
+      -- true when a cycle finishes, after which there's little left to collect
+      if collectgarbage('step', gcStepKb) then
+        setGcThreshold()
+        break
+      end
+    end
+  end
+  -- Stepping restarts the collector
+  collectgarbage('stop')
+  gfxlib.recordGcTime(gfxlib.canvasTime() - start)
+end
+
+--- Start timing over after a deliberate pause between frames, such as waiting
+-- for a response, so the next frame isn't counted as dropped.
+function nexpo.timing.reset()
+  gfxlib.resetFrameTiming()
+end
+
+local captureStats = ffi.new 'CaptureStats'
+
+--- Record every frame shown to disk, exactly as it was drawn.
+-- Frames are copied back from the GPU a couple of frames after they're shown and
+-- written out on a background thread, so capturing doesn't hold up the display.
+-- If the disk can't keep up, frames are left out of the capture rather than
+-- shown late; check nexpo.capture.stats for dropped frames.
+-- Stops any capture already running. Capturing stops when the script ends.
+-- @param path The file to write. If it contains a frame number pattern such as
+-- %05d, each frame goes in its own TGA image named with its frame number (as from
+-- nexpo.timing.framecount). Otherwise frames go one after another into a single
+-- raw file of RGBA bytes with the rows from the top down and no header, which
+-- ffmpeg reads with -f rawvideo -pix_fmt rgba -s WIDTHxHEIGHT.
+-- @param queue The number of frames that can wait to be written before frames are
+-- dropped (default 8). Each takes width x height x 4 bytes of memory.
+-- @return true, or false if the capture couldn't be started
+-- @usage nexpo.capture.start('frames/trial1_%05d.tga')
+function nexpo.capture.start(path, queue)
+  assert(type(path) == 'string', 'expected a file name')
+  return gfxlib.startCapture(path, queue or 0)
+end
+
+--- Stop capturing, once the frames already read back have been written.
+-- @return The final stats, as from nexpo.capture.stats
+function nexpo.capture.stop()
+  gfxlib.stopCapture()
+  return nexpo.capture.stats()
+end
+
+--- How the current capture is going, or how the last one went.
+-- @return A table with fields frames (frames shown since capturing started),
+-- written, dropped (left out because the disk fell behind or the window changed
+-- size), failed (couldn't be written), queued (waiting to be written now),
+-- maxqueued, lastdropped (the number of the last frame dropped, or nil), width
+-- and height
+function nexpo.capture.stats()
+  gfxlib.captureStats(captureStats)
+  local s = captureStats
+  return {
+    frames = s.frames,
+    written = s.written,
+    dropped = s.dropped,
+    failed = s.failed,
+    queued = s.queued,
+    maxqueued = s.maxQueued,
+    lastdropped = s.lastDropped >= 0 and s.lastDropped or nil,
+    width = s.width,
+    height = s.height
+  }
+end
+
+-- Defined with the console functions below
+local unbufferConsole
+
+local function runFrames()
   while not gfxlib.shouldClose() and type(nexpo.graphics.onframe) == 'function' do
     updateWindowTransform()   -- TODO: only need to call this on window resize callback
+    gfxlib.waitForFrameStart()
+    gfxlib.beginFrame()
     nexpo.graphics.onframe(nexpo.graphics.time())
+    gfxlib.endFrame()
     sendControlData()
-    io.stdout:flush()
-    io.stderr:flush()
-    collectgarbage 'collect'
+    collectFrameGarbage()
     gfxlib.swapBuffers()
+    checkFrameTiming()
     pollEvents()
     checkInput()
   end
+end
+
+-- Errors from the script are reported by whatever ran it, so the console is
+-- unbuffered first to keep the report after the script's output
+local function unbufferOnError(e)
+  if type(e) == 'string' and __traceback then e = debug.traceback(e, 2) end
+  unbufferConsole()
+  return e
+end
+
+--- Start running a script. This should be the last line of every Nexpo script.
+-- It passes control to Nexpo, which will run the render loop and process user input.
+-- @see nexpo.stop
+-- @see nexpo.graphics.onframe
+function nexpo.start()
+  assert(type(nexpo.graphics.onframe) == 'function', 'Missing "nexpo.graphics.onframe" function, nothing to do')
+  startTime = gfxlib.canvasTime()
+  collectgarbage('collect')
+  setGcThreshold()
+  collectgarbage('stop')
 
+  local ok, err = xpcall(runFrames, unbufferOnError)
+
+  collectgarbage('restart')
   gfxlib.destroyCanvas()
+  unbufferConsole()
+  if not ok then error(err, 0) end
 end
 
 --- Stop running a script. This function can be called at any time to stop rendering.
@@ -581,8 +1142,7 @@ end
 
 function nexpo.mouse.pos()
   gfxlib.cursorPos(lastMousePos)
-  return lastMousePos[0] / windowPixelsPerUnit - windowCenterX,
-         lastMousePos[1] / windowPixelsPerUnit - windowCenterY 
+  return toCanvasPosition(lastMousePos[0], lastMousePos[1])
 end
 
 function nexpo.mouse.isdown(btn)
@@ -599,29 +1159,60 @@ function nexpo.graphics.time()
   end
 end
 
+-- Mesh bundle opened by nexpo.graphics.loadbundle, if any
+local meshBundle
+
+-- The SVG data or glyph each unmodified path was made from, which is what
+-- identifies it in a mesh bundle
+local pathSources = setmetatable({}, { __mode = 'k' })
+local fontFiles = setmetatable({}, { __mode = 'k' })
+
+local function bundledPath(source)
+  if not meshBundle then return nil end
+  local p = gfxlib.bundledPath(meshBundle, source)
+  if p == nil then return nil end
+  ffi.gc(p, gfxlib.freePath)
+  pathSources[p] = source
+  return p
+end
+
+local function glyphSource(font, codepoint)
+  local file = fontFiles[font]
+  return file and string.format('glyph:%s:%d', file, codepoint)
+end
+
 function nexpo.graphics.path(svg)
+  if type(svg) == 'string' then
+    local p = bundledPath(svg)
+    if p then return p end
+  end
+
   local p = gfxlib.newPath()
   assert(p ~= nil, "Couldn't create path object")
   ffi.gc(p, gfxlib.freePath)
 
   if type(svg) == 'string' then
-    loadsvg(p, svg)
+    nexpo.graphics.loadsvg(p, svg)
+    pathSources[p] = svg
   end
   return p
 end
 
 function nexpo.graphics.moveto(p, x, y)
   assert(p ~= nil, 'Missing path parameter')
+  pathSources[p] = nil
   gfxlib.moveTo(p, x, y)
 end
 
 function nexpo.graphics.lineto(p, x, y)
   assert(p ~= nil, 'Missing path parameter')
+  pathSources[p] = nil
   gfxlib.lineTo(p, x, y)
 end
 
 function nexpo.graphics.curveto(p, p1x, p1y, p2x, p2y, p3x, p3y)
   assert(p ~= nil, 'Missing path parameter')
+  pathSources[p] = nil
   if p3y then
     gfxlib.cubicCurveTo(p, p1x, p1y, p2x, p2y, p3x, p3y)
   elseif p2y then
@@ -636,8 +1227,91 @@ function nexpo.graphics.bgcolor(r, g, b, a)
   gfxlib.setClearColor(r, g, b, a or 0)
 end
 
+--- Set how closely curves in paths are approximated by straight line segments.
+-- Paths are re-flattened automatically when their on-screen scale changes enough
+-- to need a different level of detail.
+-- @param pixels Maximum distance in screen pixels between a curve and its approximation (default 0.25)
+function nexpo.graphics.curvetolerance(pixels)
+  assert(type(pixels) == 'number' and pixels > 0, 'tolerance must be a positive number')
+  gfxlib.setFlattenTolerance(pixels)
+end
+
+function nexpo.graphics.closepath(p)
+  assert(p ~= nil, 'Missing path parameter')
+  pathSources[p] = nil
+  gfxlib.closePath(p)
+end
+
+local fillModes = { tessellate = 0, stencil = 1 }
+local fillRules = { evenodd = 0, nonzero = 1 }
+
+--- Choose how a path is filled.
+-- 'tessellate' (the default) triangulates the path once and reuses the triangles,
+-- which is fastest for paths that don't change. 'stencil' skips triangulation and
+-- fills through the stencil buffer instead, which suits paths that change every frame.
+-- Stencil fills need the stencil_bits setting, otherwise they fall back to tessellation.
+-- @param path The path
+-- @param mode 'tessellate' or 'stencil'
+-- @param rule 'evenodd' (default) or 'nonzero', only used by stencil fills
+function nexpo.graphics.fillmode(path, mode, rule)
+  assert(isPath(path), 'Invalid path parameter')
+  local modeId = fillModes[mode]
+  local ruleId = fillRules[rule or 'evenodd']
+  assert(modeId, 'mode must be tessellate or stencil')
+  assert(ruleId, 'rule must be evenodd or nonzero')
+  gfxlib.setFillMode(path, modeId + (modeId > 0 and ruleId or 0))
+end
+
+local triangulators = { libtess2 = 0, poly2tri = 1 }
+
+--- Choose how filled paths are split into triangles, for all paths or just one.
+-- 'libtess2' (the default) is fastest and handles any path. 'poly2tri' makes
+-- well shaped triangles with no slivers, but only for paths whose outlines don't
+-- cross or touch; other paths are triangulated with libtess2 anyway.
+-- @param name 'libtess2' or 'poly2tri', or 'default' with a path to follow the global choice again
+-- @param path Optional, the path to set the triangulator of
+function nexpo.graphics.triangulator(name, path)
+  if path ~= nil then
+    assert(isPath(path), 'Invalid path parameter')
+    local id = name == 'default' and -1 or triangulators[name]
+    assert(id, 'triangulator must be libtess2, poly2tri or default')
+    gfxlib.setPathTriangulator(path, id)
+  else
+    local id = triangulators[name]
+    assert(id, 'triangulator must be libtess2 or poly2tri')
+    gfxlib.setTriangulator(id)
+  end
+end
+
+local strokeJoins = { miter = 0, round = 1, bevel = 2 }
+local strokeCaps = { butt = 0, round = 1, square = 2 }
+
+--- Set how corners and open ends of a path are drawn when it is stroked.
+-- The stroke width itself can be changed every frame at no cost.
+-- @param path The path to style
+-- @param join 'miter' (default), 'round' or 'bevel'
+-- @param cap 'butt' (default), 'round' or 'square'
+-- @param miterlimit Longest miter allowed, in stroke widths, before a bevel is used instead (default 4)
+function nexpo.graphics.strokestyle(path, join, cap, miterlimit)
+  assert(isPath(path), 'Invalid path parameter')
+  local joinId = strokeJoins[join or 'miter']
+  local capId = strokeCaps[cap or 'butt']
+  assert(joinId, 'join must be miter, round or bevel')
+  assert(capId, 'cap must be butt, round or square')
+  gfxlib.setStrokeStyle(path, joinId, capId, miterlimit or 4)
+end
+
+--- Append SVG path data (the "d" attribute of an SVG path element) to a path.
+-- All path commands are supported, both absolute and relative.
+-- @param path The path to append to
+-- @param str The path data, eg 'M 0,0 L 10,0 10,10 z'
 function nexpo.graphics.loadsvg(path, str)
-  gfxlib.appendSvgPath(path, str)
+  assert(type(str) == 'string', 'SVG path data must be a string')
+  pathSources[path] = nil
+  local errorOffset = gfxlib.appendSvgPath(path, str)
+  if errorOffset >= 0 then
+    error(string.format('Invalid SVG path data at character %d: %q', errorOffset + 1, str:sub(errorOffset + 1, errorOffset + 16)), 2)
+  end
 end
 
 
@@ -648,20 +1322,480 @@ function nexpo.graphics.loadfont(path)
     error('Error loading font ' .. path, 2)
   end
   ffi.gc(font, gfxlib.freeFont)
+  fontFiles[font] = path
   return font
 end
 
 function nexpo.graphics.codepoint(font, codepoint)
   assert(isFont(font), 'Invalid font parameter')
   assert(type(codepoint) == 'number', 'Invalid codepoint parameter (should be  a number)')
-  local path = gfxlib.pathForCodepoint(font, codepoint)
+  local source = glyphSource(font, codepoint)
+  local path = source and bundledPath(source)
+  if path then return path end
+
+  path = gfxlib.pathForCodepoint(font, codepoint)
   if path == nil then
     error('Error loading codepoint', 2)
   end
+  if source then pathSources[path] = source end
   return path
 end
 
 
+--- Build the meshes for many objects at once, using all CPU cores.
+-- Drawing a path for the first time (or at a very different size) has to
+-- flatten and triangulate it, which can stall the first frames when a script
+-- draws hundreds of paths. Call this after creating the objects to do that
+-- work up front. Objects whose shape is not a path are ignored.
+-- @param objects An array of objects, as passed to nexpo.graphics.draw
+-- @usage nexpo.graphics.prebuild(tigerparts)
+function nexpo.graphics.prebuild(objects)
+  assert(type(objects) == 'table', 'expected an array of objects')
+  local n = 0
+  for i=1,#objects do
+    if isPath(objects[i].shape) then n = n + 1 end
+  end
+  if n == 0 then return end
+
+  local paths = ffi.new('Path*[?]', n)
+  local scales = ffi.new('float[?]', n)
+  local widths = ffi.new('float[?]', n)
+  local j = 0
+  for i=1,#objects do
+    local obj = objects[i]
+    if isPath(obj.shape) then
+      paths[j] = obj.shape
+      scales[j] = objectPixelsPerUnit(obj)
+      widths[j] = obj.drawtype == 'stroke' and (obj.strokewidth or 1) or 0
+      j = j + 1
+    end
+  end
+  gfxlib.prebuildPathMeshes(paths, scales, widths, n)
+end
+
+-- Puts the objects with shapes from obj into list after index n, and returns
+-- the index of the last one
+local function collectPickable(obj, list, n)
+  if #obj > 0 then
+    for i=1,#obj do n = collectPickable(obj[i], list, n) end
+  elseif obj.shape ~= nil then
+    n = n + 1
+    list[n] = obj
+  end
+  return n
+end
+
+-- Objects and arrays passed to pickShape, grown as needed and reused so picking
+-- every frame doesn't allocate
+local pickList = {}
+local pickListCount = 0
+local pickCapacity = 0
+local pickShapes, pickPaths, pickTransforms, pickWidths, pickScales
+
+--- Find the object under a point, such as the mouse position.
+-- Objects are tested against the shapes they draw, taking their position,
+-- size and rotation into account, and later objects are treated as being on
+-- top of earlier ones, as when drawn in that order.
+-- @param objects An array of objects (or nested arrays), as passed to nexpo.graphics.draw
+-- @param x The x coordinate of the point
+-- @param y The y coordinate of the point
+-- @return The topmost object containing the point, or nil
+-- @usage local target = nexpo.graphics.pick(targets, nexpo.mouse.pos())
+function nexpo.graphics.pick(objects, x, y)
+  assert(type(objects) == 'table', 'expected an array of objects')
+  assert(type(x) == 'number' and type(y) == 'number', 'expected point coordinates')
+  local list = pickList
+  local n = collectPickable(objects, list, 0)
+  -- Clear what's left from a longer list, so it doesn't keep those objects alive
+  for i=n+1,pickListCount do list[i] = nil end
+  pickListCount = n
+  if n == 0 then return nil end
+
+  if n > pickCapacity then
+    pickCapacity = math.max(n, pickCapacity * 2)
+    pickShapes = ffi.new('int[?]', pickCapacity)
+    pickPaths = ffi.new('Path*[?]', pickCapacity)
+    pickTransforms = ffi.new('float[?]', pickCapacity * 5)
+    pickWidths = ffi.new('float[?]', pickCapacity)
+    pickScales = ffi.new('float[?]', pickCapacity)
+  end
+  local shapes, paths, transforms = pickShapes, pickPaths, pickTransforms
+  local widths, scales = pickWidths, pickScales
+
+  for i=1,n do
+    local obj = list[i]
+    local j = i - 1
+    if isPath(obj.shape) then
+      shapes[j] = 0
+      paths[j] = obj.shape
+    else
+      shapes[j] = assert(builtinShapes[obj.shape], 'Unknown shape field in object')
+      paths[j] = nil
+    end
+    transforms[j*5] = obj.width or obj.size or 1
+    transforms[j*5 + 1] = obj.height or obj.size or 1
+    transforms[j*5 + 2] = obj.rotation or 0
+    transforms[j*5 + 3] = obj.x or 0
+    transforms[j*5 + 4] = obj.y or 0
+    widths[j] = obj.drawtype == 'stroke' and (obj.strokewidth or 1) or 0
+    scales[j] = objectPixelsPerUnit(obj)
+  end
+
+  local hit = gfxlib.pickShape(x, y, n, shapes, paths, transforms, widths, scales)
+  if hit < 0 then return nil end
+  return list[hit + 1]
+end
+
+--- Load the shapes of a range of characters from a font, using all CPU cores.
+-- @param font A font returned by nexpo.graphics.loadfont
+-- @param first The first codepoint to load
+-- @param last The last codepoint to load
+-- @param size Optional size the characters will be drawn at. If given, their meshes are built too.
+-- @return A table of paths indexed by codepoint. Codepoints with no shape are missing.
+function nexpo.graphics.codepoints(font, first, last, size)
+  assert(isFont(font), 'Invalid font parameter')
+  assert(type(first) == 'number' and type(last) == 'number' and last >= first, 'Invalid codepoint range')
+  local result = {}
+  local codes = ffi.new('int[?]', last - first + 1)
+  local n = 0
+  for code=first,last do
+    local source = glyphSource(font, code)
+    result[code] = source and bundledPath(source)
+    if not result[code] then
+      codes[n] = code
+      n = n + 1
+    end
+  end
+  if n == 0 then return result end
+
+  local paths = ffi.new('Path*[?]', n)
+  local pixelsPerUnit = size and windowPixelsPerUnit * size or 0
+  gfxlib.pathsForCodepoints(font, codes, paths, n, pixelsPerUnit)
+
+  for i=0,n-1 do
+    if paths[i] ~= nil then
+      local path = ffi.gc(paths[i], gfxlib.freePath)
+      local source = glyphSource(font, codes[i])
+      if source then pathSources[path] = source end
+      result[codes[i]] = path
+    end
+  end
+  return result
+end
+
+--- Load prebuilt path geometry saved by nexpo.graphics.savebundle.
+-- Paths created afterwards by nexpo.graphics.path, codepoint or codepoints
+-- are taken from the bundle when it has them, skipping SVG parsing, glyph
+-- extraction and triangulation, so call this before creating any paths.
+-- @param filename The bundle file
+-- @return true if the bundle was loaded, false if it is missing or unreadable
+-- @usage
+-- local cached = nexpo.graphics.loadbundle('tiger.bundle')
+-- local tiger = maketiger()
+-- if not cached then nexpo.graphics.savebundle('tiger.bundle', tiger) end
+function nexpo.graphics.loadbundle(filename)
+  assert(type(filename) == 'string', 'Missing bundle filename')
+  local bundle = gfxlib.openMeshBundle(filename)
+  if bundle == nil then return false end
+  meshBundle = ffi.gc(bundle, gfxlib.closeMeshBundle)
+  return true
+end
+
+--- Save the geometry of objects' paths to a bundle for nexpo.graphics.loadbundle.
+-- Meshes are built for the size and draw type each object has now. Only paths
+-- made from SVG data or font glyphs, and not changed since, can be saved; other
+-- objects are skipped.
+-- @param filename The bundle file to write
+-- @param objects An array of objects (or nested arrays), as passed to nexpo.graphics.draw
+-- @return The number of objects saved
+function nexpo.graphics.savebundle(filename, objects)
+  assert(type(filename) == 'string', 'Missing bundle filename')
+  assert(type(objects) == 'table', 'expected an array of objects')
+  local list = {}
+  collectPickable(objects, list, 0)
+
+  local writer = ffi.gc(gfxlib.newMeshBundleWriter(), gfxlib.freeMeshBundleWriter)
+  local saved = 0
+  for i=1,#list do
+    local obj = list[i]
+    local source = isPath(obj.shape) and pathSources[obj.shape]
+    if source then
+      local width = obj.drawtype == 'stroke' and (obj.strokewidth or 1) or 0
+      saved = saved + gfxlib.addToMeshBundle(writer, source, obj.shape, objectPixelsPerUnit(obj), width)
+    end
+  end
+  if gfxlib.writeMeshBundle(writer, filename) == 0 then
+    error('Error writing bundle ' .. filename, 2)
+  end
+  return saved
+end
+
+-- Objects and styles in a scene are turned into proxies: their fields are moved
+-- to a hidden table, so that every assignment goes through __newindex and can
+-- mark the scene nodes that use them as needing an update.
+local sceneProxies = setmetatable({}, { __mode = 'k' })
+local sceneForObject = setmetatable({}, { __mode = 'kv' })
+
+local function proxyTable(t, owner)
+  local proxy = sceneProxies[t]
+  if not proxy then
+    if getmetatable(t) then
+      error('Tables with metatables can\'t be added to a scene', 3)
+    end
+    local fields = {}
+    for k, v in pairs(t) do fields[k] = v end
+    for k in pairs(fields) do t[k] = nil end
+
+    local owners = setmetatable({}, { __mode = 'k' })
+    proxy = { fields = fields, owners = owners }
+    sceneProxies[t] = proxy
+    setmetatable(t, {
+      __index = fields,
+      __newindex = function(_, k, v)
+        fields[k] = v
+        for entry in pairs(owners) do
+          entry.scene.dirty[entry] = true
+        end
+      end
+    })
+  end
+  proxy.owners[owner] = true
+end
+
+local function unproxyTable(t, owner)
+  local proxy = sceneProxies[t]
+  if not proxy then return end
+  proxy.owners[owner] = nil
+  if next(proxy.owners) == nil then
+    setmetatable(t, nil)
+    for k, v in pairs(proxy.fields) do t[k] = v end
+    sceneProxies[t] = nil
+  end
+end
+
+local sceneParam = ffi.new('float[4]')
+local sceneView = ffi.new('float[5]')
+
+local function setSceneParam(entry, index, value)
+  local size
+  if type(value) == 'number' then
+    sceneParam[0] = value
+    size = 1
+  elseif type(value) == 'table' and #value >= 1 and #value <= 4 then
+    for i=1,#value do sceneParam[i - 1] = value[i] end
+    size = #value
+  else
+    error(string.format('Invalid value for parameter %s', entry.shader.varnames[index]), 4)
+  end
+  gfxlib.setSceneNodeParam(entry.scene.handle, entry.node, index, size, sceneParam)
+end
+
+-- Copy an object's fields to its scene node
+local function syncSceneEntry(entry)
+  local obj = entry.object
+  local handle, node = entry.scene.handle, entry.node
+
+  local shape = obj.shape
+  local shapeId = isPath(shape) and 0 or builtinShapes[shape]
+  if not shapeId then
+    error('Unknown shape field in object', 3)
+  end
+  local strokewidth = obj.drawtype == 'stroke' and (obj.strokewidth or 1) or 0
+  if strokewidth ~= 0 and shapeId ~= 0 then
+    error('Only paths can be stroked in a scene', 3)
+  end
+  gfxlib.setSceneNodeShape(handle, node, shapeId, shapeId == 0 and shape or nil, strokewidth)
+  gfxlib.setSceneNodeTransform(handle, node, obj.width or obj.size or 1, obj.height or obj.size or 1,
+                               obj.rotation or 0, obj.x or 0, obj.y or 0)
+
+  local style = obj.style
+  if style ~= entry.style then
+    if entry.style then unproxyTable(entry.style, entry) end
+    if style then proxyTable(style, entry) end
+    entry.style = style
+  end
+
+  local name = style and style.shader or 'color'
+  local shader = shaderForName[name] or loadShaderFromDisk(name)
+  entry.shader = shader
+  gfxlib.setSceneNodeShader(handle, node, shader.id)
+  for i=0,#shader.varnames do
+    if i ~= shader.transformLocation then
+      local varname = shader.varnames[i]
+      local value = (style and style[varname]) or shader.defaults[varname]
+      if value then
+        setSceneParam(entry, i, value)
+      end
+    end
+  end
+end
+
+--- Create a scene, a set of objects that are drawn together by nexpo.graphics.drawscene.
+-- Objects are added once, and only those that have changed since the last frame
+-- are looked at again when the scene is drawn; the rest are redrawn from what
+-- was recorded for them. This makes drawing large, mostly static displays much
+-- cheaper than calling nexpo.graphics.draw on every object each frame.
+-- @return A new, empty scene
+-- @usage
+-- local scene = nexpo.graphics.scene()
+-- nexpo.graphics.addtoscene(scene, targets)
+-- function nexpo.graphics.onframe() nexpo.graphics.drawscene(scene) end
+function nexpo.graphics.scene()
+  return {
+    handle = ffi.gc(gfxlib.newScene(), gfxlib.freeScene),
+    entries = {},
+    dirty = {}
+  }
+end
+
+--- Add objects to a scene.
+-- Changes made afterwards by assigning to an object's fields, or to the fields of
+-- its style, are picked up the next time the scene is drawn. Changes made inside
+-- a field's value, such as setting one component of a color table, are not: assign
+-- a new table instead. Objects in a scene can't be iterated with pairs until they
+-- are removed from it, and an object can only be in one scene at a time. Scenes
+-- can hold paths, filled rects and filled circles.
+-- @param scene A scene from nexpo.graphics.scene
+-- @param objects An object, or an array of objects (or nested arrays)
+function nexpo.graphics.addtoscene(scene, objects)
+  assert(type(objects) == 'table', 'expected an object or array of objects')
+  local list = {}
+  collectPickable(objects, list, 0)
+
+  for i=1,#list do
+    local obj = list[i]
+    local owner = sceneForObject[obj]
+    if not owner then
+      local entry = { scene = scene, object = obj, node = gfxlib.addSceneNode(scene.handle) }
+      proxyTable(obj, entry)
+      scene.entries[obj] = entry
+      scene.dirty[entry] = true
+      sceneForObject[obj] = scene
+    elseif owner ~= scene then
+      error('Object is already in another scene', 2)
+    end
+  end
+end
+
+--- Remove objects from a scene. Objects not in the scene are ignored.
+-- @param scene A scene from nexpo.graphics.scene
+-- @param objects An object, or an array of objects (or nested arrays)
+function nexpo.graphics.removefromscene(scene, objects)
+  assert(type(objects) == 'table', 'expected an object or array of objects')
+  local list = {}
+  collectPickable(objects, list, 0)
+
+  for i=1,#list do
+    local obj = list[i]
+    local entry = scene.entries[obj]
+    if entry then
+      gfxlib.removeSceneNode(scene.handle, entry.node)
+      scene.entries[obj] = nil
+      sceneForObject[obj] = nil
+      scene.dirty[entry] = nil
+      if entry.style then unproxyTable(entry.style, entry) end
+      unproxyTable(obj, entry)
+    end
+  end
+end
+
+--- Draw every object in a scene.
+-- Objects are drawn in the order they were added, except that an object may
+-- take the place of one removed earlier.
+-- @param scene A scene from nexpo.graphics.scene
+function nexpo.graphics.drawscene(scene)
+  for entry in pairs(scene.dirty) do
+    syncSceneEntry(entry)
+  end
+  scene.dirty = {}
+
+  sceneView[0] = windowScaleX
+  sceneView[1] = windowScaleY
+  sceneView[2] = windowCenterX
+  sceneView[3] = windowCenterY
+  sceneView[4] = windowPixelsPerUnit
+  gfxlib.drawScene(scene.handle, sceneView)
+end
+
+local sequenceReport = ffi.new 'SequenceReport'
+
+--- Create a sequence of frames to be drawn ahead of time and played back later,
+-- for stimuli that take too long to draw within one refresh, such as dense noise
+-- movies. Frames are kept in GPU memory up to a limit, then in a memory mapped
+-- store that's uploaded to the GPU during playback. Frames are the size of the
+-- window when the sequence is made.
+-- @param frames The number of frames
+-- @param gpumemory Megabytes of GPU memory the frames may take (default 1024)
+-- @return The sequence, or nil if it couldn't be made
+-- @see nexpo.graphics.drawsequence
+-- @see nexpo.graphics.playsequence
+function nexpo.graphics.sequence(frames, gpumemory)
+  assert(type(frames) == 'number' and frames >= 1, 'expected a number of frames')
+  local handle = gfxlib.newSequence(frames, gpumemory or 1024)
+  if handle == nil then return nil end
+  return {
+    handle = ffi.gc(handle, gfxlib.freeSequence),
+    frames = frames
+  }
+end
+
+--- Draw every frame of a sequence. Calls draw(i) for frames 1 to the sequence's
+-- length, which draws the frame as onframe would, and keeps what it drew. Nothing
+-- is shown while the frames are being drawn.
+-- @param sequence A sequence from nexpo.graphics.sequence
+-- @param draw A function that draws frame i
+-- @return true, or false if a frame couldn't be kept
+function nexpo.graphics.drawsequence(sequence, draw)
+  assert(type(draw) == 'function', 'expected a function to draw each frame')
+  for i=1,sequence.frames do
+    updateWindowTransform()
+    draw(i)
+    if not gfxlib.storeSequenceFrame(sequence.handle, i - 1) then
+      return false
+    end
+    pollEvents()
+  end
+  return true
+end
+
+--- Show frames of a sequence, one per refresh, then return.
+-- Playback doesn't run any Lua, so nothing the script does can delay a frame.
+-- Call it from onframe: the frames are shown in place of the frame being drawn,
+-- and anything onframe draws after it returns is shown on the next refresh.
+-- Refreshes missed are only detected with vertical sync on.
+-- @param sequence A sequence from nexpo.graphics.sequence, with its frames drawn
+-- @param first The first frame to show (default 1)
+-- @param last The last frame to show (default the end of the sequence)
+-- @return A table with fields shown (frames shown, fewer than asked for if the
+-- window was closed), firstframe (the frame number of the first, as from
+-- nexpo.timing.framecount), late (refreshes the first frame missed), repeated (frames
+-- left up for more than one refresh, not counting the last), missed (the extra
+-- refreshes they were left up for), onset (when the first frame was shown, as from
+-- nexpo.graphics.time), duration (seconds from the first frame to the last), and
+-- exact (true if every frame was shown, on time, for exactly one refresh)
+-- @usage
+-- local report = nexpo.graphics.playsequence(movie)
+-- if not report.exact then repeatTrial() end
+function nexpo.graphics.playsequence(sequence, first, last)
+  first = first or 1
+  last = last or sequence.frames
+  local count = last - first + 1
+  if not gfxlib.playSequence(sequence.handle, first - 1, count, sequenceReport) then
+    return nil
+  end
+  local r = sequenceReport
+  return {
+    shown = r.shown,
+    firstframe = r.firstFrame,
+    late = r.late,
+    repeated = r.repeated,
+    missed = r.missed,
+    onset = r.onset - (startTime or 0),
+    duration = r.duration,
+    exact = r.shown == count and r.late == 0 and r.repeated == 0
+  }
+end
+
 -------
 
 -- Convenience functions for particular shape/style combinations
@@ -717,75 +1851,88 @@ end
 -- a callback whenever a mouse button is pressed.
 -- @param button An integer representing the button pressed (1 = left, 2 = right, 3 = middle)
 -- @param modifiers Table with boolean flags of keyboard modifiers that were pressed at the time.
+-- @param time When the button was pressed, to within the frame start margin, as from nexpo.graphics.time
+-- @param x x coordinate of the mouse cursor when it was pressed
+-- @param y y coordinate of the mouse cursor when it was pressed
 -- @see nexpo.mouse.onup
 -- @see nexpo.mouse.onmove
 -- @see nexpo.mouse.onscroll
-function nexpo.mouse.ondown(button, modifiers) end
+function nexpo.mouse.ondown(button, modifiers, time, x, y) end
 
 --- Mouse button up callback function. Implement this function to receive
 -- a callback whenever a mouse button is released.
 -- @param button An integer representing the button pressed (1 = left, 2 = right, 3 = middle)
 -- @param modifiers Table with boolean flags of keyboard modifiers that were pressed at the time.
+-- @param time When the button was released, to within the frame start margin, as from nexpo.graphics.time
+-- @param x x coordinate of the mouse cursor when it was released
+-- @param y y coordinate of the mouse cursor when it was released
 -- @see nexpo.mouse.ondown
 -- @see nexpo.mouse.onmove
 -- @see nexpo.mouse.onscroll
-function nexpo.mouse.onup(button, modifiers) end
+function nexpo.mouse.onup(button, modifiers, time, x, y) end
 
 --- Mouse move callback function. Implement this function to receive
--- a callback whenever the mouse position changes.
--- @param x x coordinate of the mouse cursor
+-- a callback whenever the mouse position changes. It's called for every
+-- movement reported since the last frame, in order, before onframe.
+-- @param x x coordinate of the mouse cursor, as from nexpo.mouse.pos
 -- @param y y coordinate of the mouse cursor
+-- @param time When the mouse moved, to within the frame start margin, as from nexpo.graphics.time
 -- @see nexpo.mouse.onup
 -- @see nexpo.mouse.ondown
 -- @see nexpo.mouse.onscroll
-function nexpo.mouse.onmove(x, y) end
+function nexpo.mouse.onmove(x, y, time) end
 
 --- Mouse scroll wheel callback function. Implement this function to receive
 -- a callback whenever the mousewheel is scrolled.
 -- @param yoffset Scroll amount in the vertical direction
 -- @param xoffset Scroll amount in the horizontal direction
+-- @param time When the wheel was scrolled, to within the frame start margin, as from nexpo.graphics.time
 -- @see nexpo.mouse.onup
 -- @see nexpo.mouse.ondown
 -- @see nexpo.mouse.onmove
-function nexpo.mouse.onscroll(yoffset, xoffset) end
+function nexpo.mouse.onscroll(yoffset, xoffset, time) end
 
 --- Keyboard button down callback function. Implement this function to receive
 -- a callback whenever a key is pressed.
 -- @param keyname A string representation of the key name, eg 'a' or 'left_shift'
 -- @param scancode Scancode of the key
 -- @param modifiers Table with boolean flags of keyboard modifiers that were pressed at the time.
+-- @param time When the key was pressed, to within the frame start margin, as from nexpo.graphics.time
 -- @see nexpo.key.onup
 -- @see nexpo.key.onrepeat
 -- @see nexpo.key.onchar
-function nexpo.key.ondown(keyname, scancode, modifiers) end
+function nexpo.key.ondown(keyname, scancode, modifiers, time) end
 
 --- Keyboard button down callback function. Implement this function to receive
 -- a callback whenever a key is pressed.
 -- @param keyname A string representation of the key name, eg 'a' or 'left_shift'
 -- @param scancode Scancode of the key
 -- @param modifiers Table with boolean flags of keyboard modifiers that were pressed at the time.
+-- @param time When the key was released, to within the frame start margin, as from nexpo.graphics.time
 -- @see nexpo.key.ondown
 -- @see nexpo.key.onrepeat
 -- @see nexpo.key.onchar
-function nexpo.key.onup(keyname, scancode, modifiers) end
+function nexpo.key.onup(keyname, scancode, modifiers, time) end
 
 --- Keyboard button repeat callback function. Implement this function to receive
 -- a callback whenever a key has been held down and is producing repeated characters.
 -- @param keyname A string representation of the key name, eg 'a' or 'left_shift'
 -- @param scancode Scancode of the key
 -- @param modifiers Table with boolean flags of keyboard modifiers that were pressed at the time.
+-- @param time When the key repeated, to within the frame start margin, as from nexpo.graphics.time
 -- @see nexpo.key.onup
 -- @see nexpo.key.ondown
 -- @see nexpo.key.onchar
-function nexpo.key.onrepeat(keyname, scancode, modifiers) end
+function nexpo.key.onrepeat(keyname, scancode, modifiers, time) end
 
 --- Keyboard unicode character function. Implement this function to receive
 -- a callback with the unicode codepoint value when a key is pressed.
 -- @param codepoint The unicode codepoint of the key pressed
+-- @param time When the character was typed, to within the frame start margin, as from nexpo.graphics.time
 -- @see nexpo.key.ondown
 -- @see nexpo.key.onup
 -- @see nexpo.key.onrepeat
-function nexpo.key.onchar(codepoint) end
+function nexpo.key.onchar(codepoint, time) end
 
 
 local modifierTable = {
@@ -803,44 +1950,84 @@ local function getModifiers(m)
     return modifierTable
 end
 
+-- Event times on the nexpo.graphics.time clock
+local function eventTime(event)
+  return event.time - (startTime or 0)
+end
+
 local namesForKeys
-local function keyCallback(key, scancode, action, modifierMask)
+local function keyEvent(event)
   if namesForKeys == nil then
     namesForKeys = require 'namesForKeys'
   end
 
-  local keyname = namesForKeys[key] or key
-  local mods = getModifiers(modifierMask)
+  local keyname = namesForKeys[event.code] or event.code
+  local mods = getModifiers(event.mods)
+  local action = event.action
   if action == 0 then
-    if nexpo.key.onup then nexpo.key.onup(keyname, scancode, mods) end
+    if nexpo.key.onup then nexpo.key.onup(keyname, event.scancode, mods, eventTime(event)) end
   elseif action == 1 then
-    if nexpo.key.ondown then nexpo.key.ondown(keyname, scancode, mods) end
+    if nexpo.key.ondown then nexpo.key.ondown(keyname, event.scancode, mods, eventTime(event)) end
   elseif action == 2 then
-    if nexpo.key.onrepeat then nexpo.key.onrepeat(keyname, scancode, mods) end
+    if nexpo.key.onrepeat then nexpo.key.onrepeat(keyname, event.scancode, mods, eventTime(event)) end
   end
 
 end
 
-local function cursorPosCallback(x, y)
-  if nexpo.mouse.onmove then nexpo.mouse.onmove(x, y) end
+local function cursorEvent(event)
+  if nexpo.mouse.onmove then
+    local x, y = toCanvasPosition(event.x, event.y)
+    nexpo.mouse.onmove(x, y, eventTime(event))
+  end
 end
 
-local function scrollCallback(xoffset, yoffset)
+local function scrollEvent(event)
   -- NOTE: parameter order reversed on purpose
-  if nexpo.mouse.onscroll then nexpo.mouse.onscroll(yoffset, xoffset) end
+  if nexpo.mouse.onscroll then nexpo.mouse.onscroll(event.y, event.x, eventTime(event)) end
 end
 
-local function charCallback(codepoint)
-  if nexpo.key.onchar then nexpo.key.onchar(codepoint) end
+local function charEvent(event)
+  if nexpo.key.onchar then nexpo.key.onchar(event.code, eventTime(event)) end
 end
 
-local function mouseButtonCallback(button, action, modifierMask)
-  local mods = getModifiers(modifierMask)
-  local btn = button + 1    -- GLFW starts button numbers at 0
-  if action == 1 then
-    if nexpo.mouse.ondown then nexpo.mouse.ondown(btn, mods) end
+local function mouseButtonEvent(event)
+  local mods = getModifiers(event.mods)
+  local btn = event.code + 1    -- GLFW starts button numbers at 0
+  local x, y = toCanvasPosition(event.x, event.y)
+  if event.action == 1 then
+    if nexpo.mouse.ondown then nexpo.mouse.ondown(btn, mods, eventTime(event), x, y) end
   else
-    if nexpo.mouse.onup then nexpo.mouse.onup(btn, mods) end
+    if nexpo.mouse.onup then nexpo.mouse.onup(btn, mods, eventTime(event), x, y) end
+  end
+end
+
+-- Indexed by InputEventType
+local inputEventHandlers = {
+  [0] = keyEvent,
+  [1] = charEvent,
+  [2] = mouseButtonEvent,
+  [3] = scrollEvent,
+  [4] = cursorEvent
+}
+
+local kInputEventBatch = 256
+local inputEvents = ffi.new('InputEvent[?]', kInputEventBatch)
+local inputEventsDropped = 0
+
+function dispatchInputEvents()
+  local n
+  repeat
+    n = gfxlib.takeInputEvents(inputEvents, kInputEventBatch)
+    for i=0,n-1 do
+      local event = inputEvents[i]
+      inputEventHandlers[event.type](event)
+    end
+  until n < kInputEventBatch
+
+  local dropped = gfxlib.droppedInputEvents()
+  if dropped ~= inputEventsDropped then
+    warn('Warning: ' .. (dropped - inputEventsDropped) .. ' input events were dropped because the queue was full')
+    inputEventsDropped = dropped
   end
 end
 
@@ -872,6 +2059,7 @@ end
 local function setWindowHints(settings)
   local hints = {
     samples = 0x0002100D,
+    stencil_bits = 0x00021006,
     refresh_rate = 0x0002100F,
     resizable = 0x00020003,
     decorated = 0x00020005,
@@ -1053,6 +2241,103 @@ function nexpo.console.dumpshort(...)
     if output and #output > 0 then print(output) end
 end
 
+local consoleOverflowPolicies = { drop = 0, truncate = 1, block = 2 }
+local consoleBufferBytes
+
+--- Choose what happens to console output written faster than the IDE can show it.
+-- Output is buffered so that printing never holds up a frame; this decides what
+-- happens when the buffer is full. The default is set by console_overflow in settings.lua.
+-- @param policy 'drop' to drop whole writes that don't fit, 'truncate' to keep as
+-- much of them as fits, or 'block' to wait for room, which can make frames late
+-- @see nexpo.console.dropped
+function nexpo.console.overflow(policy)
+  local overflow = consoleOverflowPolicies[policy]
+  assert(overflow, "policy must be 'drop', 'truncate' or 'block'")
+  gfxlib.setConsoleBuffer(consoleBufferBytes, overflow)
+end
+
+--- Get the number of bytes of console output dropped because the buffer was full.
+-- @return The number of bytes dropped since the script started
+-- @see nexpo.console.overflow
+function nexpo.console.dropped()
+  return gfxlib.droppedConsoleBytes()
+end
+
+--- Wait for buffered console output to be written.
+-- @param timeout Optional seconds to wait, 1 by default
+-- @return true if everything was written in time
+function nexpo.console.flush(timeout)
+  return gfxlib.flushConsole(timeout or 1)
+end
+
+-- Writes like io.write, into gfxlib's console buffer
+local function writeConsole(stream, ...)
+  for i=1,select('#', ...) do
+    local s = select(i, ...)
+    if type(s) == 'number' then
+      s = tostring(s)
+    elseif type(s) ~= 'string' then
+      error(string.format("bad argument #%d to 'write' (string expected, got %s)", i, type(s)), 3)
+    end
+    gfxlib.writeConsole(stream, s, #s)
+  end
+end
+
+local function consoleFile(stream)
+  local file = {}
+  function file:write(...)
+    writeConsole(stream, ...)
+    return self
+  end
+  function file:flush()
+    gfxlib.flushConsole(1)
+    return true
+  end
+  function file:setvbuf() return true end
+  function file:close() return nil, 'cannot close standard file' end
+  return setmetatable(file, { __tostring = function() return 'file (console)' end })
+end
+
+local unbufferedConsole
+
+-- Sends print, io.write, io.stdout and io.stderr through the console buffer
+local function bufferConsole(settings)
+  consoleBufferBytes = (settings.console_buffer_kb or 1024) * 1024
+  local overflow = consoleOverflowPolicies[settings.console_overflow or 'drop']
+  if not overflow then
+    warn("Unknown console_overflow setting, using 'drop'")
+    overflow = consoleOverflowPolicies.drop
+  end
+  gfxlib.setConsoleBuffer(consoleBufferBytes, overflow)
+
+  unbufferedConsole = { print = print, write = io.write, stdout = io.stdout, stderr = io.stderr }
+  io.stdout = consoleFile(1)
+  io.stderr = consoleFile(2)
+  io.write = function(...)
+    writeConsole(1, ...)
+    return io.stdout
+  end
+  print = function(...)
+    local n = select('#', ...)
+    local parts = {...}
+    for i=1,n do parts[i] = tostring(parts[i]) end
+    local line = table.concat(parts, '\t', 1, n) .. '\n'
+    gfxlib.writeConsole(1, line, #line)
+  end
+end
+
+-- Writes what's left in the console buffer and puts back the standard streams, so
+-- anything written about the script ending comes after the script's own output
+function unbufferConsole()
+  if not unbufferedConsole then return end
+  gfxlib.stopConsole()
+  print = unbufferedConsole.print
+  io.write = unbufferedConsole.write
+  io.stdout = unbufferedConsole.stdout
+  io.stderr = unbufferedConsole.stderr
+  unbufferedConsole = nil
+end
+
 
 
 
@@ -1065,7 +2350,15 @@ local function init()
     ffi.cdef(ffi.string(sig))
   end
 
+  -- Live controls go through shared memory when the IDE provides it
+  controlChannel = gfxlib.openControlChannel()
+
   local settings = loadsettings()
+  bufferConsole(settings)
+  nexpo.timing.gc(settings.gc_budget_ms and settings.gc_budget_ms / 1000,
+                  settings.gc_margin_ms and settings.gc_margin_ms / 1000,
+                  settings.gc_growth)
+  gfxlib.setFrameStartMargin(settings.frame_start_margin_ms and settings.frame_start_margin_ms / 1000 or -1)
   setWindowHints(settings)
 
   local width, height
@@ -1077,14 +2370,22 @@ local function init()
     height = settings.window_height
   end
 
-  gfxlib.createCanvas(
-    width,
-    height,
-    settings.title,
-    settings.fullscreen,
-    settings.vsync,
-    lookupMonitor(settings.monitor),
-    0)
+  -- Offscreen canvases need no display, for running scripts on servers
+  if settings.offscreen or os.getenv('NEXPO_OFFSCREEN') then
+    if not gfxlib.createOffscreenCanvas(settings.window_width, settings.window_height,
+                                        settings.samples or 16, settings.stencil_bits or 0) then
+      error 'Unable to create offscreen canvas'
+    end
+  else
+    gfxlib.createCanvas(
+      width,
+      height,
+      settings.title,
+      settings.fullscreen,
+      settings.vsync,
+      lookupMonitor(settings.monitor),
+      0)
+  end
 
   if settings.gamma_ramp then
     assert(type(settings.gamma_ramp) == 'table', 'Error: gamma_ramp setting must be a table')
@@ -1095,13 +2396,6 @@ local function init()
   if settings.window_x and settings.window_y then
     nexpo.window.pos(settings.window_x, settings.window_y)
   end
-
-  gfxlib.setKeyCallback(keyCallback)
-  gfxlib.setScrollCallback(scrollCallback)
-  gfxlib.setCharCallback(charCallback)
-  --gfxlib.setCursorPosCallback(cursorPosCallback)
-  gfxlib.setMouseButtonCallback(mouseButtonCallback)
-
 end
 
 init()
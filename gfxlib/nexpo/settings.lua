@@ -20,9 +20,38 @@ fullscreen_height = 0
 -- Set true for fullscreen, false for windowed
 -- fullscreen = true
 
+-- Set true to draw offscreen at window_width x window_height, without opening a
+-- window. Needs no display server, so scripts can run on servers and build machines.
+-- Setting the NEXPO_OFFSCREEN environment variable does the same.
+-- offscreen = true
+
+-- Console output is buffered so printing never holds up a frame. When output comes
+-- faster than the IDE can show it and the buffer fills, 'drop' drops whole writes,
+-- 'truncate' keeps as much of each as fits, and 'block' waits for room.
+-- console_overflow = 'drop'
+-- console_buffer_kb = 1024
+
+-- Garbage is collected a little at a time after each frame is drawn, in the time
+-- left before it's shown. At most gc_budget_ms is spent per frame, stopping
+-- gc_margin_ms before the refresh. A full collection is made when memory grows
+-- by gc_growth times since the last collection finished.
+-- gc_budget_ms = 2
+-- gc_margin_ms = 2
+-- gc_growth = 2
+
+-- onframe is called a margin before the refresh its frame is meant for, judged
+-- from how long recent frames took, and input events are polled every millisecond
+-- while waiting, so their times are accurate to about the margin. Set
+-- frame_start_margin_ms to fix the margin, or to 0 to call onframe as soon as the
+-- last frame is swapped. Needs vsync.
+-- frame_start_margin_ms = 8
+
 -- Samples per pixel for multisample antialiasing
 samples = 16
 
+-- Bits per pixel of stencil buffer, needed by paths using the 'stencil' fill mode
+-- stencil_bits = 8
+
 -- Override default monitor gamma value, only applies when fullscreen
 gamma = 2.2
 
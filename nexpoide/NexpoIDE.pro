@@ -16,6 +16,9 @@ VERSION = 14.5.9
 
 DEFINES += APP_VERSION=\\\"$$VERSION\\\"
 
+# The control channel's message format is shared with gfxlib
+INCLUDEPATH += $$_PRO_FILE_PWD_/../gfxlib/gfxlib
+
 # Disable debug output on release builds
 #CONFIG(release,debug|release):DEFINES += QT_NO_DEBUG_OUTPUT
 
@@ -40,7 +43,8 @@ SOURCES += \
     closetoolbutton.cpp \
     checkboxcontrol.cpp \
     updateinfowidget.cpp \
-    jsonfetcher.cpp
+    jsonfetcher.cpp \
+    controlchannel.cpp
 
 HEADERS += \
     mainwindow.h \
@@ -62,7 +66,9 @@ HEADERS += \
     closetoolbutton.h \
     checkboxcontrol.h \
     updateinfowidget.h \
-    jsonfetcher.h
+    jsonfetcher.h \
+    controlchannel.h \
+    ../gfxlib/gfxlib/controlprotocol.h
 
 FORMS += \
     mainwindow.ui \
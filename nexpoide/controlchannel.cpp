@@ -0,0 +1,43 @@
+#include "controlchannel.h"
+#include <QDir>
+
+ControlChannel::ControlChannel()
+    : m_file(QDir::tempPath() + QStringLiteral("/nexpocontrols"))
+    , m_data(0)
+{
+}
+
+ControlChannel::~ControlChannel()
+{
+    if (m_data) m_file.unmap(m_data);
+}
+
+bool ControlChannel::open()
+{
+    if (!m_file.open()) return false;
+    if (!m_file.resize(kControlChannelBytes)) return false;
+    m_data = m_file.map(0, kControlChannelBytes);
+    if (!m_data) return false;
+
+    memset(m_data, 0, kControlChannelBytes);
+    initControlChannel(header());
+    return true;
+}
+
+QString ControlChannel::path() const
+{
+    return m_file.fileName();
+}
+
+bool ControlChannel::read(ControlMessage* message)
+{
+    if (!m_data) return false;
+    return readControlMessage(&header()->toIde, reinterpret_cast<const char*> (m_data + kControlToIdeOffset), message);
+}
+
+bool ControlChannel::sendNumber(quint32 id, double value)
+{
+    if (!m_data) return false;
+    return writeControlMessage(&header()->toPlayer, reinterpret_cast<char*> (m_data + kControlToPlayerOffset),
+                               CONTROL_NUMBER, id, &value, 1, 0, 0);
+}
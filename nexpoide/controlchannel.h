@@ -0,0 +1,30 @@
+#ifndef CONTROLCHANNEL_H
+#define CONTROLCHANNEL_H
+
+#include <QTemporaryFile>
+#include "controlprotocol.h"
+
+// The IDE's end of the live control channel described in gfxlib's controlprotocol.h.
+// Each player process gets a channel of its own, in a temporary file that's removed
+// when the channel is deleted.
+class ControlChannel
+{
+public:
+    ControlChannel();
+    ~ControlChannel();
+
+    // Creates and maps the file. Pass path() to the player before starting it.
+    bool open();
+    QString path() const;
+
+    bool read(ControlMessage* message);
+    bool sendNumber(quint32 id, double value);
+
+private:
+    QTemporaryFile m_file;
+    uchar* m_data;
+
+    ControlChannelHeader* header() const { return reinterpret_cast<ControlChannelHeader*> (m_data); }
+};
+
+#endif // CONTROLCHANNEL_H
@@ -9,6 +9,7 @@
 #include "sliderwithspinner.h"
 #include "linkbutton.h"
 #include "timeseriesplot.h"
+#include "controlchannel.h"
 
 #include <QFileDialog>
 #include <QSettings>
@@ -23,6 +24,7 @@
 #include <QDateTime>
 #include <QMimeData>
 #include <QCompleter>
+#include <QTimer>
 #include <iostream>
 
 static const char kControlPrefix = '\x05';
@@ -32,6 +34,7 @@ MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::MainWindow)
     , m_scriptProcess(0)
+    , m_controlChannel(0)
     , m_currentEditor(0)
     , m_scriptStatusWidget(0)
     , m_helpData(0)
@@ -106,6 +109,11 @@ MainWindow::MainWindow(QWidget *parent)
     // Set initial state of central widget
     showCentralWidget();
 
+    // Poll the control channel a few times a frame
+    m_controlTimer = new QTimer(this);
+    m_controlTimer->setInterval(5);
+    connect(m_controlTimer, &QTimer::timeout, this, &MainWindow::readControlChannel);
+
     // Create process to run scripts
     startScriptProcess();
 
@@ -117,6 +125,7 @@ MainWindow::~MainWindow()
 {
     delete ui;
     delete m_helpData;
+    delete m_controlChannel;
 }
 
 // Returns true if all tabs close, false if user cancelled
@@ -674,6 +683,22 @@ void MainWindow::startScriptProcess()
     // Auto start a new process when existing one finishes
     connect(m_scriptProcess, &QProcess::stateChanged, this, &MainWindow::scriptProcessStateChanged);
 
+    // Give the process its own control channel. Without one, controls go through
+    // the pipe with the console text.
+    delete m_controlChannel;
+    m_controlChannel = new ControlChannel;
+    if (m_controlChannel->open()) {
+        QProcessEnvironment env = QProcessEnvironment::systemEnvironment();
+        env.insert(kControlChannelVariable, m_controlChannel->path());
+        m_scriptProcess->setProcessEnvironment(env);
+        m_controlTimer->start();
+    } else {
+        std::cerr << "Warning: couldn't create the control channel, controls will be slower" << std::endl;
+        delete m_controlChannel;
+        m_controlChannel = 0;
+        m_controlTimer->stop();
+    }
+
     // Start process
     m_scriptProcess->start(playerPath);
 }
@@ -704,11 +729,17 @@ void MainWindow::handleControlCommand(QByteArray cmd)
     }
 
     if (op == QByteArrayLiteral("numbervalue")) {
-        controls_setNumberValue(params[0], params[1]);
+        bool ok;
+        double value = params[1].toDouble(&ok);
+        if (ok) controls_setNumberValue(params[0], value);
     } else if (op == QByteArrayLiteral("stringvalue")) {
         controls_setStringValue(params[0], QByteArray::fromHex(params[1]));
     } else if (op == QByteArrayLiteral("slider")) {
-        controls_createSlider(params[0], params[1], params[2], params[3]);
+        bool ok[3];
+        double minValue = params[1].toDouble(&ok[0]);
+        double maxValue = params[2].toDouble(&ok[1]);
+        double initialValue = params[3].toDouble(&ok[2]);
+        if (ok[0] && ok[1] && ok[2]) controls_createSlider(params[0], minValue, maxValue, initialValue);
     } else if (op == QByteArrayLiteral("checkbox")) {
         controls_createCheckbox(params[0], params[1]);
     } else if (op == QByteArrayLiteral("timeseriesplot")) {
@@ -720,11 +751,78 @@ void MainWindow::handleControlCommand(QByteArray cmd)
     }
 }
 
+void MainWindow::readControlChannel()
+{
+    if (!m_controlChannel) return;
+
+    ControlMessage message;
+    bool newFrame = false;
+    while (m_controlChannel->read(&message)) {
+        switch (message.type) {
+        case CONTROL_FRAME:
+            if (message.valueCount < 1) break;
+            m_scriptElapsed = message.values[0];
+            newFrame = true;
+            break;
+        case CONTROL_SAMPLES:
+            for (quint32 i=0; i+sizeof(ControlSample)<=message.textLength; i+=sizeof(ControlSample)) {
+                ControlSample sample;
+                memcpy(&sample, message.text + i, sizeof(sample));
+                controls_setNumberValue(m_controlNames.value(sample.id), sample.value);
+            }
+            break;
+        case CONTROL_SLIDER:
+        {
+            if (message.valueCount < 3) break;
+            QByteArray name(message.text, message.textLength);
+            m_controlNames.insert(message.id, name);
+            controls_createSlider(name, message.values[0], message.values[1], message.values[2], message.id);
+            break;
+        }
+        case CONTROL_PLOT:
+        {
+            QByteArray name(message.text, message.textLength);
+            m_controlNames.insert(message.id, name);
+            controls_createTimeSeriesPlot(name);
+            break;
+        }
+        default:
+            break;
+        }
+    }
+
+    // Plots replot once for however many frames arrived
+    if (newFrame) {
+        emit scriptElapsedChanged(m_scriptElapsed);
+        sendPendingControlValues();
+    }
+}
+
+// Sends the latest value of each slider moved since the last frame. Values that
+// don't fit in the channel are sent after the next one.
+void MainWindow::sendPendingControlValues()
+{
+    QHash<quint32, double>::iterator it = m_pendingControlValues.begin();
+    while (it != m_pendingControlValues.end()) {
+        if (!m_controlChannel->sendNumber(it.key(), it.value())) break;
+        it = m_pendingControlValues.erase(it);
+    }
+}
+
+void MainWindow::addControl(const QByteArray& name, Control* control)
+{
+    control->setObjectName(name);
+    m_controlsByName[name].append(control);
+}
+
 void MainWindow::clearControls()
 {
     while (ui->controlsLayout->count() > 0) {
         delete ui->controlsLayout->itemAt(0)->widget();
     }
+    m_controlsByName.clear();
+    m_controlNames.clear();
+    m_pendingControlValues.clear();
     ui->controlsDockWidget->hide();
 }
 
@@ -746,6 +844,13 @@ void MainWindow::numberControlValueChanged(double value)
 {
     QWidget* widget = qobject_cast<QWidget*> (sender());
     if (!widget) return;
+
+    // Coalesced, so the script gets at most one value per control per frame
+    quint32 id = widget->property("controlId").toUInt();
+    if (m_controlChannel && id) {
+        m_pendingControlValues.insert(id, value);
+        return;
+    }
     sendControlCommand(QByteArrayLiteral("numbervalue"), widget->objectName().toUtf8(), QByteArray::number(value));
 }
 
@@ -985,24 +1090,24 @@ void MainWindow::deleteControl(const QString& name, int type) {
             }
         }
     }
+
+    // Deleted controls were nulled in the index
+    QHash<QByteArray, QList<QPointer<Control> > >::iterator it = m_controlsByName.find(name.toUtf8());
+    if (it != m_controlsByName.end()) {
+        it->removeAll(QPointer<Control>());
+        if (it->isEmpty()) m_controlsByName.erase(it);
+    }
 }
 
-void MainWindow::controls_createSlider(const QByteArray& name, const QByteArray& minValueString,
-                                              const QByteArray& maxValueString, const QByteArray& initialValueString)
+void MainWindow::controls_createSlider(const QByteArray& name, double minValue, double maxValue,
+                                       double initialValue, quint32 id)
 {
     // Delete old slider if it exists
     deleteControl(name, Control::Slider);
 
-    bool ok;
-    double minValue = minValueString.toDouble(&ok);
-    if (!ok) return;
-    double maxValue = maxValueString.toDouble(&ok);
-    if (!ok) return;
-    double initialValue = initialValueString.toDouble(&ok);
-    if (!ok) return;
-
     SliderWithSpinner* widget = new SliderWithSpinner;
-    widget->setObjectName(name);
+    addControl(name, widget);
+    if (id) widget->setProperty("controlId", id);
     widget->setMinValue(minValue);
     widget->setMaxValue(maxValue);
     widget->setValue(initialValue);
@@ -1013,19 +1118,13 @@ void MainWindow::controls_createSlider(const QByteArray& name, const QByteArray&
     ui->controlsDockWidget->show();
 }
 
-void MainWindow::controls_setNumberValue(const QByteArray& name, const QByteArray& valueString)
+void MainWindow::controls_setNumberValue(const QByteArray& name, double value)
 {
-    bool ok;
-    double value = valueString.toDouble(&ok);
-    if (!ok) return;
-
     // Note: there could be multiple controls with the same name
-    for (int row=0; row<ui->controlsLayout->rowCount(); row++) {
-        QLayoutItem* item = ui->controlsLayout->itemAt(row, QFormLayout::FieldRole);
-        if (!item) continue;
-        Control* control = qobject_cast<Control*> (item->widget());
-
-        if (control->objectName() == name) {
+    QHash<QByteArray, QList<QPointer<Control> > >::const_iterator it = m_controlsByName.constFind(name);
+    if (it == m_controlsByName.constEnd()) return;
+    foreach (Control* control, *it) {
+        if (control) {
             switch (control->type())
             {
             case Control::Slider:
@@ -1044,7 +1143,7 @@ void MainWindow::controls_setNumberValue(const QByteArray& name, const QByteArra
 void MainWindow::controls_createTimeSeriesPlot(const QByteArray &name)
 {
     TimeSeriesPlot* plot = new TimeSeriesPlot;
-    plot->setObjectName(name);
+    addControl(name, plot);
     plot->setTitle(name);
     plot->setWindowSize(200);
     //plot->setMinimumPlotInterval(1.0/29);
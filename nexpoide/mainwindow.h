@@ -5,6 +5,8 @@
 #include <QProcess>
 #include <QByteArray>
 #include <QJsonObject>
+#include <QHash>
+#include <QPointer>
 
 namespace Ui {
 class MainWindow;
@@ -16,6 +18,9 @@ class JsonFetcher;
 class ScriptStatusWidget;
 class QJsonObject;
 class HelpModel;
+class Control;
+class ControlChannel;
+class QTimer;
 
 class MainWindow : public QMainWindow
 {
@@ -41,6 +46,7 @@ public slots:
     void scriptProcessStateChanged(QProcess::ProcessState state);
     void scriptProcessStderrReady();
     void scriptProcessStdoutReady();
+    void readControlChannel();
     void updateCurrentEditor();
     void onCurrentEditorChanged(FileEditor*);
     void numberControlValueChanged(double value);
@@ -148,6 +154,14 @@ private:
     qint64 m_scriptStartTime;
     double m_scriptElapsed;
 
+    // Live controls. The channel carries them while a script runs from the IDE,
+    // and the pipe is only used if it couldn't be created.
+    ControlChannel* m_controlChannel;
+    QTimer* m_controlTimer;
+    QHash<QByteArray, QList<QPointer<Control> > > m_controlsByName;
+    QHash<quint32, QByteArray> m_controlNames;          // by the id the script gave each control
+    QHash<quint32, double> m_pendingControlValues;      // slider values to send with the next frame
+
     FileEditor* m_currentEditor;
     ScriptStatusWidget* m_scriptStatusWidget;
     QJsonObject* m_helpData;
@@ -171,12 +185,14 @@ private:
     void sendControlCommand(const QByteArray& op, const QByteArray& param1, const QByteArray& param2);
     void clearControls();
     void deleteControl(const QString& name, int type);
-    void controls_createSlider(const QByteArray& name, const QByteArray& minValueString,
-                                                  const QByteArray& maxValueString, const QByteArray& initialValueString);
+    void addControl(const QByteArray& name, Control* control);
+    void sendPendingControlValues();
+    void controls_createSlider(const QByteArray& name, double minValue, double maxValue,
+                               double initialValue, quint32 id = 0);
     void controls_createTimeSeriesPlot(const QByteArray& name);
 
 
-    void controls_setNumberValue(const QByteArray&, const QByteArray&);
+    void controls_setNumberValue(const QByteArray&, double);
     void controls_setStringValue(const QByteArray&, const QByteArray&);
     void controls_createCheckbox(const QByteArray&, const QByteArray&);
     void loadHelpData();
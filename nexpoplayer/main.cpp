@@ -93,9 +93,11 @@ void run(const std::string& scriptPath)
     // Set working directory to script's directory
     chdir(dirFromPath(scriptPath).c_str());
 
+    // Nexpo buffers console output until nexpo.start returns, so flush whatever a
+    // script that never got that far wrote before exiting
     std::string runCmd = "xpcall(dofile, function(e) io.stderr:write(__traceback and debug.traceback(e) or tostring(e)) end, \""
             + fileFromPath(scriptPath)
-            + "\")";
+            + "\") io.stdout:flush()";
 
     if (luaL_dostring(L, runCmd.c_str()) != 0) {
         std::cerr << "Error executing script call" << std::endl;